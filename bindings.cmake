@@ -10,6 +10,11 @@ add_library(usermod_lv_bindings INTERFACE)
 target_sources(usermod_lv_bindings INTERFACE ${LV_SRC})
 target_include_directories(usermod_lv_bindings INTERFACE ${LV_INCLUDE})
 
+# lvgl is built with the Micropython headers here, so it can read the tick from the port clock (see lv_conf.h).
+# all_lv_bindings() passes the same definitions to the preprocessing of lvgl.h, so the module matches lvgl.
+set(LV_MP_DEFINITIONS LV_TICK_CUSTOM=1)
+target_compile_definitions(usermod_lv_bindings INTERFACE ${LV_MP_DEFINITIONS})
+
 target_link_libraries(usermod_lv_bindings INTERFACE lvgl_interface)
 
 # make usermod (target declared by Micropython for all user compiled modules) link to bindings
@@ -1,4 +1,5 @@
 #include "../include/common.h"
+#include "../include/pixconv.h"
 #include "py/obj.h"
 #include "py/runtime.h"
 #include "py/gc.h"
@@ -235,16 +236,201 @@ void ili9xxx_flush(void *_disp_drv, const void *_area, void *_color_p)
     if ( dt == DISPLAY_TYPE_ILI9488 ) {
         color_size = 3;
         /*Convert ARGB to RGB is required (cut off A-byte)*/
-        size_t i;
-        lv_color32_t* tmp32 = (lv_color32_t*) color_p;
-        color24_t* tmp24 = (color24_t*) color_p;
-
-        for(i=0; i < size; i++) {
-            tmp24[i].red = tmp32[i].red;
-            tmp24[i].green = tmp32[i].green;
-            tmp24[i].blue = tmp32[i].blue;
-        }
+        pixconv_xrgb8888_to_rgb888(color_p, color_p, size);
     }
 
     ili9xxx_send_data_dma(disp_drv, color_p, size * color_size, dc, *spi_ptr);
 }
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// ILI9xxx panel: configuration and SPI transaction descriptors per instance
+//
+// Each flush queues CASET, RASET and RAMWR with their parameters and the pixels, without waiting for the
+// address transactions. The commands and parameters are sent from tx_data, so they need no DMA buffers.
+// DC is set by the pre transaction callback: commands are at even indexes of a descriptor set, below
+// ILI9XXX_PANEL_ADDR_TRANS.
+// Two sets are used alternately, since the last transaction of a flush may still be on its way to the
+// results queue when LVGL calls the next flush.
+//
+// 16 bit pixels are sent directly from the draw buffer.
+// ILI9488 pixels are converted to 24 bit in chunks, into two DMA buffers used alternately: chunk N+1 is
+// converted while chunk N is being transferred.
+
+#define ILI9XXX_PANEL_ADDR_TRANS 5
+#define ILI9XXX_PANEL_TRANS (ILI9XXX_PANEL_ADDR_TRANS + 2)
+#define ILI9XXX_PANEL_SETS 2
+#define ILI9XXX_PANEL_CHUNK_PX 1024  // Multiple of 4, keeps the conversion on words
+
+struct _ili9xxx_panel_t {
+    ili9xxx_panel_config_t config;
+    lv_disp_t *disp;
+    spi_transaction_t trans[ILI9XXX_PANEL_SETS][ILI9XXX_PANEL_TRANS];
+    spi_transaction_t * volatile last;  // Last transaction of the current flush
+    uint32_t *chunk_buf[2];             // Converted pixels, ILI9488 only
+    int set;                            // Next descriptor set
+    int pending;                        // Queued transactions whose results were not retrieved yet
+};
+
+// Index of trans in the panel descriptor sets, or -1 if it's not a panel transaction
+static inline int ili9xxx_panel_trans_index(ili9xxx_panel_t *panel, spi_transaction_t *trans)
+{
+    if (!panel) return -1;
+    spi_transaction_t *first = &panel->trans[0][0];
+    if (trans < first || trans >= first + ILI9XXX_PANEL_SETS * ILI9XXX_PANEL_TRANS) return -1;
+    return (trans - first) % ILI9XXX_PANEL_TRANS;
+}
+
+void ili9xxx_panel_delete(ili9xxx_panel_t *panel);
+
+ili9xxx_panel_t *ili9xxx_panel_create(const ili9xxx_panel_config_t *config)
+{
+    // Accessed from ISR, so it must be in internal RAM
+    ili9xxx_panel_t *panel = heap_caps_calloc(1, sizeof(ili9xxx_panel_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!panel) return NULL;
+    panel->config = *config;
+    for (int s = 0; s < ILI9XXX_PANEL_SETS; s++) {
+        for (int i = 0; i < ILI9XXX_PANEL_TRANS; i++) {
+            panel->trans[s][i].user = panel;
+        }
+    }
+    if (config->display_type == DISPLAY_TYPE_ILI9488) {
+        for (int i = 0; i < 2; i++) {
+            panel->chunk_buf[i] = heap_caps_malloc(ILI9XXX_PANEL_CHUNK_PX * sizeof(color24_t), MALLOC_CAP_DMA);
+            if (!panel->chunk_buf[i]) {
+                ili9xxx_panel_delete(panel);
+                return NULL;
+            }
+        }
+    }
+    return panel;
+}
+
+// Retrieve completed results, until none is left or until trans completed
+static void ili9xxx_panel_reap(ili9xxx_panel_t *panel, spi_transaction_t *trans, TickType_t ticks_to_wait)
+{
+    spi_transaction_t *done;
+    while (panel->pending > 0 && spi_device_get_trans_result(panel->config.spi, &done, ticks_to_wait) == ESP_OK) {
+        panel->pending--;
+        if (done == trans) break;
+    }
+}
+
+void ili9xxx_panel_delete(ili9xxx_panel_t *panel)
+{
+    if (!panel) return;
+    ili9xxx_panel_reap(panel, NULL, portMAX_DELAY);
+    for (int i = 0; i < 2; i++) {
+        if (panel->chunk_buf[i]) heap_caps_free(panel->chunk_buf[i]);
+    }
+    heap_caps_free(panel);
+}
+
+// Called in ISR context!
+void ili9xxx_panel_pre_cb_isr(spi_transaction_t *trans)
+{
+    ili9xxx_panel_t *panel = trans->user;
+    int index = ili9xxx_panel_trans_index(panel, trans);
+    if (index >= 0) gpio_set_level(panel->config.dc, index < ILI9XXX_PANEL_ADDR_TRANS ? index & 1 : 1);
+}
+
+// Called in ISR context!
+void ili9xxx_panel_post_cb_isr(spi_transaction_t *trans)
+{
+    ili9xxx_panel_t *panel = trans->user;
+    if (ili9xxx_panel_trans_index(panel, trans) >= 0 && trans == panel->last)
+        lv_disp_flush_ready(panel->disp);
+}
+
+static inline void ili9xxx_panel_set_cmd(spi_transaction_t *trans, uint8_t cmd)
+{
+    trans->flags = SPI_TRANS_USE_TXDATA;
+    trans->length = 8;
+    trans->tx_data[0] = cmd;
+}
+
+static inline void ili9xxx_panel_set_range(spi_transaction_t *trans, int start, int end)
+{
+    trans->flags = SPI_TRANS_USE_TXDATA;
+    trans->length = 32;
+    trans->tx_data[0] = (start >> 8) & 0xFF;
+    trans->tx_data[1] = start & 0xFF;
+    trans->tx_data[2] = (end >> 8) & 0xFF;
+    trans->tx_data[3] = end & 0xFF;
+}
+
+// On failure the flush is abandoned: flush_ready is called, since the completion of the last transaction won't
+static bool ili9xxx_panel_queue(ili9xxx_panel_t *panel, spi_transaction_t *trans)
+{
+    if (spi_device_queue_trans(panel->config.spi, trans, portMAX_DELAY) != ESP_OK) {
+        panel->last = NULL;
+        lv_disp_flush_ready(panel->disp);
+        return false;
+    }
+    panel->pending++;
+    return true;
+}
+
+void ili9xxx_panel_flush(void *_disp_drv, const void *_area, void *_color_p)
+{
+    lv_disp_t *disp_drv = _disp_drv;
+    const lv_area_t *area = _area;
+    lv_color_t *color_p = _color_p;
+    ili9xxx_panel_t *panel = lv_disp_get_driver_data(disp_drv);
+    const ili9xxx_panel_config_t *config = &panel->config;
+
+    panel->disp = disp_drv;
+
+    // Free the queue slots of the transactions that completed since the last flush
+
+    ili9xxx_panel_reap(panel, NULL, 0);
+
+    spi_transaction_t *trans = panel->trans[panel->set];
+    panel->set = (panel->set + 1) % ILI9XXX_PANEL_SETS;
+
+    ili9xxx_panel_set_cmd(&trans[0], 0x2A);
+    ili9xxx_panel_set_range(&trans[1], area->x1 + config->start_x, area->x2 + config->start_x);
+    ili9xxx_panel_set_cmd(&trans[2], 0x2B);
+    ili9xxx_panel_set_range(&trans[3], area->y1 + config->start_y, area->y2 + config->start_y);
+    ili9xxx_panel_set_cmd(&trans[4], 0x2C);
+
+    size_t size = (area->x2 - area->x1 + 1) * (area->y2 - area->y1 + 1);
+
+    if ( config->display_type != DISPLAY_TYPE_ILI9488 ) {
+        spi_transaction_t *pixels = &trans[ILI9XXX_PANEL_ADDR_TRANS];
+        pixels->flags = 0;
+        pixels->length = size * 2 * 8;
+        pixels->tx_buffer = color_p;
+        panel->last = pixels;
+
+        // Memory write by DMA, ili9xxx_panel_post_cb_isr calls disp_flush_ready when finished
+
+        for (int i = 0; i <= ILI9XXX_PANEL_ADDR_TRANS; i++) {
+            if (!ili9xxx_panel_queue(panel, &trans[i])) return;
+        }
+        return;
+    }
+
+    for (int i = 0; i < ILI9XXX_PANEL_ADDR_TRANS; i++) {
+        if (!ili9xxx_panel_queue(panel, &trans[i])) return;
+    }
+
+    // Convert ARGB to RGB (cut off A-byte) one chunk at a time, while the previous chunk is transferred
+
+    const uint32_t *src = (const uint32_t *) color_p;
+    for (size_t offset = 0, n = 0; offset < size; offset += n) {
+        int ping = (offset / ILI9XXX_PANEL_CHUNK_PX) & 1;
+        spi_transaction_t *chunk = &trans[ILI9XXX_PANEL_ADDR_TRANS + ping];
+        n = size - offset < ILI9XXX_PANEL_CHUNK_PX ? size - offset : ILI9XXX_PANEL_CHUNK_PX;
+
+        // The buffer is free once the transaction that used it two chunks ago completed
+
+        if (offset >= 2 * ILI9XXX_PANEL_CHUNK_PX) ili9xxx_panel_reap(panel, chunk, portMAX_DELAY);
+
+        pixconv_xrgb8888_to_rgb888(panel->chunk_buf[ping], src + offset, n);
+        chunk->flags = 0;
+        chunk->length = n * sizeof(color24_t) * 8;
+        chunk->tx_buffer = panel->chunk_buf[ping];
+        if (offset + n == size) panel->last = chunk;
+        if (!ili9xxx_panel_queue(panel, chunk)) return;
+    }
+}
@@ -241,4 +241,35 @@ void ili9xxx_post_cb_isr(spi_transaction_t *trans);
 
 void ili9xxx_flush(void *disp_drv, const void *area, void *color_p);
 
+/////////////////////////////////////////////////////////////////////////////////////////////
+// ili9xxx panel in C
+//
+// Holds the panel configuration and its own SPI transaction descriptors, so several panels
+// can be used at once. ili9xxx_panel_flush queues the address commands together with the
+// pixels and returns without waiting for the SPI bus. ILI9488 pixels are converted to
+// 24 bit in chunks, each one while the previous one is transferred.
+// Setup: create the SPI device with pre_cb = ili9xxx_panel_pre_cb_isr, post_cb = ili9xxx_panel_post_cb_isr
+// and queue_size = ILI9XXX_PANEL_QUEUE_SIZE, then set the display driver_data to the panel and
+// flush_cb to ili9xxx_panel_flush.
+
+typedef struct {
+    spi_device_handle_t spi;
+    int dc;
+    int display_type;
+    int start_x;
+    int start_y;
+} ili9xxx_panel_config_t;
+
+typedef struct _ili9xxx_panel_t ili9xxx_panel_t;
+
+enum {
+    ENUM_ILI9XXX_PANEL_QUEUE_SIZE = 12,
+};
+
+ili9xxx_panel_t *ili9xxx_panel_create(const ili9xxx_panel_config_t *config);
+void ili9xxx_panel_delete(ili9xxx_panel_t *panel);
+void ili9xxx_panel_pre_cb_isr(spi_transaction_t *trans);
+void ili9xxx_panel_post_cb_isr(spi_transaction_t *trans);
+void ili9xxx_panel_flush(void *disp_drv, const void *area, void *color_p);
+
 
@@ -49,6 +49,9 @@
 # Critical function for high FPS are flush and ISR.
 # when "hybrid=True", use C implementation for these functions instead of
 # pure python implementation. This improves each frame in about 15ms!
+# When the espidf module provides the ili9xxx panel (ili9xxx_panel_create),
+# the hybrid flush queues the address commands and the pixels at once and
+# returns without waiting for the SPI bus.
 #
 # When hybrid=False driver is pure micropython.
 # Pure Micropython could be viable when ESP32 supports Viper code emitter.
@@ -158,17 +161,22 @@ class ili9XXX:
         else:
             raise RuntimeError("Not enough DMA-able memory to allocate display buffer")
 
+        self.panel = None
         self.disp_spi_init()
         self.disp_drv = lv.disp_create(self.width, self.height)
-        self.disp_drv.set_flush_cb(esp.ili9xxx_flush if hybrid and hasattr(esp, 'ili9xxx_flush') else self.flush)
         self.disp_drv.set_draw_buffers(self.buf1, self.buf2, self.buf_size, lv.DISP_RENDER_MODE.PARTIAL)
 
-        self.disp_drv.set_driver_data({
-            'dc': self.dc,
-            'spi': self.spi,
-            'dt': self.display_type,
-            'start_x': self.start_x,
-            'start_y': self.start_y})
+        if self.panel:
+            self.disp_drv.set_flush_cb(esp.ili9xxx_panel_flush)
+            self.disp_drv.set_driver_data(self.panel)
+        else:
+            self.disp_drv.set_flush_cb(esp.ili9xxx_flush if hybrid and hasattr(esp, 'ili9xxx_flush') else self.flush)
+            self.disp_drv.set_driver_data({
+                'dc': self.dc,
+                'spi': self.spi,
+                'dt': self.display_type,
+                'start_x': self.start_x,
+                'start_y': self.start_y})
 
         # TODO: enable monitor by listening to LV_EVENT_RENDER_READY
         # self.disp_drv.monitor_cb = self.monitor
@@ -211,7 +219,13 @@ class ili9XXX:
             "duty_cycle_pos": 128,
         })
 
-        if self.hybrid and hasattr(esp, 'ili9xxx_post_cb_isr'):
+        native_panel = self.hybrid and hasattr(esp, 'ili9xxx_panel_create')
+
+        if native_panel:
+            devcfg.queue_size = esp.ILI9XXX_PANEL_QUEUE_SIZE
+            devcfg.pre_cb = esp.ili9xxx_panel_pre_cb_isr
+            devcfg.post_cb = esp.ili9xxx_panel_post_cb_isr
+        elif self.hybrid and hasattr(esp, 'ili9xxx_post_cb_isr'):
             devcfg.pre_cb = None
             devcfg.post_cb = esp.ili9xxx_post_cb_isr
         else:
@@ -249,6 +263,16 @@ class ili9XXX:
         if ret != 0: raise RuntimeError("Failed adding SPI device")
         self.spi = ptr_to_spi.ptr_val
 
+        if native_panel:
+            self.panel = esp.ili9xxx_panel_create(esp.ili9xxx_panel_config_t({
+                "spi": self.spi,
+                "dc": self.dc,
+                "display_type": self.display_type,
+                "start_x": self.start_x,
+                "start_y": self.start_y,
+            }))
+            if not self.panel: raise RuntimeError("Failed creating ili9xxx panel")
+
         self.bytes_transmitted = 0
         completed_spi_transaction = esp.spi_transaction_t()
         cast_spi_transaction_instance = esp.spi_transaction_t.__cast_instance__
@@ -292,6 +316,13 @@ class ili9XXX:
 
         self.disp.remove()
 
+        if self.panel:
+
+            # Waits for the panel transactions and frees it
+
+            esp.ili9xxx_panel_delete(self.panel)
+            self.panel = None
+
         if self.spi:
 
             # Pop all pending transaction results
@@ -151,13 +151,14 @@ class Ili9341_hw(st77xx.St77xx_hw):
 
     def apply_rotation(self, rot):
         self.rot = rot
+        self.hw_rot = 0 if self.sw_rot else self.rot % 4
         if (self.rot % 2) == 0:
             self.width, self.height = self.res
         else:
             self.height, self.width = self.res
         self.write_register(
             _MADCTL,
-            bytes([_MADCTL_BGR | _MADCTL_ROTS[self.rot % 4]]),
+            bytes([_MADCTL_BGR | _MADCTL_ROTS[self.hw_rot]]),
         )
 
 
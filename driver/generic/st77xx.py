@@ -169,7 +169,7 @@ ST77XX_INV_PORTRAIT = const(2)
 ST77XX_INV_LANDSCAPE = const(3)
 
 class St77xx_hw(object):
-    def __init__(self, *, cs, dc, spi, res, suppRes, bl=None, model=None, suppModel=[], rst=None, rot=ST77XX_LANDSCAPE, bgr=False, rp2_dma=None):
+    def __init__(self, *, cs, dc, spi, res, suppRes, bl=None, model=None, suppModel=[], rst=None, rot=ST77XX_LANDSCAPE, bgr=False, rp2_dma=None, sw_rot=False):
         '''
         This is an abstract low-level driver the ST77xx controllers, not to be instantiated directly.
         Derived classes implement chip-specific bits. THe following parameters are recognized:
@@ -183,6 +183,7 @@ class St77xx_hw(object):
         * *rot*: display orientation (0: portrait, 1: landscape, 2: inverted portrait, 3: inverted landscape); the constants ST77XX_PORTRAIT, ST77XX_LANDSCAPE, ST77XX_INV_POTRAIT, ST77XX_INV_LANDSCAPE may be used.
         * *bgr*: color order if BGR (not RGB)
         * *rp2_dma*: optional DMA object for the rp2 port
+        * *sw_rot*: rotate the pixels in software (lvgl.pixconv) rather than with MADCTL, which then stays in portrait orientation; for modules where MADCTL rotation is broken. Costs a scratch buffer of the draw buffer size.
 
 
         Subclass constructors (implementing concrete chip) set in addition the following, not to be used directly:
@@ -202,6 +203,7 @@ class St77xx_hw(object):
         self.set_backlight(10) # set some backlight
 
         self.rot=rot
+        self.sw_rot=sw_rot
         self.bgr=bgr
         self.width,self.height=(0,0) # this is set later in hard_reset->config->apply_rotation
 
@@ -232,7 +234,7 @@ class St77xx_hw(object):
         if self.bl is None: return
         self.bl.duty_u16(percent*655)
     def set_window(self, x, y, w, h):
-        c0,r0=ST77XX_COL_ROW_MODEL_START_ROTMAP[self.res[0],self.res[1],self.model][self.rot%4]
+        c0,r0=ST77XX_COL_ROW_MODEL_START_ROTMAP[self.res[0],self.res[1],self.model][self.hw_rot]
         struct.pack_into('>hh', self.buf4, 0, c0+x, c0+x+w-1)
         self.write_register(ST77XX_CASET, self.buf4)
         struct.pack_into('>hh', self.buf4, 0, r0+y, r0+y+h-1)
@@ -240,9 +242,10 @@ class St77xx_hw(object):
 
     def apply_rotation(self,rot):
         self.rot=rot
+        self.hw_rot=0 if self.sw_rot else self.rot%4 # rotation set in MADCTL
         if (self.rot%2)==0: self.width,self.height=self.res
         else: self.height,self.width=self.res
-        self.write_register(ST77XX_MADCTL,bytes([(ST77XX_MADCTL_BGR if self.bgr else 0)|ST77XX_MADCTL_ROTS[self.rot%4]]))
+        self.write_register(ST77XX_MADCTL,bytes([(ST77XX_MADCTL_BGR if self.bgr else 0)|ST77XX_MADCTL_ROTS[self.hw_rot]]))
 
     def blit(self, x, y, w, h, buf, is_blocking=True):
         self.set_window(x, y, w, h)
@@ -254,7 +257,8 @@ class St77xx_hw(object):
         struct.pack_into('>h',self.buf2,0,color)
         buf=bs*bytes(self.buf2)
         npx=self.width*self.height
-        self.set_window(0, 0, self.width, self.height)
+        if self.sw_rot: self.set_window(0, 0, *self.res)
+        else: self.set_window(0, 0, self.width, self.height)
         self.write_register(ST77XX_RAMWR, None)
         self.cs.value(0)
         self.dc.value(1)
@@ -438,8 +442,19 @@ class St77xx_lvgl(object):
     def disp_drv_flush_cb(self,disp_drv,area,color):
         # print(f"({area.x1},{area.y1}..{area.x2},{area.y2})")
         self.rp2_wait_dma() # wait if not yet done and DMA is being used
+        x,y,w,h=area.x1,area.y1,area.x2-area.x1+1,area.y2-area.y1+1
+        buf=color.__dereference__(2*w*h)
+        if self.sw_rot and self.rot%4:
+            # rotate into rot_buf, which is not touched by LVGL while it is being sent;
+            # the area is mapped to the controller's (portrait) coordinates, as MADCTL would
+            q=self.rot%4
+            self.rotate16(self.rot_buf,buf,w,h,q)
+            buf=memoryview(self.rot_buf)[:2*w*h]
+            if q==1: x,y,w,h=self.height-y-h,x,h,w
+            elif q==2: x,y=self.width-x-w,self.height-y-h
+            else: x,y,w,h=y,self.width-x-w,h,w
         # blit in background
-        self.blit(area.x1,area.y1,w:=(area.x2-area.x1+1),h:=(area.y2-area.y1+1),color.__dereference__(2*w*h),is_blocking=False)
+        self.blit(x,y,w,h,buf,is_blocking=False)
         self.disp_drv.flush_ready()
     def __init__(self,doublebuffer=True,factor=4):
         import lvgl as lv
@@ -448,6 +463,10 @@ class St77xx_lvgl(object):
         if lv.COLOR_DEPTH!=16: raise RuntimeError(f'LVGL *must* be compiled with LV_COLOR_DEPTH=16 (currently LV_COLOR_DEPTH={lv.COLOR_DEPTH}.')
         
         bufSize=(self.width*self.height*lv.color_t.__SIZE__)//factor
+        if self.sw_rot:
+            if not hasattr(lv,'pixconv'): raise RuntimeError('sw_rot needs lvgl.pixconv')
+            self.rotate16=lv.pixconv.rotate16
+            self.rot_buf=bytearray(bufSize)
 
         if not lv.is_initialized(): lv.init()
         # create event loop if not yet present
@@ -0,0 +1,269 @@
+#ifndef __LVMP_PIXCONV_H
+#define __LVMP_PIXCONV_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////////
+// Pixel format conversion kernels for display flush paths
+//
+// Each kernel converts n pixels from src to dst. dst may be src (in place),
+// but the buffers must not overlap otherwise.
+// 32 bit pixels are in LVGL's XRGB8888 layout: bytes B, G, R, X in memory.
+// 24 bit pixels keep that byte order (B, G, R). RGB565 pixels are native
+// endian 16 bit words.
+//
+// When src and dst are word aligned on a little endian CPU, the kernels work
+// on 32 bit words, several pixels at a time. Otherwise they fall back to
+// byte access, so any alignment is fine.
+// Define PIXCONV_WORD as 0 to always use the fallback.
+//
+
+#ifndef PIXCONV_WORD
+#   if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#       define PIXCONV_WORD 1
+#   else
+#       define PIXCONV_WORD 0
+#   endif
+#endif
+
+typedef void (*pixconv_kernel_t)(void *dst, const void *src, size_t n);
+
+static inline int pixconv_aligned(const void *dst, const void *src)
+{
+    return PIXCONV_WORD && (((uintptr_t)dst | (uintptr_t)src) & 3) == 0;
+}
+
+// RGB565 byte swap, for controllers that take the high byte first
+
+static inline void pixconv_rgb565_swap(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t i = 0;
+
+    if (pixconv_aligned(d, s)) {
+        for (; i + 2 <= n; i += 2, s += 4, d += 4) {
+            uint32_t w = *(const uint32_t *)s;
+            *(uint32_t *)d = ((w & 0x00FF00FF) << 8) | ((w >> 8) & 0x00FF00FF);
+        }
+    }
+
+    for (; i < n; i++, s += 2, d += 2) {
+        uint8_t lo = s[0];
+        d[0] = s[1];
+        d[1] = lo;
+    }
+}
+
+// RGB565 red and blue swap (RGB <-> BGR)
+
+static inline void pixconv_rgb565_swap_rb(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t i = 0;
+
+    if (pixconv_aligned(d, s)) {
+        for (; i + 2 <= n; i += 2, s += 4, d += 4) {
+            uint32_t w = *(const uint32_t *)s;
+            *(uint32_t *)d = (w & 0x07E007E0) | ((w >> 11) & 0x001F001F) | ((w & 0x001F001F) << 11);
+        }
+    }
+
+    for (; i < n; i++, s += 2, d += 2) {
+        uint16_t p;
+        memcpy(&p, s, 2);
+        p = (p & 0x07E0) | (p >> 11) | (p << 11);
+        memcpy(d, &p, 2);
+    }
+}
+
+// XRGB8888 red and blue swap (RGB <-> BGR). X is kept
+
+static inline void pixconv_xrgb8888_swap_rb(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t i = 0;
+
+    if (pixconv_aligned(d, s)) {
+        for (; i < n; i++, s += 4, d += 4) {
+            uint32_t w = *(const uint32_t *)s;
+            *(uint32_t *)d = (w & 0xFF00FF00) | ((w >> 16) & 0xFF) | ((w & 0xFF) << 16);
+        }
+    }
+
+    for (; i < n; i++, s += 4, d += 4) {
+        uint8_t b = s[0];
+        d[0] = s[2];
+        d[1] = s[1];
+        d[2] = b;
+        d[3] = s[3];
+    }
+}
+
+// RGB888 red and blue swap (RGB <-> BGR)
+
+static inline void pixconv_rgb888_swap_rb(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    for (size_t i = 0; i < n; i++, s += 3, d += 3) {
+        uint8_t b = s[0];
+        d[0] = s[2];
+        d[1] = s[1];
+        d[2] = b;
+    }
+}
+
+// XRGB8888 to RGB888 (cut off the X byte), 4 pixels to 3 words.
+// mask is applied to every output byte: 0xFF for RGB888, 0xFC for RGB666 (18 bit mode, 3 bytes per pixel)
+
+static inline void pixconv_xrgb8888_to_rgb888_masked(void *dst, const void *src, size_t n, uint8_t mask)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t i = 0;
+
+    if (pixconv_aligned(d, s)) {
+        uint32_t m = mask * 0x01010101u;
+        for (; i + 4 <= n; i += 4, s += 16, d += 12) {
+            const uint32_t *sw = (const uint32_t *)s;
+            uint32_t *dw = (uint32_t *)d;
+            uint32_t p0 = sw[0], p1 = sw[1], p2 = sw[2], p3 = sw[3];
+            dw[0] = ((p0 & 0xFFFFFF) | (p1 << 24)) & m;
+            dw[1] = (((p1 >> 8) & 0xFFFF) | (p2 << 16)) & m;
+            dw[2] = (((p2 >> 16) & 0xFF) | (p3 << 8)) & m;
+        }
+    }
+
+    for (; i < n; i++, s += 4, d += 3) {
+        uint8_t b = s[0], g = s[1], r = s[2];
+        d[0] = b & mask;
+        d[1] = g & mask;
+        d[2] = r & mask;
+    }
+}
+
+static inline void pixconv_xrgb8888_to_rgb888(void *dst, const void *src, size_t n)
+{
+    pixconv_xrgb8888_to_rgb888_masked(dst, src, n, 0xFF);
+}
+
+static inline void pixconv_xrgb8888_to_rgb666(void *dst, const void *src, size_t n)
+{
+    pixconv_xrgb8888_to_rgb888_masked(dst, src, n, 0xFC);
+}
+
+// 8 bit values (L8, A8) to 1 bpp, first pixel in the most significant bit.
+// A bit is set when the value is at least threshold. The last byte is padded with zeros
+
+static inline void pixconv_pack_1bpp(void *dst, const void *src, size_t n, uint8_t threshold)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8, s += 8) {
+        *d++ = (s[0] >= threshold) << 7 | (s[1] >= threshold) << 6 | (s[2] >= threshold) << 5 | (s[3] >= threshold) << 4 |
+               (s[4] >= threshold) << 3 | (s[5] >= threshold) << 2 | (s[6] >= threshold) << 1 | (s[7] >= threshold);
+    }
+
+    if (i < n) {
+        uint8_t byte = 0;
+        for (int bit = 7; i < n; i++, bit--) {
+            byte |= (*s++ >= threshold) << bit;
+        }
+        *d = byte;
+    }
+}
+
+// 8 bit values (L8, A8) to 4 bpp (the high nibble), first pixel in the high nibble.
+// The last byte is padded with zeros
+
+static inline void pixconv_pack_4bpp(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    size_t i = 0;
+
+    if (pixconv_aligned(s, s)) {
+        for (; i + 4 <= n; i += 4, s += 4, d += 2) {
+            uint32_t w = *(const uint32_t *)s;
+            uint32_t t = (w & 0x00F000F0) | ((w >> 12) & 0x000F000F);
+            d[0] = t;
+            d[1] = t >> 16;
+        }
+    }
+
+    for (; i + 2 <= n; i += 2, s += 2) {
+        *d++ = (s[0] & 0xF0) | (s[1] >> 4);
+    }
+
+    if (i < n) {
+        *d = s[0] & 0xF0;
+    }
+}
+
+// Rotation of a w x h block of 16 or 32 bit pixels clockwise by quarter_turns * 90 degrees.
+// The result is h x w for 90 and 270 degrees. Buffers must be aligned to the pixel size.
+// 0 and 180 degrees may run in place. 90 and 270 degrees need separate buffers: they go through
+// tile x tile pixel tiles, so both the rows read and the columns written stay in cache.
+
+#ifndef PIXCONV_ROTATE_TILE
+#   define PIXCONV_ROTATE_TILE 16
+#endif
+
+#define PIXCONV_DEFINE_ROTATE(name, pixel_t) \
+static inline void name##_tiled(void *dst, const void *src, uint32_t w, uint32_t h, unsigned quarter_turns, uint32_t tile) \
+{ \
+    pixel_t *d = dst; \
+    const pixel_t *s = src; \
+    size_t n = (size_t)w * h; \
+    switch (quarter_turns & 3) { \
+        case 0: \
+            if (d != s) memmove(d, s, n * sizeof(pixel_t)); \
+            break; \
+        case 2: \
+            if (d == s) { \
+                for (size_t i = 0, j = n - 1; i < j; i++, j--) { \
+                    pixel_t t = d[i]; \
+                    d[i] = d[j]; \
+                    d[j] = t; \
+                } \
+            } else { \
+                for (size_t i = 0; i < n; i++) d[n - 1 - i] = s[i]; \
+            } \
+            break; \
+        default: \
+            for (uint32_t ty = 0; ty < h; ty += tile) { \
+                uint32_t ye = ty + tile < h ? ty + tile : h; \
+                for (uint32_t tx = 0; tx < w; tx += tile) { \
+                    uint32_t xe = tx + tile < w ? tx + tile : w; \
+                    for (uint32_t y = ty; y < ye; y++) { \
+                        const pixel_t *row = s + (size_t)y * w; \
+                        if ((quarter_turns & 3) == 1) { \
+                            pixel_t *col = d + (h - 1 - y); \
+                            for (uint32_t x = tx; x < xe; x++) col[(size_t)x * h] = row[x]; \
+                        } else { \
+                            pixel_t *col = d + y; \
+                            for (uint32_t x = tx; x < xe; x++) col[(size_t)(w - 1 - x) * h] = row[x]; \
+                        } \
+                    } \
+                } \
+            } \
+    } \
+} \
+\
+static inline void name(void *dst, const void *src, uint32_t w, uint32_t h, unsigned quarter_turns) \
+{ \
+    name##_tiled(dst, src, w, h, quarter_turns, PIXCONV_ROTATE_TILE); \
+}
+
+PIXCONV_DEFINE_ROTATE(pixconv_rotate16, uint16_t)
+PIXCONV_DEFINE_ROTATE(pixconv_rotate32, uint32_t)
+
+#endif // __LVMP_PIXCONV_H
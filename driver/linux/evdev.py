@@ -30,50 +30,76 @@ class crosshair_cursor:
         self.cursor_ver.delete()
 
 # evdev driver for mouse
+# When an lv_epoll.event_loop is provided, the device is read when the loop
+# reports it readable, and the input is processed immediately. Otherwise it is
+# polled (without blocking) on every read.
 class mouse_indev:
-    def __init__(self, scr=None, cursor=None, device='/dev/input/mice'):
+    def __init__(self, scr=None, cursor=None, device='/dev/input/mice', event_loop=None):
 
         # Open evdev and initialize members
         self.evdev = open(device, 'rb')
-        self.poll = select.poll()
-        self.poll.register(self.evdev.fileno())
         self.scr = scr if scr else lv.scr_act()
         self.cursor = cursor if cursor else crosshair_cursor(self.scr)
         self.hor_res = self.scr.get_width()
         self.ver_res = self.scr.get_height()
+        self.x = 0
+        self.y = 0
+        self.state = lv.INDEV_STATE.RELEASED
+        self.moved = False
+        self.event_loop = event_loop
+        if self.event_loop:
+            self.event_loop.register(self.evdev.fileno(), self.evdev_ready)
+        else:
+            self.poll = select.poll()
+            self.poll.register(self.evdev.fileno(), select.POLLIN)
 
         # Register LVGL indev driver
         self.indev = lv.indev_create()
         self.indev.set_type(lv.INDEV_TYPE.POINTER)
         self.indev.set_read_cb(self.mouse_read)
 
-    def mouse_read(self, indev, data) -> int:
-        
-        # Check if there is input to be read from evdev
-        if not self.poll.poll()[0][1] & select.POLLIN:
-            return 0
+    def evdev_ready(self, fd, events):
+        self.read_evdev()
+        # Process the input now instead of waiting for the next read period
+        self.indev.get_read_timer().ready()
+
+    def read_evdev(self):
 
         # Read and parse evdev mouse data
         mouse_data = ustruct.unpack('bbb',self.evdev.read(3))
 
         # Data is relative, update coordinates
-        data.point.x += mouse_data[1]
-        data.point.y -= mouse_data[2]
+        self.x += mouse_data[1]
+        self.y -= mouse_data[2]
 
         # Handle coordinate overflow cases
-        data.point.x = min(data.point.x, self.hor_res - 1)
-        data.point.y = min(data.point.y, self.ver_res - 1)
-        data.point.x = max(data.point.x, 0)
-        data.point.y = max(data.point.y, 0)
+        self.x = max(min(self.x, self.hor_res - 1), 0)
+        self.y = max(min(self.y, self.ver_res - 1), 0)
 
         # Update "pressed" status
-        data.state = lv.INDEV_STATE.PRESSED if ((mouse_data[0] & 1) == 1) else lv.INDEV_STATE.RELEASED
+        self.state = lv.INDEV_STATE.PRESSED if ((mouse_data[0] & 1) == 1) else lv.INDEV_STATE.RELEASED
+        self.moved = True
+
+    def mouse_read(self, indev, data) -> int:
+
+        # Check if there is input to be read from evdev
+        if not self.event_loop:
+            events = self.poll.poll(0)
+            if events and events[0][1] & select.POLLIN:
+                self.read_evdev()
+
+        data.point.x = self.x
+        data.point.y = self.y
+        data.state = self.state
 
         # Draw cursor, if needed
-        if self.cursor: self.cursor(data)
+        if self.cursor and self.moved: self.cursor(data)
+        self.moved = False
         return 0
 
     def delete(self):
+        if self.event_loop:
+            self.event_loop.unregister(self.evdev.fileno())
         self.evdev.close()
         if self.cursor and hasattr(self.cursor, 'delete'):
             self.cursor.delete()
@@ -0,0 +1,240 @@
+##############################################################################
+# Event loop for the unix port, based on epoll and timerfd.
+#
+# Waits for the next lvgl timer deadline (a timerfd), input devices and user
+# file descriptors in a single epoll_wait. Input is handled as soon as it
+# arrives, and the process sleeps otherwise. Unlike lv_utils.event_loop with
+# lv_timer, no signals are used, so syscalls are not interrupted.
+#
+# The loop runs on the calling thread, from run() (or run_once()).
+# Callbacks registered with register() are called from the loop.
+#
+# Usage example with fbdev and evdev:
+#
+#        import lv_epoll
+#        event_loop = lv_epoll.event_loop()
+#        disp = lv.linux_fbdev_create()
+#        lv.linux_fbdev_set_file(disp, "/dev/fb0")
+#        mouse = evdev.mouse_indev(event_loop=event_loop)
+#        event_loop.register(sock.fileno(), lambda fd, events: handle(sock))
+#        event_loop.run()
+#
+# wake() can be called from another thread or a signal handler, to make the
+# loop run the lvgl task handler without waiting for the next deadline.
+#
+##############################################################################
+
+import ffi
+import uctypes
+import ustruct
+import os
+import usys
+import time
+import lvgl as lv
+
+# FFI libraries
+
+libc = ffi.open("libc.so.6")
+
+# C constants
+
+CLOCK_MONOTONIC = 1
+EPOLL_CLOEXEC = 0o2000000
+EPOLL_CTL_ADD = 1
+EPOLL_CTL_DEL = 2
+EPOLL_CTL_MOD = 3
+EPOLLIN = 0x001
+EPOLLPRI = 0x002
+EPOLLOUT = 0x004
+EPOLLERR = 0x008
+EPOLLHUP = 0x010
+TFD_CLOEXEC = 0o2000000
+TFD_NONBLOCK = 0o4000
+EFD_CLOEXEC = 0o2000000
+EFD_NONBLOCK = 0o4000
+
+# struct epoll_event {uint32_t events; epoll_data_t data;} is packed on x86_64 only.
+# The fd is kept in the low 32 bits of data.
+
+if os.uname().machine == 'x86_64':
+    EPOLL_EVENT_FMT = '<IiI'
+else:
+    EPOLL_EVENT_FMT = 'IIiI'
+EPOLL_EVENT_SIZE = ustruct.calcsize(EPOLL_EVENT_FMT)
+MAX_EVENTS = 16
+
+# C structs
+
+timespec_t = {
+    "tv_sec": 0 | uctypes.INT64,
+    "tv_nsec": 8 | uctypes.INT64,
+}
+
+itimerspec_t = {
+    "it_interval": (0, timespec_t),
+    "it_value": (16, timespec_t),
+}
+
+# C functions
+
+epoll_create1_ = libc.func("i", "epoll_create1", "i")
+epoll_ctl_ = libc.func("i", "epoll_ctl", "iiip")
+epoll_wait_ = libc.func("i", "epoll_wait", "ipii")
+timerfd_create_ = libc.func("i", "timerfd_create", "ii")
+timerfd_settime_ = libc.func("i", "timerfd_settime", "iipp")
+eventfd_ = libc.func("i", "eventfd", "Ii")
+read_ = libc.func("l", "read", "ipl")
+write_ = libc.func("l", "write", "iPl")
+close_ = libc.func("i", "close", "i")
+
+def check(r, name):
+    if r < 0:
+        raise RuntimeError("%s error: %d (errno = %d)" % (name, r, os.errno()))
+    return r
+
+# Does lvgl read the tick from a clock, or does it need lv.tick_inc?
+
+tick_custom = getattr(lv, 'TICK_CUSTOM', 0)
+
+# Callbacks wrapped with lv.deferred are queued, and run after the task handler
+
+run_deferred = getattr(lv, 'run_deferred', None)
+
+# Run the task handler through lv.telemetry when available, so it can record the handler time of each frame
+
+task_handler = lv.telemetry.timer_handler if hasattr(lv, 'telemetry') else lv.task_handler
+
+##############################################################################
+
+class event_loop():
+
+    _current_instance = None
+
+    def __init__(self, max_delay=500, refresh_cb=None, exception_sink=None):
+        if self.is_running():
+            raise RuntimeError("Event loop is already running!")
+
+        if not lv.is_initialized():
+            lv.init()
+
+        self.max_delay = max_delay
+        self.refresh_cb = refresh_cb
+        self.exception_sink = exception_sink if exception_sink else self.default_exception_sink
+        self.disabled = 0
+        self.callbacks = {}
+        self.last_tick = time.ticks_ms()
+
+        # Preallocate everything that is used on each iteration
+        self.events = bytearray(EPOLL_EVENT_SIZE * MAX_EVENTS)
+        self.event = bytearray(EPOLL_EVENT_SIZE)
+        self.counter = bytearray(8)
+        self.wake_counter = ustruct.pack('Q', 1)
+        self.timerspec = bytearray(uctypes.sizeof(itimerspec_t))
+        self.timer_value = uctypes.struct(uctypes.addressof(self.timerspec), itimerspec_t, uctypes.NATIVE).it_value
+
+        self.epfd = check(epoll_create1_(EPOLL_CLOEXEC), "epoll_create1")
+        self.timerfd = check(timerfd_create_(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC), "timerfd_create")
+        self.wakefd = check(eventfd_(0, EFD_NONBLOCK | EFD_CLOEXEC), "eventfd")
+        self._ctl(EPOLL_CTL_ADD, self.timerfd, EPOLLIN)
+        self._ctl(EPOLL_CTL_ADD, self.wakefd, EPOLLIN)
+
+        event_loop._current_instance = self
+
+    def deinit(self):
+        if event_loop._current_instance is not self:
+            return
+        event_loop._current_instance = None
+        close_(self.timerfd)
+        close_(self.wakefd)
+        close_(self.epfd)
+
+    def disable(self):
+        self.disabled += 1
+
+    def enable(self):
+        self.disabled -= 1
+        if self.disabled == 0:
+            self.wake()
+
+    def wake(self):
+        # Can be called from another thread or from a signal handler
+        write_(self.wakefd, self.wake_counter, 8)
+
+    @staticmethod
+    def is_running():
+        return event_loop._current_instance is not None
+
+    @staticmethod
+    def current_instance():
+        return event_loop._current_instance
+
+    def register(self, fd, callback, events=EPOLLIN):
+        # callback(fd, events) is called when fd is ready
+        op = EPOLL_CTL_MOD if fd in self.callbacks else EPOLL_CTL_ADD
+        self._ctl(op, fd, events)
+        self.callbacks[fd] = callback
+
+    def unregister(self, fd):
+        if fd in self.callbacks:
+            del self.callbacks[fd]
+            self._ctl(EPOLL_CTL_DEL, fd, 0)
+
+    def run(self):
+        while event_loop._current_instance is self:
+            self.run_once()
+
+    def run_once(self, timeout=-1):
+        # Run lvgl if needed, then wait up to timeout ms (-1: no timeout) for the next deadline or fd event
+        if self.disabled == 0 and lv._nesting.value == 0:
+            self._arm(self.task_handler())
+
+        n = epoll_wait_(self.epfd, self.events, MAX_EVENTS, timeout)
+        if n < 0:
+            if os.errno() == 4: # EINTR
+                return
+            check(n, "epoll_wait")
+        for i in range(n):
+            fields = ustruct.unpack_from(EPOLL_EVENT_FMT, self.events, i * EPOLL_EVENT_SIZE)
+            events, fd = fields[0], fields[-2]
+            if fd == self.timerfd or fd == self.wakefd:
+                read_(fd, self.counter, 8)
+            else:
+                callback = self.callbacks.get(fd)
+                if callback:
+                    try:
+                        callback(fd, events)
+                    except Exception as e:
+                        self.exception_sink(e)
+            if event_loop._current_instance is not self:
+                break
+
+    def task_handler(self):
+        try:
+            if not tick_custom:
+                now = time.ticks_ms()
+                lv.tick_inc(time.ticks_diff(now, self.last_tick))
+                self.last_tick = now
+            delay = task_handler()
+            if run_deferred: run_deferred()
+            if self.refresh_cb: self.refresh_cb()
+            return delay
+        except Exception as e:
+            if self.exception_sink:
+                self.exception_sink(e)
+            return self.max_delay
+
+    def default_exception_sink(self, e):
+        usys.print_exception(e)
+        self.deinit()
+
+    def _arm(self, delay):
+        # lv.timer_handler returns LV_NO_TIMER_READY when there are no timers
+        delay = max(1, min(delay, self.max_delay))
+        self.timer_value.tv_sec = delay // 1000
+        self.timer_value.tv_nsec = (delay % 1000) * 1000000
+        if event_loop._current_instance is self:
+            check(timerfd_settime_(self.timerfd, 0, self.timerspec, None), "timerfd_settime")
+
+    def _ctl(self, op, fd, events):
+        ustruct.pack_into(EPOLL_EVENT_FMT, self.event, 0, *((events, fd, 0) if EPOLL_EVENT_SIZE == 12 else (events, 0, fd, 0)))
+        check(epoll_ctl_(self.epfd, op, fd, self.event), "epoll_ctl")
@@ -0,0 +1,200 @@
+##############################################################################
+# Decoder and reference viewer for the lvgl.remote_display stream.
+#
+# lvgl.remote_display streams the tiles of the screen that changed in each
+# frame, run length encoded, to a socket, pipe or file (see its description in
+# gen/gen_mpy.py for the stream format). decoder rebuilds the frames from the
+# stream. It runs on MicroPython and on CPython, so the screen of a headless
+# box can be viewed from a desktop:
+#
+#        python3 driver/linux/lv_remote.py kiosk.local 5900 screen.ppm
+#
+# connects to the box, and rewrites screen.ppm after every frame.
+#
+# On the box, listen and hand the connection to the display:
+#
+#        import socket
+#        remote = lv.remote_display(480, 320)
+#        srv = socket.socket()
+#        srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+#        srv.bind(socket.getaddrinfo('0.0.0.0', 5900)[0][-1])
+#        srv.listen(1)
+#        conn, addr = srv.accept()
+#        remote.connect(conn.fileno())
+#        pointer = lv_remote.pointer_indev(conn)
+#
+# The viewer can drive the UI by sending pointer records on the same
+# connection: 'P' x:u16 y:u16 pressed:u8 (see send_pointer). pointer_indev
+# reads them on the box, as an LVGL pointer input device.
+#
+##############################################################################
+
+try:
+    import ustruct as struct
+except ImportError:
+    import struct
+
+HEADER_SIZE = 12
+TILE_HEADER_SIZE = 14
+FRAME_SIZE = 5
+POINTER_SIZE = 6
+
+# on_frame(decoder) is called when a frame is complete, with the frame in fb
+
+class decoder:
+    def __init__(self, on_frame=None):
+        self.on_frame = on_frame
+        self.buf = bytearray()
+        self.fb = None
+        self.width = self.height = self.px_size = self.color_format = self.tile = 0
+        self.frames = 0         # Frames completed
+        self.frame = -1         # Number of the last frame completed, as sent
+        self.tiles = 0
+        self.bytes = 0
+
+    # Decode data from the stream. Returns the number of frames it completed
+    def feed(self, data):
+        self.buf.extend(data)
+        self.bytes += len(data)
+        buf = self.buf
+        pos = 0
+        done = 0
+        while True:
+            if self.fb is None:
+                if len(buf) - pos < HEADER_SIZE:
+                    break
+                if buf[pos:pos + 4] != b'LVRD' or buf[pos + 4] != 1:
+                    raise ValueError('Not a remote display stream')
+                self.px_size, self.color_format, self.tile = buf[pos + 5], buf[pos + 6], buf[pos + 7]
+                self.width, self.height = struct.unpack_from('<HH', buf, pos + 8)
+                self.fb = bytearray(self.width * self.height * self.px_size)
+                pos += HEADER_SIZE
+                continue
+            if len(buf) - pos < 1:
+                break
+            kind = buf[pos]
+            if kind == ord('E'):
+                if len(buf) - pos < FRAME_SIZE:
+                    break
+                self.frame = struct.unpack_from('<I', buf, pos + 1)[0]
+                self.frames += 1
+                done += 1
+                pos += FRAME_SIZE
+                if self.on_frame:
+                    self.on_frame(self)
+            elif kind == ord('T'):
+                if len(buf) - pos < TILE_HEADER_SIZE:
+                    break
+                x, y, w, h, encoding, length = struct.unpack_from('<HHHHBI', buf, pos + 1)
+                if len(buf) - pos < TILE_HEADER_SIZE + length:
+                    break
+                self._tile(x, y, w, h, encoding, memoryview(buf)[pos + TILE_HEADER_SIZE:pos + TILE_HEADER_SIZE + length])
+                self.tiles += 1
+                pos += TILE_HEADER_SIZE + length
+            else:
+                raise ValueError('Unknown record %r' % kind)
+        if pos:
+            self.buf = buf[pos:]
+        return done
+
+    def _tile(self, x, y, w, h, encoding, data):
+        px_size = self.px_size
+        row_size = w * px_size
+        stride = self.width * px_size
+        fb = self.fb
+        if encoding == 0:
+            for row in range(h):
+                o = (y + row) * stride + x * px_size
+                fb[o:o + row_size] = data[row * row_size:(row + 1) * row_size]
+            return
+        # Expand the runs into the tile, row by row
+        tile = bytearray(w * h * px_size)
+        o = 0
+        i = 0
+        while i < len(data):
+            n = data[i] + 1
+            px = bytes(data[i + 1:i + 1 + px_size])
+            tile[o:o + n * px_size] = px * n
+            o += n * px_size
+            i += 1 + px_size
+        for row in range(h):
+            o = (y + row) * stride + x * px_size
+            fb[o:o + row_size] = tile[row * row_size:(row + 1) * row_size]
+
+    def rgb(self, x, y):
+        # (r, g, b) of a pixel, LVGL colors are little endian: RGB565, B G R or B G R X
+        o = (y * self.width + x) * self.px_size
+        px = self.fb[o:o + self.px_size]
+        if self.px_size == 2:
+            c = px[0] | px[1] << 8
+            return ((c >> 11) * 255 // 31, ((c >> 5) & 0x3F) * 255 // 63, (c & 0x1F) * 255 // 31)
+        return (px[2], px[1], px[0])
+
+    def write_ppm(self, stream):
+        stream.write(('P6\n%d %d\n255\n' % (self.width, self.height)).encode())
+        row = bytearray(self.width * 3)
+        for y in range(self.height):
+            for x in range(self.width):
+                row[3 * x:3 * x + 3] = bytes(self.rgb(x, y))
+            stream.write(row)
+
+def send_pointer(sock, x, y, pressed):
+    sock.send(b'P' + struct.pack('<HHB', x, y, 1 if pressed else 0))
+
+# LVGL pointer input device, fed by the viewer's pointer records on sock.
+# The socket is polled, not made non blocking: remote_display writes to it.
+
+class pointer_indev:
+    def __init__(self, sock):
+        import lvgl as lv
+        import select
+        self.lv = lv
+        self.sock = sock
+        self.poll = select.poll()
+        self.poll.register(sock, select.POLLIN)
+        self.buf = b''
+        self.x = self.y = 0
+        self.pressed = False
+        self.indev = lv.indev_create()
+        self.indev.set_type(lv.INDEV_TYPE.POINTER)
+        self.indev.set_read_cb(self.read)
+
+    def read(self, indev, data):
+        if self.poll.poll(0):
+            self.buf += self.sock.recv(64) or b''
+        while len(self.buf) >= POINTER_SIZE:
+            if self.buf[0] == ord('P'):
+                self.x, self.y, pressed = struct.unpack('<HHB', self.buf[1:POINTER_SIZE])
+                self.pressed = pressed != 0
+            self.buf = self.buf[POINTER_SIZE:]
+        data.point.x = self.x
+        data.point.y = self.y
+        data.state = self.lv.INDEV_STATE.PRESSED if self.pressed else self.lv.INDEV_STATE.RELEASED
+
+    def delete(self):
+        self.indev.delete()
+
+# Reference viewer: decode the stream from host:port, write a PPM image after each frame
+
+def view(host, port, path):
+    import socket
+    sock = socket.socket()
+    sock.connect(socket.getaddrinfo(host, port)[0][-1])
+    def on_frame(d):
+        with open(path, 'wb') as f:
+            d.write_ppm(f)
+        print('frame %d: %dx%d, %d tiles, %d bytes so far' % (d.frame, d.width, d.height, d.tiles, d.bytes))
+    d = decoder(on_frame)
+    while True:
+        data = sock.recv(65536)
+        if not data:
+            break
+        d.feed(data)
+    sock.close()
+
+if __name__ == '__main__':
+    import sys
+    if len(sys.argv) < 3:
+        print('Usage: lv_remote.py host port [image.ppm]')
+    else:
+        view(sys.argv[1], int(sys.argv[2]), sys.argv[3] if len(sys.argv) > 3 else 'screen.ppm')
@@ -0,0 +1,698 @@
+##############################################################################
+# Virtual SPI LCD controller for the unix port.
+#
+# Emulates an ILI9xxx/ST77xx style display controller, so SPI panel drivers
+# can be benchmarked and regression tested without hardware.
+# The command stream (CASET, RASET, RAMWR, RAMWRC, MADCTL, COLMOD and others)
+# is decoded into an in-memory framebuffer (the controller GRAM), and the SPI
+# clock is modeled, so the bus time of every transfer is accounted for.
+#
+# install() registers stand-ins for the machine and espidf modules, so the
+# drivers run unmodified:
+# - machine.Pin, machine.PWM and machine.SPI, for driver/generic (st77xx, ili9xxx)
+# - The espidf SPI master, GPIO and heap_caps API used by driver/esp32/ili9XXX.py.
+#   The native ili9xxx panel (espidf.ili9xxx_panel_*) is mirrored in Python
+#   with the same transaction sequence, so the driver takes its queued hybrid
+#   path. The older hybrid flush (espidf.ili9xxx_flush) is not emulated.
+#   Queued transactions complete on the modeled bus while the caller goes on,
+#   polling transactions block it: blocked_us accounts for the bus time the
+#   caller waited. A single panel is supported.
+# The DC and CS pin numbers given to the controller are the ones the driver
+# toggles. Other pins and PWM duty cycles are recorded in pins and duty.
+#
+# Usage example with st77xx:
+#
+#        import lv_spi_lcd
+#        lcd = lv_spi_lcd.controller(240, 320, dc=12, cs=13)
+#        lv_spi_lcd.install(lcd)
+#        import st77xx
+#        disp = st77xx.St7789(res=(240, 320), rot=st77xx.ST77XX_PORTRAIT, spi=machine.SPI(1, baudrate=40_000_000), dc=12, cs=13)
+#        ...
+#        print(lcd.transfer_us, lcd.bytes, lcd.rgb(10, 10))
+#
+# Usage example with ili9XXX (install before importing the driver):
+#
+#        lcd = lv_spi_lcd.controller(240, 320, dc=12, cs=None)
+#        lv_spi_lcd.install(lcd)
+#        from ili9XXX import ili9341
+#        disp = ili9341(dc=12, mhz=40)
+#
+# The framebuffer holds GRAM as addressed by MADCTL: with MV set, the column
+# address selects the GRAM row. MX and MY then mirror the GRAM column and row.
+# pixel(x, y) returns the raw pixel value, and rgb(x, y) the color as 8 bit
+# (r, g, b), decoded according to COLMOD and the MADCTL BGR bit.
+#
+# With realtime=True, the bus is modeled on the clock: transfers run one after
+# the other, polling transfers block until theirs is done, and queued ones let
+# the caller go on. espidf transaction results become available when the bus
+# is done with them, so driver throughput measured with a clock reflects the
+# SPI bus and the overlap of CPU work with transfers. Post transaction
+# callbacks still run when the transaction is queued.
+#
+##############################################################################
+
+import usys
+import time
+
+# Commands
+
+CMD_SWRESET = 0x01
+CMD_SLPIN = 0x10
+CMD_SLPOUT = 0x11
+CMD_INVOFF = 0x20
+CMD_INVON = 0x21
+CMD_DISPOFF = 0x28
+CMD_DISPON = 0x29
+CMD_CASET = 0x2A
+CMD_RASET = 0x2B
+CMD_RAMWR = 0x2C
+CMD_MADCTL = 0x36
+CMD_COLMOD = 0x3A
+CMD_RAMWRC = 0x3C
+
+MADCTL_MY = 0x80
+MADCTL_MX = 0x40
+MADCTL_MV = 0x20
+MADCTL_BGR = 0x08
+
+# Bytes per pixel for the MCU interface format (low bits of COLMOD)
+
+COLMOD_BYTES = {5: 2, 6: 3, 7: 3}
+
+##############################################################################
+
+class controller():
+
+    def __init__(self, width=240, height=320, dc=None, cs=None, realtime=False):
+        self.width = width
+        self.height = height
+        self.dc_pin = dc
+        self.cs_pin = cs
+        self.realtime = realtime
+        self.bus_free = time.ticks_us()
+        self.pins = {}
+        self.duty = {}
+        self.reset_stats()
+        self.reset()
+
+    def reset(self):
+        # Hardware reset state
+        self.registers = {}
+        self.madctl = 0
+        self.colmod = 0x66
+        self.bpp = 3
+        self.fb = bytearray(self.width * self.height * self.bpp)
+        self.caset = (0, self.width - 1)
+        self.raset = (0, self.height - 1)
+        self.col = 0
+        self.row = 0
+        self.carry = b''
+        self.cmd = None
+        self.params = bytearray()
+        self.dc = 1
+        self.selected = self.cs_pin is None
+        self.sleeping = True
+        self.display_on = False
+        self.inverted = False
+
+    def reset_stats(self):
+        self.bytes = 0
+        self.transactions = 0
+        self.commands = 0
+        self.pixels = 0
+        self.transfer_us = 0
+        self.blocked_us = 0
+        self.queue_full = 0
+
+    # Bus interface
+
+    def set_pin(self, pin, value):
+        self.pins[pin] = value
+        if pin == self.dc_pin:
+            self.dc = value
+        elif pin == self.cs_pin:
+            # Like the real controllers, the current command carries over CS frames
+            self.selected = not value
+
+    def transfer(self, buf, hz, blocking=True):
+        # Write buf at hz SPI clock. DC selects command or data, as the driver set it
+        if not self.selected:
+            return
+        n = len(buf)
+        us = n * 8000000 / hz
+        if blocking:
+            self.blocked_us += us
+        self.bytes += n
+        self.transactions += 1
+        self.transfer_us += us
+        if self.dc:
+            self.data(buf)
+        else:
+            for cmd in buf:
+                self.command(cmd)
+        if self.realtime:
+            # Transfers run one after the other on the bus, until bus_free
+            now = time.ticks_us()
+            start = now if time.ticks_diff(self.bus_free, now) < 0 else self.bus_free
+            self.bus_free = time.ticks_add(start, int(us))
+            if blocking:
+                self.wait(self.bus_free)
+
+    def wait(self, ticks):
+        # Sleep until ticks (time.ticks_us)
+        delay = time.ticks_diff(ticks, time.ticks_us())
+        if delay > 0:
+            time.sleep_us(delay)
+
+    # Command decoding
+
+    def command(self, cmd):
+        self._end_command()
+        self.commands += 1
+        self.cmd = cmd
+        if cmd == CMD_RAMWR:
+            self.col, self.row = self.caset[0], self.raset[0]
+            self.carry = b''
+        elif cmd == CMD_SWRESET:
+            self.reset()
+        elif cmd == CMD_SLPIN or cmd == CMD_SLPOUT:
+            self.sleeping = cmd == CMD_SLPIN
+        elif cmd == CMD_DISPON or cmd == CMD_DISPOFF:
+            self.display_on = cmd == CMD_DISPON
+        elif cmd == CMD_INVON or cmd == CMD_INVOFF:
+            self.inverted = cmd == CMD_INVON
+
+    def data(self, buf):
+        cmd = self.cmd
+        if cmd == CMD_RAMWR or cmd == CMD_RAMWRC:
+            self._write_pixels(buf)
+            return
+        if cmd is None:
+            return
+        self.params.extend(buf)
+        params = self.params
+        if cmd == CMD_CASET and len(params) >= 4:
+            self.caset = ((params[0] << 8) | params[1], (params[2] << 8) | params[3])
+        elif cmd == CMD_RASET and len(params) >= 4:
+            self.raset = ((params[0] << 8) | params[1], (params[2] << 8) | params[3])
+        elif cmd == CMD_MADCTL and len(params) >= 1:
+            self.madctl = params[0]
+        elif cmd == CMD_COLMOD and len(params) >= 1 and params[0] != self.colmod:
+            if params[0] & 7 not in COLMOD_BYTES:
+                raise ValueError("Unsupported COLMOD 0x%02X" % params[0])
+            self.colmod = params[0]
+            self.bpp = COLMOD_BYTES[params[0] & 7]
+            self.fb = bytearray(self.width * self.height * self.bpp)
+
+    def _end_command(self):
+        if self.cmd is not None and self.cmd != CMD_RAMWR and self.cmd != CMD_RAMWRC:
+            self.registers[self.cmd] = bytes(self.params)
+        self.cmd = None
+        self.params = bytearray()
+
+    def _write_pixels(self, buf):
+        # Pixels may be split between transfers
+        bpp = self.bpp
+        data = memoryview(buf)
+        if self.carry:
+            need = bpp - len(self.carry)
+            self.carry += bytes(data[:need])
+            data = data[need:]
+            if len(self.carry) < bpp:
+                return
+            self._put(memoryview(self.carry))
+            self.carry = b''
+        n = len(data) - len(data) % bpp
+        if n:
+            self._put(data[:n])
+        if n < len(data):
+            self.carry = bytes(data[n:])
+
+    def _put(self, data):
+        # Write whole pixels from the current address, advancing through the CASET/RASET window
+        x0, x1 = self.caset
+        y0, y1 = self.raset
+        if x1 < x0 or y1 < y0:
+            return
+        bpp = self.bpp
+        width = self.width
+        height = self.height
+        madctl = self.madctl
+        fb = self.fb
+        n = len(data)
+        self.pixels += n // bpp
+        i = 0
+        if not madctl & (MADCTL_MV | MADCTL_MX):
+            # Rows are contiguous in GRAM: copy a run at a time
+            while i < n:
+                if self.row > y1:
+                    self.row = y0
+                run = min(x1 - self.col + 1, (n - i) // bpp)
+                y = height - 1 - self.row if madctl & MADCTL_MY else self.row
+                start = max(self.col, 0)
+                end = min(self.col + run, width)
+                if 0 <= y < height and start < end:
+                    o = (y * width + start) * bpp
+                    s = i + (start - self.col) * bpp
+                    fb[o:o + (end - start) * bpp] = data[s:s + (end - start) * bpp]
+                i += run * bpp
+                self.col += run
+                if self.col > x1:
+                    self.col = x0
+                    self.row += 1
+        else:
+            while i < n:
+                if self.row > y1:
+                    self.row = y0
+                x, y = (self.row, self.col) if madctl & MADCTL_MV else (self.col, self.row)
+                if madctl & MADCTL_MX:
+                    x = width - 1 - x
+                if madctl & MADCTL_MY:
+                    y = height - 1 - y
+                if 0 <= x < width and 0 <= y < height:
+                    o = (y * width + x) * bpp
+                    fb[o:o + bpp] = data[i:i + bpp]
+                i += bpp
+                self.col += 1
+                if self.col > x1:
+                    self.col = x0
+                    self.row += 1
+
+    # Framebuffer access
+
+    def pixel(self, x, y):
+        o = (y * self.width + x) * self.bpp
+        value = 0
+        for b in self.fb[o:o + self.bpp]:
+            value = (value << 8) | b
+        return value
+
+    def rgb(self, x, y):
+        value = self.pixel(x, y)
+        if self.bpp == 2:
+            r, g, b = (value >> 8) & 0xF8, (value >> 3) & 0xFC, (value << 3) & 0xF8
+            r, g, b = r | r >> 5, g | g >> 6, b | b >> 5
+        else:
+            r, g, b = (value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF
+            if self.colmod & 7 == 6:
+                r, g, b = r & 0xFC, g & 0xFC, b & 0xFC
+        return (b, g, r) if self.madctl & MADCTL_BGR else (r, g, b)
+
+    def count(self, value, x=0, y=0, w=None, h=None):
+        # Number of pixels equal to value in a rectangle, the whole framebuffer by default
+        w = self.width - x if w is None else w
+        h = self.height - y if h is None else h
+        n = 0
+        for py in range(y, y + h):
+            for px in range(x, x + w):
+                if self.pixel(px, py) == value:
+                    n += 1
+        return n
+
+##############################################################################
+# machine stand-ins
+
+_controller = None
+
+class Pin():
+    IN = 0
+    OUT = 1
+    OPEN_DRAIN = 2
+    PULL_UP = 1
+    PULL_DOWN = 2
+
+    def __init__(self, id, mode=-1, pull=-1, value=None):
+        self.id = id
+        if value is not None:
+            self.value(value)
+
+    def init(self, mode=-1, pull=-1, value=None):
+        if value is not None:
+            self.value(value)
+
+    def value(self, v=None):
+        if v is None:
+            return _controller.pins.get(self.id, 0)
+        _controller.set_pin(self.id, 1 if v else 0)
+
+    __call__ = value
+
+    def on(self):
+        self.value(1)
+
+    def off(self):
+        self.value(0)
+
+class PWM():
+    def __init__(self, pin, freq=1000, duty_u16=0):
+        self.pin = pin.id if isinstance(pin, Pin) else pin
+        self._freq = freq
+        self.duty_u16(duty_u16)
+
+    def freq(self, f=None):
+        if f is None:
+            return self._freq
+        self._freq = f
+
+    def duty_u16(self, d=None):
+        if d is None:
+            return _controller.duty.get(self.pin, 0)
+        _controller.duty[self.pin] = d
+
+    def deinit(self):
+        _controller.duty.pop(self.pin, None)
+
+class SPI():
+    def __init__(self, id=0, baudrate=1000000, **kw):
+        self.id = id
+        self.baudrate = baudrate
+
+    def init(self, baudrate=None, **kw):
+        if baudrate:
+            self.baudrate = baudrate
+
+    def deinit(self):
+        pass
+
+    def write(self, buf):
+        _controller.transfer(buf, self.baudrate)
+
+    def write_readinto(self, write_buf, read_buf):
+        self.write(write_buf)
+        for i in range(len(read_buf)):
+            read_buf[i] = 0
+
+    def read(self, n, write=0):
+        return bytes(n)
+
+    def readinto(self, buf, write=0):
+        for i in range(len(buf)):
+            buf[i] = 0
+
+class _machine():
+    # machine module with the stand-ins, and everything else from the real machine module
+    Pin = Pin
+    PWM = PWM
+    SPI = SPI
+
+    def __init__(self, machine):
+        self._machine = machine
+
+    def __getattr__(self, name):
+        if self._machine is None:
+            raise AttributeError(name)
+        return getattr(self._machine, name)
+
+##############################################################################
+# espidf stand-ins, for driver/esp32/ili9XXX.py
+
+ESP_OK = 0
+ESP_ERR_TIMEOUT = 0x107
+CPU_FREQ = 240000000
+
+class _namespace():
+    def __init__(self, **kw):
+        for k in kw:
+            setattr(self, k, kw[k])
+
+class _struct():
+    # Stand-in for the espidf structs: fields are set from a dict or as attributes
+    def __init__(self, fields=None):
+        if fields:
+            for k in fields:
+                setattr(self, k, fields[k])
+
+class C_Pointer():
+    def __init__(self):
+        self.ptr_val = None
+        self.int_val = 0
+
+class spi_device():
+    def __init__(self, devcfg):
+        self.clock_speed_hz = devcfg.clock_speed_hz
+        self.spics_io_num = getattr(devcfg, 'spics_io_num', -1)
+        self.queue_size = getattr(devcfg, 'queue_size', 1)
+        self.pre_cb = getattr(devcfg, 'pre_cb', None)
+        self.post_cb = getattr(devcfg, 'post_cb', None)
+        self.results = []
+
+# Mirror of the C ili9xxx panel in driver/esp32/espidf.c
+
+ILI9XXX_PANEL_ADDR_TRANS = 5
+ILI9XXX_PANEL_TRANS = ILI9XXX_PANEL_ADDR_TRANS + 2
+ILI9XXX_PANEL_SETS = 2
+ILI9XXX_PANEL_QUEUE_SIZE = 12
+DISPLAY_TYPE_ILI9488 = 2
+
+# Pixels per ILI9488 conversion chunk. Can be changed before creating the panel,
+# a chunk as large as the draw buffer converts everything before the transfer
+
+ILI9XXX_PANEL_CHUNK_PX = 1024
+
+SPI_TRANS_USE_TXDATA = 1 << 3
+
+def _color32_to_24(dst, src, n):
+    import lvgl as lv
+    if hasattr(lv, 'pixconv'):
+        lv.pixconv.xrgb8888_to_rgb888(dst, src, n)
+        return
+    for i in range(n):
+        dst[i * 3:i * 3 + 3] = src[i * 4:i * 4 + 3]
+
+class ili9xxx_panel():
+    def __init__(self, config):
+        self.config = config
+        self.disp = None
+        self.trans = [[_struct({'user': self, 'index': i, 'flags': 0, 'length': 0, 'tx_buffer': None, 'tx_data': bytearray(4)})
+            for i in range(ILI9XXX_PANEL_TRANS)] for s in range(ILI9XXX_PANEL_SETS)]
+        self.last = None
+        self.chunk_px = ILI9XXX_PANEL_CHUNK_PX
+        if config.display_type == DISPLAY_TYPE_ILI9488:
+            self.chunk_buf = [bytearray(self.chunk_px * 3) for i in range(2)]
+        self.set = 0
+        self.pending = 0
+
+    def reap(self, trans, ticks_to_wait):
+        # Retrieve completed results, until none is left or until trans completed
+        ptr = C_Pointer()
+        while self.pending > 0 and _esp.spi_device_get_trans_result(self.config.spi, ptr, ticks_to_wait) == ESP_OK:
+            self.pending -= 1
+            if ptr.ptr_val is trans:
+                break
+
+    def pre_cb(self, trans):
+        _controller.set_pin(self.config.dc, trans.index & 1 if trans.index < ILI9XXX_PANEL_ADDR_TRANS else 1)
+
+    def post_cb(self, trans):
+        if trans is self.last:
+            self.disp.flush_ready()
+
+    @staticmethod
+    def set_cmd(trans, cmd):
+        trans.flags = SPI_TRANS_USE_TXDATA
+        trans.length = 8
+        trans.tx_data[0] = cmd
+
+    @staticmethod
+    def set_range(trans, start, end):
+        trans.flags = SPI_TRANS_USE_TXDATA
+        trans.length = 32
+        trans.tx_data[0] = (start >> 8) & 0xFF
+        trans.tx_data[1] = start & 0xFF
+        trans.tx_data[2] = (end >> 8) & 0xFF
+        trans.tx_data[3] = end & 0xFF
+
+    def queue(self, trans):
+        _esp.spi_device_queue_trans(self.config.spi, trans, -1)
+        self.pending += 1
+
+    def flush(self, disp, area, color_p):
+        import lvgl as lv
+        config = self.config
+        self.disp = disp
+        self.reap(None, 0)
+
+        trans = self.trans[self.set]
+        self.set = (self.set + 1) % ILI9XXX_PANEL_SETS
+
+        self.set_cmd(trans[0], 0x2A)
+        self.set_range(trans[1], area.x1 + config.start_x, area.x2 + config.start_x)
+        self.set_cmd(trans[2], 0x2B)
+        self.set_range(trans[3], area.y1 + config.start_y, area.y2 + config.start_y)
+        self.set_cmd(trans[4], 0x2C)
+
+        size = (area.x2 - area.x1 + 1) * (area.y2 - area.y1 + 1)
+
+        if config.display_type != DISPLAY_TYPE_ILI9488:
+            pixels = trans[ILI9XXX_PANEL_ADDR_TRANS]
+            pixels.flags = 0
+            pixels.length = size * 2 * 8
+            pixels.tx_buffer = color_p.__dereference__(size * 2)
+            self.last = pixels
+            for t in trans[:ILI9XXX_PANEL_ADDR_TRANS + 1]:
+                self.queue(t)
+            return
+
+        for t in trans[:ILI9XXX_PANEL_ADDR_TRANS]:
+            self.queue(t)
+
+        # Convert ARGB to RGB one chunk at a time, while the previous chunk is transferred
+        src = color_p.__dereference__(size * lv.color_t.__SIZE__)
+        offset = 0
+        while offset < size:
+            ping = (offset // self.chunk_px) & 1
+            chunk = trans[ILI9XXX_PANEL_ADDR_TRANS + ping]
+            n = min(size - offset, self.chunk_px)
+            if offset >= 2 * self.chunk_px:
+                self.reap(chunk, -1)
+            _color32_to_24(self.chunk_buf[ping], src[offset * 4:], n)
+            chunk.flags = 0
+            chunk.length = n * 3 * 8
+            chunk.tx_buffer = self.chunk_buf[ping]
+            if offset + n == size:
+                self.last = chunk
+            self.queue(chunk)
+            offset += n
+
+_panel = None
+_esp = None
+
+class _espidf():
+    HSPI_HOST = 1
+    VSPI_HOST = 2
+    MALLOC_CAP = _namespace(DMA=1 << 3, INTERNAL=1 << 11, SPIRAM=1 << 10, DEFAULT=1 << 12)
+    SPI_DEVICE = _namespace(TXBIT_LSBFIRST=1 << 0, RXBIT_LSBFIRST=1 << 1, BIT_LSBFIRST=3, THREEWIRE=1 << 2,
+        POSITIVE_CS=1 << 3, HALFDUPLEX=1 << 4, CLK_AS_CS=1 << 5, NO_DUMMY=1 << 6)
+    GPIO_MODE = _namespace(DISABLE=0, INPUT=1, OUTPUT=2, INPUT_OUTPUT=3)
+    GPIO = _namespace(PULLUP_ONLY=0, PULLDOWN_ONLY=1, PULLUP_PULLDOWN=2, FLOATING=3)
+    ESP = _namespace(MAX_DELAY=-1)
+
+    ILI9XXX_PANEL_QUEUE_SIZE = ILI9XXX_PANEL_QUEUE_SIZE
+
+    spi_bus_config_t = _struct
+    spi_device_interface_config_t = _struct
+    spi_transaction_t = _struct
+    ili9xxx_panel_config_t = _struct
+    C_Pointer = C_Pointer
+
+    # Markers for the callbacks ili9XXX sets on the device
+    ex_spi_pre_cb_isr = 'ex_spi_pre_cb_isr'
+    ex_spi_post_cb_isr = 'ex_spi_post_cb_isr'
+    ili9xxx_panel_pre_cb_isr = 'ili9xxx_panel_pre_cb_isr'
+    ili9xxx_panel_post_cb_isr = 'ili9xxx_panel_post_cb_isr'
+
+    def heap_caps_malloc(self, size, caps):
+        import lvgl as lv
+        return lv.malloc(size)
+
+    def heap_caps_free(self, ptr):
+        import lvgl as lv
+        lv.free(ptr)
+
+    def gpio_pad_select_gpio(self, pin):
+        pass
+
+    def gpio_set_direction(self, pin, mode):
+        pass
+
+    def gpio_set_pull_mode(self, pin, mode):
+        pass
+
+    def gpio_set_level(self, pin, level):
+        _controller.set_pin(pin, level)
+
+    def spi_bus_initialize(self, host, buscfg, dma_chan):
+        return ESP_OK
+
+    def spi_bus_free(self, host):
+        return ESP_OK
+
+    def spi_bus_add_device(self, host, devcfg, ptr):
+        ptr.ptr_val = spi_device(devcfg)
+        return ESP_OK
+
+    def spi_bus_remove_device(self, spi):
+        return ESP_OK
+
+    def spi_transaction_set_cb(self, pre_cb, post_cb):
+        return (pre_cb, post_cb)
+
+    def _transmit(self, spi, trans, blocking):
+        # Transactions complete synchronously. Hardware CS frames each transaction
+        if spi.spics_io_num >= 0:
+            _controller.set_pin(spi.spics_io_num, 0)
+        if spi.pre_cb == self.ili9xxx_panel_pre_cb_isr:
+            callbacks = (_panel.pre_cb, _panel.post_cb) if isinstance(trans.user, ili9xxx_panel) else None
+        else:
+            callbacks = trans.user
+        if callbacks and callbacks[0]:
+            callbacks[0](trans)
+        n = trans.length // 8
+        data = trans.tx_data[:n] if getattr(trans, 'flags', 0) & SPI_TRANS_USE_TXDATA else trans.tx_buffer[:n]
+        _controller.transfer(data, spi.clock_speed_hz, blocking)
+        if spi.spics_io_num >= 0:
+            _controller.set_pin(spi.spics_io_num, 1)
+        if callbacks and callbacks[1]:
+            callbacks[1](trans)
+        return ESP_OK
+
+    def spi_device_polling_transmit(self, spi, trans):
+        return self._transmit(spi, trans, True)
+
+    def spi_device_queue_trans(self, spi, trans, ticks_to_wait):
+        # The result is kept until retrieved. A real device holds at most queue_size
+        # results, queueing more than that is counted in queue_full
+        if len(spi.results) >= spi.queue_size:
+            _controller.queue_full += 1
+            spi.results.pop(0)
+        ret = self._transmit(spi, trans, False)
+        spi.results.append((trans, _controller.bus_free))
+        return ret
+
+    def spi_device_get_trans_result(self, spi, ptr, ticks_to_wait):
+        # With realtime, a result is available once the bus is done with its transaction
+        if not spi.results:
+            return ESP_ERR_TIMEOUT
+        trans, done = spi.results[0]
+        if _controller.realtime and time.ticks_diff(done, time.ticks_us()) > 0:
+            if ticks_to_wait == 0:
+                return ESP_ERR_TIMEOUT
+            _controller.wait(done)
+        spi.results.pop(0)
+        ptr.ptr_val = trans
+        return ESP_OK
+
+    def ili9xxx_panel_create(self, config):
+        global _panel
+        _panel = ili9xxx_panel(config)
+        return _panel
+
+    def ili9xxx_panel_delete(self, panel):
+        global _panel
+        panel.reap(None, -1)
+        if _panel is panel:
+            _panel = None
+
+    def ili9xxx_panel_flush(self, disp, area, color_p):
+        _panel.flush(disp, area, color_p)
+
+    def get_ccount(self, ptr):
+        ptr.int_val = time.ticks_us() * (CPU_FREQ // 1000000)
+
+    def esp_clk_cpu_freq(self):
+        return CPU_FREQ
+
+##############################################################################
+
+def install(lcd):
+    # Route the machine and espidf modules to lcd. Call before importing the driver
+    global _controller, _esp
+    _controller = lcd
+    if not isinstance(usys.modules.get('machine'), _machine):
+        try:
+            import machine
+        except ImportError:
+            machine = None
+        usys.modules['machine'] = _machine(machine)
+    _esp = _espidf()
+    usys.modules['espidf'] = _esp
@@ -139,14 +139,16 @@ class Timer:
         self._valid = False
 
     def init(self, mode=PERIODIC, period=-1, callback=None):
-        self.tid = timer_create(self.id)
+        # The posix timer and signal handler are reused when re-initialized
+        if not hasattr(self, 'tid'):
+            self.tid = timer_create(self.id)
+            self.handler_ref = self.handler
+            # print("Sig %d: %s" % (SIGRTMIN + self.id, self.org_sig))
+            self.action = sigaction(SIGRTMIN + self.id, self.handler_ref)
         self.mode = mode
         self.period = period
         self.cb = callback
         timer_settime(self.tid, self.period, self.mode == Timer.PERIODIC)
-        self.handler_ref = self.handler
-        # print("Sig %d: %s" % (SIGRTMIN + self.id, self.org_sig))
-        self.action = sigaction(SIGRTMIN + self.id, self.handler_ref)
         self._valid = True
 
     def deinit(self):
@@ -213,6 +213,13 @@ lv_str_enum_pattern = re.compile('^_{prefix}_STR_(.+)'.format(prefix=module_pref
 lv_callback_type_pattern = re.compile('({prefix}_){{0,1}}(.+)_cb(_t){{0,1}}'.format(prefix=module_prefix))
 lv_global_callback_pattern = re.compile('.*g_cb_t')
 lv_func_returns_array = re.compile('.*_array$')
+lv_func_keeps_args = re.compile('.*_(set|add|init)(_.*){0,1}$')
+lv_func_static_str = re.compile('.*_static$')
+
+# Callbacks of widget classes implemented in Python are called for every event on every instance.
+# They are generated as fast callbacks: The callable is looked up once per class and struct arguments are passed in reusable wrappers.
+fast_callbacks = ['{prefix}_{base_name}_class_t_{cb}'.format(prefix=module_prefix, base_name=base_obj_name, cb=cb)
+    for cb in ['constructor_cb', 'destructor_cb', 'event_cb']]
 lv_enum_name_pattern = re.compile('^(ENUM_){{0,1}}({prefix}_){{0,1}}(.*)'.format(prefix=module_prefix.upper()))
 
 # Prevent identifier names which are Python reserved words (add underscore in such case)
@@ -334,6 +341,18 @@ for obj_ctor in obj_ctors:
     funcs.remove(obj_ctor)
 obj_names = [create_obj_pattern.match(ctor.name).group(1) for ctor in obj_ctors]
 
+all_func_names = set(func.name for func in all_funcs)
+
+def has_funcs(*func_names):
+    return all(func_name in all_func_names for func_name in func_names)
+
+def struct_has_fields(struct_name, *field_names):
+    struct = structs.get(struct_name)
+    if struct is not None and not struct.decls and struct_name in synonym:
+        struct = structs.get(synonym[struct_name]) # Typedef of a struct defined elsewhere
+    return struct is not None and struct.decls is not None and \
+        all(field_name in [decl.name for decl in struct.decls] for field_name in field_names)
+
 def has_ctor(obj_name):
     return ctor_name_from_obj_name(obj_name) in [ctor.name for ctor in obj_ctors]
 
@@ -597,6 +616,11 @@ lv_mp_type = {
 lv_to_mp_byref = {}
 lv_to_mp_funcptr = {}
 
+# Convertors of pointers that may refer to a Micropython buffer, which might need to be pinned
+
+def is_pinnable_convertor(convertor):
+    return convertor == 'mp_to_ptr' or convertor.startswith('mp_array_to_')
+
 # Add native array supported types
 # These types would be converted automatically to/from array type.
 # Supported array (pointer) types are signed/unsigned int: 8bit, 16bit, 32bit and 64bit.
@@ -688,6 +712,9 @@ print ("""
 #include "py/objarray.h"
 #include "py/objtype.h"
 #include "py/objexcept.h"
+#include "py/smallint.h"
+#include "py/stackctrl.h"
+#include "py/mphal.h"
 
 /*
  * {module_name} includes
@@ -811,6 +838,7 @@ typedef struct mp_lv_struct_t
 {
     mp_obj_base_t base;
     void *data;
+    mp_obj_t *pins; // Buffers pinned to data. NULL when the struct only references memory it doesn't own
 } mp_lv_struct_t;
 
 STATIC const mp_lv_struct_t mp_lv_null_obj;
@@ -823,18 +851,54 @@ STATIC mp_int_t mp_lv_obj_get_buffer(mp_obj_t self_in, mp_buffer_info_t *bufinfo
 
 STATIC mp_int_t mp_blob_get_buffer(mp_obj_t self_in, mp_buffer_info_t *bufinfo, mp_uint_t flags);
 
+#ifdef LV_OBJ_T
+
+// Cache the native base type of Python classes that inherit native types (for example "class MyButton(lv.btn)"),
+// to avoid walking the class hierarchy each time such instance is passed to LVGL.
+// Types are kept as pairs of {Python type, native base type}.
+// The cache is a root pointer, so cached types are not collected.
+
+#define MP_LV_NATIVE_BASE_CACHE_SIZE 8
+MP_REGISTER_ROOT_POINTER(const mp_obj_type_t *mp_lv_native_base_cache[MP_LV_NATIVE_BASE_CACHE_SIZE * 2]);
+
+STATIC const mp_obj_type_t *get_native_base_type(const mp_obj_type_t *type)
+{
+    const mp_obj_type_t **entry = &MP_STATE_VM(mp_lv_native_base_cache)[
+        ((((uintptr_t)type) >> 4) % MP_LV_NATIVE_BASE_CACHE_SIZE) * 2];
+    if (entry[0] == type) return entry[1];
+    const mp_obj_type_t *native_type = type;
+    while (MP_OBJ_TYPE_GET_SLOT_OR_NULL(native_type, parent)) native_type = MP_OBJ_TYPE_GET_SLOT(native_type, parent);
+    entry[0] = type;
+    entry[1] = native_type;
+    return native_type;
+}
+
+#else
+
+STATIC inline const mp_obj_type_t *get_native_base_type(const mp_obj_type_t *type)
+{
+    const mp_obj_type_t *native_type = type;
+    while (MP_OBJ_TYPE_GET_SLOT_OR_NULL(native_type, parent)) native_type = MP_OBJ_TYPE_GET_SLOT(native_type, parent);
+    return native_type;
+}
+
+#endif
+
 STATIC mp_obj_t get_native_obj(mp_obj_t mp_obj)
 {
     if (!MP_OBJ_IS_OBJ(mp_obj)) return mp_obj;
-    const mp_obj_type_t *native_type = ((mp_obj_base_t*)mp_obj)->type;
-    if (native_type == NULL)
+    const mp_obj_type_t *type = ((mp_obj_base_t*)mp_obj)->type;
+    if (type == NULL)
         return NULL;
-    if (MP_OBJ_TYPE_GET_SLOT_OR_NULL(native_type, parent) == NULL ||
-        (MP_OBJ_TYPE_GET_SLOT_OR_NULL(native_type, buffer) == mp_blob_get_buffer) ||
-        (MP_OBJ_TYPE_GET_SLOT_OR_NULL(native_type, buffer) == mp_lv_obj_get_buffer))
+    if (MP_OBJ_TYPE_GET_SLOT_OR_NULL(type, parent) == NULL ||
+        (MP_OBJ_TYPE_GET_SLOT_OR_NULL(type, buffer) == mp_blob_get_buffer) ||
+        (MP_OBJ_TYPE_GET_SLOT_OR_NULL(type, buffer) == mp_lv_obj_get_buffer))
        return mp_obj;
-    while (MP_OBJ_TYPE_GET_SLOT_OR_NULL(native_type, parent)) native_type = MP_OBJ_TYPE_GET_SLOT(native_type, parent);
-    return mp_obj_cast_to_native_base(mp_obj, MP_OBJ_FROM_PTR(native_type));
+    const mp_obj_type_t *native_type = get_native_base_type(type);
+    if (native_type == type || !mp_obj_is_instance_type(type) || mp_obj_is_instance_type(native_type))
+        return mp_obj_cast_to_native_base(mp_obj, MP_OBJ_FROM_PTR(native_type));
+    // Python instance of a native type. The native object is embedded in the instance
+    return ((mp_obj_instance_t*)MP_OBJ_TO_PTR(mp_obj))->subobj[0];
 }
 
 STATIC mp_obj_t dict_to_struct(mp_obj_t dict, const mp_obj_type_t *type);
@@ -868,6 +932,35 @@ STATIC mp_obj_t cast(mp_obj_t mp_obj, const mp_obj_type_t *mp_type)
     return res;
 }
 
+// Buffer pinning
+// LVGL keeps some of the pointers it receives (draw buffers, image data, static text, chart arrays...)
+// When such pointer refers to a Micropython buffer, the buffer object is pinned to the lv_obj_t or struct
+// that keeps the pointer, so it's not garbage collected (or moved) as long as LVGL may access it.
+// Pins are kept in a dict. The key identifies the function argument or struct field that set the pointer,
+// so setting a new value releases the previously pinned buffer.
+
+#define MP_LV_PIN_KEY(id, index) MP_OBJ_NEW_SMALL_INT((mp_int_t)((((mp_uint_t)(id)) << 3 | (index)) & MP_SMALL_INT_POSITIVE_MASK))
+
+STATIC inline bool mp_lv_is_pinnable(mp_obj_t obj)
+{
+    return MP_OBJ_IS_STR_OR_BYTES(obj) ||
+        MP_OBJ_IS_TYPE(obj, &mp_type_bytearray) ||
+#if MICROPY_PY_ARRAY
+        MP_OBJ_IS_TYPE(obj, &mp_type_array) ||
+#endif
+        MP_OBJ_IS_TYPE(obj, &mp_type_memoryview);
+}
+
+GENMPY_UNUSED STATIC void mp_lv_pin(mp_obj_t *pins, mp_obj_t key, mp_obj_t value)
+{
+    if (mp_lv_is_pinnable(value)) {
+        if (*pins == MP_OBJ_NULL) *pins = mp_obj_new_dict(0);
+        mp_obj_dict_store(*pins, key, value);
+    } else if (*pins != MP_OBJ_NULL) {
+        mp_map_lookup(mp_obj_dict_get_map(*pins), key, MP_MAP_LOOKUP_REMOVE_IF_FOUND);
+    }
+}
+
 // object handling
 // This section is enabled only when objects are supported
 
@@ -877,6 +970,7 @@ typedef struct mp_lv_obj_t {
     mp_obj_base_t base;
     LV_OBJ_T *lv_obj;
     LV_OBJ_T *callbacks;
+    mp_obj_t pins;
 } mp_lv_obj_t;
 
 STATIC inline LV_OBJ_T *mp_to_lv(mp_obj_t mp_obj)
@@ -915,6 +1009,7 @@ STATIC void mp_lv_delete_cb(lv_event_t * e)
         mp_lv_obj_t *self = lv_obj->user_data;
         if (self) {
             self->lv_obj = NULL;
+            self->pins = MP_OBJ_NULL; // LVGL no longer references the pinned buffers
         }
     }
 }
@@ -942,6 +1037,7 @@ STATIC inline mp_obj_t lv_to_mp(LV_OBJ_T *lv_obj)
             .base = {(const mp_obj_type_t *)mp_obj_type},
             .lv_obj = lv_obj,
             .callbacks = NULL,
+            .pins = MP_OBJ_NULL,
         };
 
         // Register the Python object in user_data
@@ -953,6 +1049,16 @@ STATIC inline mp_obj_t lv_to_mp(LV_OBJ_T *lv_obj)
     return MP_OBJ_FROM_PTR(self);
 }
 
+// Pins are always kept on the mp_lv_obj_t registered in user_data, since other
+// mp objects (for example those created by __cast__) may refer to the same lv_obj_t
+
+GENMPY_UNUSED STATIC void mp_lv_obj_pin(LV_OBJ_T *lv_obj, mp_obj_t key, mp_obj_t value)
+{
+    if (lv_obj == NULL) return;
+    mp_lv_obj_t *self = MP_OBJ_TO_PTR(lv_to_mp(lv_obj));
+    mp_lv_pin(&self->pins, key, value);
+}
+
 STATIC void* mp_to_ptr(mp_obj_t self_in);
 
 STATIC mp_obj_t cast_obj_type(const mp_obj_type_t* type, mp_obj_t obj)
@@ -962,6 +1068,7 @@ STATIC mp_obj_t cast_obj_type(const mp_obj_type_t* type, mp_obj_t obj)
         .base = {type},
         .lv_obj = mp_to_ptr(obj),
         .callbacks = NULL,
+        .pins = MP_OBJ_NULL,
     };
     if (!self->lv_obj) return mp_const_none;
     return MP_OBJ_FROM_PTR(self);
@@ -1103,13 +1210,25 @@ STATIC mp_obj_t make_new_lv_struct(
     mp_lv_struct_t *self = m_new_obj(mp_lv_struct_t);
     mp_lv_struct_t *other = (n_args > 0) && (!mp_obj_is_int(args[0])) ? mp_to_lv_struct(cast(args[0], type)): NULL;
     size_t count = (n_args > 0) && (mp_obj_is_int(args[0]))? mp_obj_get_int(args[0]): 1;
+    // Pins are kept in a slot right after the struct data, so they live as long as the data itself,
+    // even when LVGL keeps the data after the struct object is gone.
+    size_t pins_offset = (size * count + sizeof(mp_obj_t) - 1) & ~(sizeof(mp_obj_t) - 1);
     *self = (mp_lv_struct_t){
         .base = {type},
-        .data = (size == 0 || (other && other->data == NULL))? NULL: m_malloc(size * count)
+        .data = (size == 0 || (other && other->data == NULL))? NULL: m_malloc(pins_offset + sizeof(mp_obj_t))
     };
     if (self->data) {
+        self->pins = (mp_obj_t*)((byte*)self->data + pins_offset);
+        *self->pins = MP_OBJ_NULL;
         if (other) {
             memcpy(self->data, other->data, size * count);
+            if (other->pins && *other->pins != MP_OBJ_NULL) {
+                mp_map_t *other_pins = mp_obj_dict_get_map(*other->pins);
+                for (size_t i = 0; i < other_pins->alloc; i++) {
+                    if (mp_map_slot_is_filled(other_pins, i))
+                        mp_lv_pin(self->pins, other_pins->table[i].key, other_pins->table[i].value);
+                }
+            }
         } else {
             memset(self->data, 0, size * count);
         }
@@ -1158,7 +1277,8 @@ STATIC mp_obj_t lv_struct_subscr(mp_obj_t self_in, mp_obj_t index, mp_obj_t valu
     mp_lv_struct_t *element_at_index = m_new_obj(mp_lv_struct_t);
     *element_at_index = (mp_lv_struct_t){
         .base = {type},
-        .data = element_addr
+        .data = element_addr,
+        .pins = self->pins // elements share the pins of the whole array
     };
 
     if (value != MP_OBJ_SENTINEL){
@@ -1362,6 +1482,7 @@ STATIC inline mp_obj_t mp_lv_cast_instance(mp_obj_t self_in, mp_obj_t ptr_obj)
 {
     mp_lv_struct_t *self = MP_OBJ_TO_PTR(self_in);
     self->data = mp_to_ptr(ptr_obj);
+    self->pins = NULL;
     return self_in;
 }
 
@@ -1445,8 +1566,221 @@ STATIC void *mp_lv_callback(mp_obj_t mp_callback, void *lv_callback, qstr callba
     }
 }
 
+// Pin a buffer to a struct.
+// Prefer the dict kept in user_data (same dict that keeps the callbacks), since it's referenced by the struct itself.
+// Otherwise, use the pins slot of a struct allocated by Micropython. Structs only referenced from Micropython have no such slot.
+
+GENMPY_UNUSED STATIC void mp_lv_struct_pin(mp_obj_t mp_struct, void **user_data_ptr, void *containing_struct,
+    mp_lv_get_user_data get_user_data, mp_lv_set_user_data set_user_data, mp_obj_t key, mp_obj_t value)
+{
+    bool has_user_data = user_data_ptr || (containing_struct && get_user_data && set_user_data);
+    void *user_data = user_data_ptr? *user_data_ptr: has_user_data? get_user_data(containing_struct): NULL;
+    if (has_user_data && !user_data && mp_lv_is_pinnable(value)) {
+        user_data = MP_OBJ_TO_PTR(mp_obj_new_dict(0));
+        if (user_data_ptr) *user_data_ptr = user_data;
+        else set_user_data(containing_struct, user_data);
+    }
+    if (user_data && MP_OBJ_IS_TYPE(MP_OBJ_FROM_PTR(user_data), &mp_type_dict)) {
+        mp_obj_t pins = MP_OBJ_FROM_PTR(user_data);
+        mp_lv_pin(&pins, key, value);
+        return;
+    }
+    mp_obj_t native_struct = get_native_obj(mp_struct);
+    if (native_struct && MP_OBJ_IS_OBJ(native_struct) &&
+        MP_OBJ_TYPE_GET_SLOT_OR_NULL(mp_obj_get_type(native_struct), make_new) == &make_new_lv_struct) {
+            mp_lv_struct_t *self = MP_OBJ_TO_PTR(native_struct);
+            if (self->pins) mp_lv_pin(self->pins, key, value);
+    }
+}
+
 static int _nesting = 0;
 
+// Time spent in (outermost) Python callbacks, accumulated while mp_lv_callback_timing is set
+
+GENMPY_UNUSED STATIC bool mp_lv_callback_timing = false;
+GENMPY_UNUSED STATIC mp_uint_t mp_lv_callback_us = 0;
+
+#define MP_LV_CALLBACK_ENTER() mp_uint_t callback_start = (mp_lv_callback_timing && _nesting == 0)? (mp_hal_ticks_us() | 1): 0; _nesting++
+#define MP_LV_CALLBACK_EXIT() _nesting--; if (callback_start) mp_lv_callback_us += mp_hal_ticks_us() - callback_start
+
+/*
+ * LVGL lock
+ *
+ * While lvgl.render_thread runs LVGL on its own pthread, binding calls take this lock around the whole call,
+ * including argument and result conversion, and so do the extensions below that touch LVGL state.
+ * The lock is recursive per thread, and a binding call releases it when an exception unwinds it.
+ * Python callbacks that LVGL calls on the render thread are marshaled to a thread that runs Python code, which
+ * runs them with the lock lent by the render thread while the render thread waits. A thread that waits for
+ * the lock serves such calls, otherwise they are run from the MicroPython scheduler.
+ * When the render thread doesn't run, the lock is not taken at all.
+ */
+
+#ifndef MP_LV_RENDER_THREAD
+#if MICROPY_PY_THREAD && MICROPY_ENABLE_SCHEDULER && defined(__unix__)
+#define MP_LV_RENDER_THREAD 1
+#else
+#define MP_LV_RENDER_THREAD 0
+#endif
+#endif
+
+#if MP_LV_RENDER_THREAD
+
+#include <pthread.h>
+#include <time.h>
+#include "py/mpthread.h"
+
+typedef struct mp_lv_lock_t {
+    pthread_mutex_t mutex;      // Protects the fields below, and is only held briefly
+    pthread_cond_t cond;        // Signaled when the lock is released and when a marshaled call is posted or done
+    volatile bool active;       // The render thread runs
+    pthread_t owner;
+    int depth;                  // The lock is held when depth > 0
+    void (*call)(void *);       // Marshaled call posted by the render thread, until a MicroPython thread takes it
+    void *call_arg;
+    bool call_pending;          // The render thread waits for a marshaled call to return
+    mp_obj_t exception_sink;    // Called with exceptions raised by marshaled calls
+} mp_lv_lock_t;
+
+STATIC mp_lv_lock_t mp_lv_lock_state = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+STATIC __thread bool mp_lv_on_render_thread = false;
+
+STATIC inline bool mp_lv_render_thread_is_current(void)
+{
+    return mp_lv_on_render_thread;
+}
+
+STATIC void mp_lv_lock_serve(void)
+{
+    // Run the posted call on this MicroPython thread. Called holding the GIL and the mutex.
+    mp_lv_lock_t *lock = &mp_lv_lock_state;
+    void (*call)(void *) = lock->call;
+    void *call_arg = lock->call_arg;
+    pthread_t owner = lock->owner;
+    int depth = lock->depth;
+    lock->call = NULL;
+    lock->owner = pthread_self();
+    lock->depth = 1;
+    pthread_mutex_unlock(&lock->mutex);
+
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+        call(call_arg);
+        nlr_pop();
+    } else {
+        mp_obj_t exception = MP_OBJ_FROM_PTR(nlr.ret_val);
+        if (lock->exception_sink != MP_OBJ_NULL && lock->exception_sink != mp_const_none)
+            mp_call_function_1_protected(lock->exception_sink, exception);
+        else
+            mp_obj_print_exception(&mp_plat_print, exception);
+    }
+
+    pthread_mutex_lock(&lock->mutex);
+    lock->owner = owner;
+    lock->depth = depth;
+    lock->call_pending = false;
+    pthread_cond_broadcast(&lock->cond);
+}
+
+STATIC mp_obj_t mp_lv_lock_serve_scheduled(mp_obj_t arg)
+{
+    mp_lv_lock_t *lock = &mp_lv_lock_state;
+    pthread_mutex_lock(&lock->mutex);
+    if (lock->call) mp_lv_lock_serve();
+    pthread_mutex_unlock(&lock->mutex);
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_lock_serve_scheduled_obj, mp_lv_lock_serve_scheduled);
+
+GENMPY_UNUSED STATIC void mp_lv_lock_acquire(void)
+{
+    // Called on a MicroPython thread, holding the GIL
+    mp_lv_lock_t *lock = &mp_lv_lock_state;
+    pthread_t self = pthread_self();
+    pthread_mutex_lock(&lock->mutex);
+    if (lock->depth == 0 || !pthread_equal(lock->owner, self)) {
+        while (lock->depth > 0) {
+            if (lock->call) {
+                mp_lv_lock_serve();
+                continue;
+            }
+            // Never wait for the GIL while holding the mutex
+            MP_THREAD_GIL_EXIT();
+            pthread_cond_wait(&lock->cond, &lock->mutex);
+            pthread_mutex_unlock(&lock->mutex);
+            MP_THREAD_GIL_ENTER();
+            pthread_mutex_lock(&lock->mutex);
+        }
+        lock->owner = self;
+    }
+    lock->depth++;
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+GENMPY_UNUSED STATIC void mp_lv_lock_release(void)
+{
+    mp_lv_lock_t *lock = &mp_lv_lock_state;
+    pthread_mutex_lock(&lock->mutex);
+    if (--lock->depth == 0) pthread_cond_broadcast(&lock->cond);
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+GENMPY_UNUSED STATIC void mp_lv_render_thread_call(void (*call)(void *), void *call_arg)
+{
+    // Called on the render thread, holding the lock. Returns after a MicroPython thread ran call(call_arg).
+    mp_lv_lock_t *lock = &mp_lv_lock_state;
+    MP_THREAD_GIL_EXIT();
+    pthread_mutex_lock(&lock->mutex);
+    lock->call = call;
+    lock->call_arg = call_arg;
+    lock->call_pending = true;
+    pthread_cond_broadcast(&lock->cond);
+    while (lock->call_pending) {
+        if (lock->call) {
+            // Not taken yet. The scheduler queue might be full, so retry periodically.
+            pthread_mutex_unlock(&lock->mutex);
+            mp_sched_schedule(MP_OBJ_FROM_PTR(&mp_lv_lock_serve_scheduled_obj), mp_const_none);
+            pthread_mutex_lock(&lock->mutex);
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 10 * 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            if (lock->call_pending) pthread_cond_timedwait(&lock->cond, &lock->mutex, &deadline);
+        } else {
+            pthread_cond_wait(&lock->cond, &lock->mutex);
+        }
+    }
+    pthread_mutex_unlock(&lock->mutex);
+    MP_THREAD_GIL_ENTER();
+}
+
+#define MP_LV_LOCK_BEGIN() \
+    nlr_buf_t mp_lv_lock_nlr; \
+    bool mp_lv_locked = mp_lv_lock_state.active; \
+    if (mp_lv_locked) { \
+        mp_lv_lock_acquire(); \
+        if (nlr_push(&mp_lv_lock_nlr) != 0) { \
+            mp_lv_lock_release(); \
+            nlr_jump(mp_lv_lock_nlr.ret_val); \
+        } \
+    }
+
+#define MP_LV_LOCK_END() if (mp_lv_locked) { nlr_pop(); mp_lv_lock_release(); }
+
+#else
+
+#define MP_LV_LOCK_BEGIN()
+#define MP_LV_LOCK_END()
+
+#endif // MP_LV_RENDER_THREAD
+
 // Function pointers wrapper
 
 STATIC mp_obj_t mp_lv_funcptr(const mp_lv_obj_fun_builtin_var_t *mp_fun, void *lv_fun, void *lv_callback, qstr func_name, void *user_data)
@@ -1464,6 +1798,50 @@ STATIC mp_obj_t mp_lv_funcptr(const mp_lv_obj_fun_builtin_var_t *mp_fun, void *l
     return MP_OBJ_FROM_PTR(funcptr);
 }
 
+// Fast callbacks
+// The callable is kept as a pointer to its entry in the callbacks dict, per dict (class).
+// The entry remains valid as long as the dict is not rehashed, and reflects re-assignment of the callback.
+// Struct arguments are passed in static wrappers which are reused between calls, unless the callback is re-entered.
+// Like any struct argument of a callback, these must not be kept after the callback returns.
+
+#define MP_LV_FAST_CALLBACK_CACHE_SIZE 4
+
+typedef struct mp_lv_fast_callback_t {
+    struct {
+        mp_map_elem_t *table;
+        mp_map_elem_t *elem;
+    } cache[MP_LV_FAST_CALLBACK_CACHE_SIZE];
+    size_t next;
+    bool busy;
+} mp_lv_fast_callback_t;
+
+GENMPY_UNUSED STATIC mp_obj_t mp_lv_fast_callback_get(mp_lv_fast_callback_t *fast_callback, mp_obj_t callbacks, qstr callback_name)
+{
+    mp_map_t *map = mp_obj_dict_get_map(callbacks);
+    mp_obj_t key = MP_OBJ_NEW_QSTR(callback_name);
+    for (size_t i = 0; i < MP_LV_FAST_CALLBACK_CACHE_SIZE; i++) {
+        mp_map_elem_t *elem = fast_callback->cache[i].elem;
+        if (fast_callback->cache[i].table == map->table && elem && elem < map->table + map->alloc && elem->key == key)
+            return elem->value;
+    }
+    mp_map_elem_t *elem = mp_map_lookup(map, key, MP_MAP_LOOKUP);
+    if (elem == NULL) nlr_raise(mp_obj_new_exception_arg1(&mp_type_KeyError, key));
+    fast_callback->cache[fast_callback->next].table = map->table;
+    fast_callback->cache[fast_callback->next].elem = elem;
+    fast_callback->next = (fast_callback->next + 1) % MP_LV_FAST_CALLBACK_CACHE_SIZE;
+    return elem->value;
+}
+
+GENMPY_UNUSED STATIC mp_obj_t mp_lv_fast_callback_struct(mp_lv_struct_t *wrapper, const mp_obj_type_t *type, void *lv_struct)
+{
+    if (lv_struct == NULL) return mp_const_none;
+    *wrapper = (mp_lv_struct_t){
+        .base = {type},
+        .data = lv_struct
+    };
+    return MP_OBJ_FROM_PTR(wrapper);
+}
+
 // Missing implementation for 64bit integer conversion
 
 STATIC unsigned long long mp_obj_get_ull(mp_obj_t obj)
@@ -1884,6 +2262,14 @@ def try_generate_struct(struct_name, struct):
                         format(field = sanitize(decl.name), convertor = mp_to_lv_convertor, type_name = type_name, cast = cast, size = memcpy_size))
                 read_cases.append('case MP_QSTR_{field}: dest[0] = {convertor}({cast}data->{field}); break; // converting from {type_name}'.
                     format(field = sanitize(decl.name), convertor = lv_to_mp_convertor, type_name = type_name, cast = cast))
+            elif is_writeable and decl.name != 'user_data' and is_pinnable_convertor(mp_to_lv_convertor):
+                # The struct keeps a pointer to the buffer, pin it
+                has_user_data = 'user_data' in [user_data_decl.name for user_data_decl in flatten_struct_decls]
+                write_cases.append('case MP_QSTR_{field}: data->{field} = {cast}{convertor}(dest[1]); mp_lv_struct_pin(self_in, {user_data}, NULL, NULL, NULL, MP_LV_PIN_KEY(MP_QSTR_{field}, 0), dest[1]); break; // converting to {type_name}'.
+                    format(field = sanitize(decl.name), convertor = mp_to_lv_convertor, type_name = type_name, cast = cast,
+                        user_data = '(void**)&data->user_data' if has_user_data else 'NULL'))
+                read_cases.append('case MP_QSTR_{field}: dest[0] = {convertor}({cast}data->{field}); break; // converting from {type_name}'.
+                    format(field = sanitize(decl.name), convertor = lv_to_mp_convertor, type_name = type_name, cast = cast))
             else:
                 if is_writeable:
                     write_cases.append('case MP_QSTR_{field}: data->{field} = {cast}{convertor}(dest[1]); break; // converting to {type_name}'.
@@ -1920,22 +2306,27 @@ STATIC void mp_{sanitized_struct_name}_attr(mp_obj_t self_in, qstr attr, mp_obj_
 
     if (dest[0] == MP_OBJ_NULL) {{
         // load attribute
+        MP_LV_LOCK_BEGIN();
         switch(attr)
         {{
             {read_cases};
             default: call_parent_methods(self_in, attr, dest); // fallback to locals_dict lookup
         }}
+        MP_LV_LOCK_END();
     }} else {{
         if (dest[1])
         {{
             // store attribute
+            bool stored = true;
+            MP_LV_LOCK_BEGIN();
             switch(attr)
             {{
                 {write_cases};
-                default: return;
+                default: stored = false;
             }}
+            MP_LV_LOCK_END();
 
-            dest[0] = MP_OBJ_NULL; // indicate success
+            if (stored) dest[0] = MP_OBJ_NULL; // indicate success
         }}
     }}
 }}
@@ -2234,7 +2625,7 @@ typedef union {
 
 generated_callbacks = collections.OrderedDict()
 
-def build_callback_func_arg(arg, index, func, func_name = None):
+def build_callback_func_arg(arg, index, func, func_name = None, fast_callback = False):
     arg_type = get_type(arg.type, remove_quals = True)
     cast = '(void*)' if isinstance(arg.type, c_ast.PtrDecl) else '' # needed when field is const. casting to void overrides it
     if arg_type not in lv_to_mp or not lv_to_mp[arg_type]:
@@ -2244,11 +2635,61 @@ def build_callback_func_arg(arg, index, func, func_name = None):
     arg_metadata = {'type': lv_mp_type[arg_type]}
     if arg.name: arg_metadata['name'] = arg.name
     callback_metadata[func_name]['args'].append(arg_metadata)
+    if fast_callback and lv_to_mp[arg_type].startswith('mp_read_ptr_'):
+        # Reuse a static wrapper, unless the callback was re-entered and the wrapper is still in use
+        return 'static mp_lv_struct_t arg{i}_wrapper;\n    mp_args[{i}] = reuse_wrappers? mp_lv_fast_callback_struct(&arg{i}_wrapper, get_mp_{struct}_type(), {cast}arg{i}): {convertor}({cast}arg{i});'.format(
+                convertor = lv_to_mp[arg_type],
+                struct = lv_to_mp[arg_type][len('mp_read_ptr_'):],
+                i = index, cast = cast)
     return 'mp_args[{i}] = {convertor}({cast}arg{i});'.format(
                 convertor = lv_to_mp[arg_type],
                 i = index, cast = cast)
 
 
+def gen_callback_marshaling(func_name, return_type, enumerated_args, user_data = None):
+    # Callbacks called on the render thread are run on a MicroPython thread (see "LVGL lock").
+    # Given the callback's user_data, a callback that is an lvgl.deferred is run on the render thread instead,
+    # since it only queues the call (see Deferred callbacks).
+    # Returns the declarations emitted before the callback, its prologue, and the marshaled function emitted after it.
+    name = sanitize(func_name)
+    fields = ([] if return_type == 'void' else ['%s ret;' % return_type]) + ['%s;' % gen.visit(arg) for arg in enumerated_args]
+    arg_names = [arg.name for arg in enumerated_args]
+    deferred = user_data is not None and len(obj_names) > 0
+    declarations = """
+#if MP_LV_RENDER_THREAD
+typedef struct {{ {fields} }} {name}_callback_call_t;
+GENMPY_UNUSED STATIC void {name}_callback_marshaled(void *call);{deferred}
+#endif
+""".format(name = name, fields = ' '.join(fields or ['char unused;']),
+        deferred = '\nGENMPY_UNUSED STATIC bool mp_lv_deferred_can_queue(mp_obj_t callbacks, qstr name, size_t n_args);' if deferred else '')
+    prologue = """
+#if MP_LV_RENDER_THREAD
+    if (mp_lv_render_thread_is_current(){deferred}) {{
+        {name}_callback_call_t call = {{ {init} }};
+        mp_lv_render_thread_call({name}_callback_marshaled, &call);
+        return{ret};
+    }}
+#endif""".format(
+        name = name,
+        deferred = ' &&\n            !mp_lv_deferred_can_queue(get_callback_dict_from_user_data({user_data}), MP_QSTR_{name}, {n_args})'.format(
+            user_data = user_data, name = name, n_args = len(enumerated_args)) if deferred else '',
+        init = ', '.join('.%s = %s' % (arg_name, arg_name) for arg_name in arg_names) or '0',
+        ret = '' if return_type == 'void' else ' call.ret')
+    marshaled = """
+#if MP_LV_RENDER_THREAD
+GENMPY_UNUSED STATIC void {name}_callback_marshaled(void *call)
+{{
+    {name}_callback_call_t *c = call;
+    {assignment}{name}_callback({args});
+}}
+#endif
+""".format(
+        name = name,
+        assignment = '' if return_type == 'void' else 'c->ret = ',
+        args = ', '.join('c->%s' % arg_name for arg_name in arg_names))
+    return declarations, prologue, marshaled
+
+
 def gen_callback_func(func, func_name = None, user_data_argument = False):
     global mp_to_lv
     if func_name in generated_callbacks:
@@ -2304,23 +2745,30 @@ def gen_callback_func(func, func_name = None, user_data_argument = False):
             raise MissingConversionException("Callback return value: Missing conversion to %s" % return_type)
 
     callback_metadata[func_name]['return_type'] = lv_mp_type[return_type]
+    if func_name in fast_callbacks:
+        gen_fast_callback_func(func, func_name, full_user_data, return_type, enumerated_args)
+        return
+    marshaling = gen_callback_marshaling(func_name, return_type, enumerated_args, full_user_data)
     print("""
 /*
  * Callback function {func_name}
  * {func_prototype}
  */
-
+{marshaling_declarations}
 GENMPY_UNUSED STATIC {return_type} {func_name}_callback({func_args})
-{{
+{{{marshaling_prologue}
     mp_obj_t mp_args[{num_args}];
     {build_args}
     mp_obj_t callbacks = get_callback_dict_from_user_data({user_data});
-    _nesting++;
+    MP_LV_CALLBACK_ENTER();
     {return_value_assignment}mp_call_function_n_kw(mp_obj_dict_get(callbacks, MP_OBJ_NEW_QSTR(MP_QSTR_{func_name})) , {num_args}, 0, mp_args);
-    _nesting--;
+    MP_LV_CALLBACK_EXIT();
     return{return_value};
 }}
-""".format(
+{marshaled}""".format(
+        marshaling_declarations = marshaling[0],
+        marshaling_prologue = marshaling[1],
+        marshaled = marshaling[2],
         func_prototype = gen.visit(func),
         func_name = sanitize(func_name),
         return_type = return_type,
@@ -2332,6 +2780,51 @@ GENMPY_UNUSED STATIC {return_type} {func_name}_callback({func_args})
         return_value='' if return_type == 'void' else ' %s(callback_result)' % mp_to_lv[return_type]))
     generated_callbacks[func_name] = True
 
+def gen_fast_callback_func(func, func_name, full_user_data, return_type, enumerated_args):
+    args = func.args.params
+    marshaling = gen_callback_marshaling(func_name, return_type, enumerated_args)
+    print("""
+/*
+ * Fast callback function {func_name}
+ * {func_prototype}
+ */
+{marshaling_declarations}
+GENMPY_UNUSED STATIC {return_type} {func_name}_callback({func_args})
+{{{marshaling_prologue}
+    static mp_lv_fast_callback_t fast_callback;
+    bool reuse_wrappers = !fast_callback.busy;
+    fast_callback.busy = true;
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) != 0) {{
+        // The wrappers are free again when the callback raises
+        if (reuse_wrappers) fast_callback.busy = false;
+        nlr_jump(nlr.ret_val);
+    }}
+    mp_obj_t mp_args[{num_args}];
+    {build_args}
+    mp_obj_t callbacks = get_callback_dict_from_user_data({user_data});
+    MP_LV_CALLBACK_ENTER();
+    {return_value_assignment}mp_call_function_n_kw(mp_lv_fast_callback_get(&fast_callback, callbacks, MP_QSTR_{func_name}), {num_args}, 0, mp_args);
+    MP_LV_CALLBACK_EXIT();
+    nlr_pop();
+    if (reuse_wrappers) fast_callback.busy = false;
+    return{return_value};
+}}
+{marshaled}""".format(
+        marshaling_declarations = marshaling[0],
+        marshaling_prologue = marshaling[1],
+        marshaled = marshaling[2],
+        func_prototype = gen.visit(func),
+        func_name = sanitize(func_name),
+        return_type = return_type,
+        func_args = ', '.join([(gen.visit(arg)) for arg in enumerated_args]),
+        num_args=len(args),
+        build_args="\n    ".join([build_callback_func_arg(arg, i, func, func_name=func_name, fast_callback=True) for i,arg in enumerate(args)]),
+        user_data=full_user_data,
+        return_value_assignment = '' if return_type == 'void' else 'mp_obj_t callback_result = ',
+        return_value='' if return_type == 'void' else ' %s(callback_result)' % mp_to_lv[return_type]))
+    generated_callbacks[func_name] = True
+
 #
 # Emit Mpy function definitions
 #
@@ -2419,6 +2912,56 @@ def build_mp_func_arg(arg, index, func, obj_name):
             convertor = mp_to_lv[arg_type],
             i = index)
 
+#
+# Buffer pinning
+# Pointer arguments that LVGL may keep (on set/add/init functions) are pinned to the first argument,
+# which is either an lv_obj_t or a struct.
+#
+
+def build_mp_func_pins(func, args):
+    if len(args) < 2 or not lv_func_keeps_args.match(func.name):
+        return []
+    try:
+        owner_type = get_type(args[0].type, remove_quals = True)
+        if owner_type not in mp_to_lv:
+            try_generate_type(args[0].type)
+        owner_convertor = mp_to_lv.get(owner_type)
+        owner_name = args[0].name if args[0].name else 'arg0'
+        if owner_convertor == 'mp_to_lv':
+            pin_func = 'mp_lv_obj_pin({owner}, {{key}}, {{value}});'.format(owner = owner_name)
+        elif owner_convertor and (owner_convertor.startswith('mp_write_ptr_') or owner_convertor == 'mp_to_ptr'):
+            if owner_convertor == 'mp_to_ptr':
+                # Opaque struct. Can only pin if it has user_data accessors
+                user_data = None
+                user_data_getter, user_data_setter = get_user_data_accessors(None, get_type(args[0].type.type, remove_quals = True)) \
+                    if isinstance(args[0].type, c_ast.PtrDecl) else (None, None)
+                if not (user_data_getter and user_data_setter):
+                    return []
+            else:
+                user_data, user_data_getter, user_data_setter = get_user_data(func.type, func.name)
+            pin_func = 'mp_lv_struct_pin(mp_args[0], {user_data}, {containing_struct}, (mp_lv_get_user_data){getter}, (mp_lv_set_user_data){setter}, {{key}}, {{value}});'.format(
+                user_data = '(void**)&%s->%s' % (owner_name, user_data) if user_data else 'NULL',
+                containing_struct = owner_name if user_data_getter and user_data_setter else 'NULL',
+                getter = user_data_getter.name if user_data_getter else 'NULL',
+                setter = user_data_setter.name if user_data_setter else 'NULL')
+        else:
+            return []
+        pins = []
+        for i, arg in enumerate(args):
+            if i == 0 or isinstance(arg, c_ast.EllipsisParam) or arg.name == 'user_data' or decl_to_callback(arg):
+                continue
+            arg_type = get_type(arg.type, remove_quals = True)
+            if arg_type not in mp_to_lv:
+                try_generate_type(arg.type)
+            convertor = mp_to_lv.get(arg_type)
+            if not convertor:
+                continue
+            if is_pinnable_convertor(convertor) or ('convert_from_str' in convertor and lv_func_static_str.match(func.name)):
+                pins.append(pin_func.format(key = 'MP_LV_PIN_KEY(lv_func_ptr, %d)' % i, value = 'mp_args[%d]' % i))
+        return pins
+    except MissingConversionException:
+        return []
+
 def emit_func_obj(func_obj_name, func_name, param_count, func_ptr, is_static):
     print("""
 STATIC {builtin_macro}(mp_{func_obj_name}_mpobj, {param_count}, mp_{func_name}, {func_ptr});
@@ -2452,10 +2995,14 @@ def gen_mp_func(func, obj_name):
     else:
         param_count = len(args)
 
+    # Functions that keep pointer arguments pin them, so they cannot share a wrapper with functions that don't
+    pins = build_mp_func_pins(func, args)
+
     # If func prototype matches an already generated func, reuse it and only emit func obj that points to it.
     prototype_str = gen.visit(function_prototype(func))
-    if prototype_str in func_prototypes:
-        original_func = func_prototypes[prototype_str]
+    reuse_key = '\n'.join([prototype_str] + pins)
+    if reuse_key in func_prototypes:
+        original_func = func_prototypes[reuse_key]
         if generated_funcs[original_func.name] == True:
             print("/* Reusing %s for %s */" % (original_func.name, func.name))
             emit_func_obj(func.name, original_func.name, param_count, func.name, is_static_member(func, base_obj_type))
@@ -2463,7 +3010,7 @@ def gen_mp_func(func, obj_name):
             func_metadata[func.name]['args'] = func_metadata[original_func.name]['args']
             generated_funcs[func.name] = True # completed generating the function
             return
-    func_prototypes[prototype_str] = func
+    func_prototypes[reuse_key] = func
 
     # user_data argument must be handled first, if it exists
     try:
@@ -2500,9 +3047,12 @@ def gen_mp_func(func, obj_name):
 
 STATIC mp_obj_t mp_{func}(size_t mp_n_args, const mp_obj_t *mp_args, void *lv_func_ptr)
 {{
+    MP_LV_LOCK_BEGIN();
     {build_args}
-    {build_result}(({func_ptr})lv_func_ptr)({send_args});
-    return {build_return_value};
+    {build_result}(({func_ptr})lv_func_ptr)({send_args});{build_pins}
+    mp_obj_t mp_lv_res = {build_return_value};
+    MP_LV_LOCK_END();
+    return mp_lv_res;
 }}
 
  """.format(
@@ -2516,6 +3066,7 @@ STATIC mp_obj_t mp_{func}(size_t mp_n_args, const mp_obj_t *mp_args, void *lv_fu
                (not isinstance(arg.type.type, c_ast.IdentifierType)) or
                'void' not in arg.type.type.names]), # Handle the case of 'void' param which should be ignored
         send_args=", ".join([(arg.name if (hasattr(arg, 'name') and arg.name) else ("arg%d" % i)) for i,arg in enumerate(args)]),
+        build_pins="".join(["\n    " + pin for pin in pins]),
         build_result=build_result,
         build_return_value=build_return_value))
 
@@ -2542,313 +3093,1054 @@ def gen_func_error(method, exp):
 
 
 #
-# Emit Mpy objects definitions
+# Awaitables
+# Emitted before the objects and structs, since they add members to them.
 #
 
-enum_referenced = collections.OrderedDict()
+extension_globals = []
+obj_extension_members = collections.defaultdict(list)
+struct_extension_members = collections.defaultdict(list)
+
+awaitable_wait_event = len(obj_names) > 0 and has_funcs(
+        'lv_obj_add_event', 'lv_obj_get_event_count', 'lv_obj_get_event_dsc', 'lv_obj_remove_event',
+        'lv_event_dsc_get_user_data', 'lv_event_get_user_data', 'lv_event_get_code', 'lv_async_call')
+awaitable_anim_done = has_funcs('lv_anim_start', 'lv_anim_set_deleted_cb', '_lv_ll_get_head', '_lv_ll_get_next',
+        'lv_async_call')
+awaitable_next_frame = has_funcs(
+        'lv_disp_add_event', 'lv_disp_get_event_count', 'lv_disp_get_event_dsc', 'lv_disp_remove_event',
+        'lv_event_dsc_get_user_data', 'lv_event_get_user_data', 'lv_disp_get_default', 'lv_disp_get_next',
+        'lv_async_call')
+
+if awaitable_wait_event or awaitable_anim_done or awaitable_next_frame:
+    print("""
+/*
+ * Awaitables for uasyncio
+ *
+ *   code = await obj.wait_event(lvgl.EVENT.CLICKED)
+ *   await anim.start().done()
+ *   await lvgl.next_frame()
+ *
+ * An awaitable is resolved from an LVGL callback, which sets a uasyncio.ThreadSafeFlag the awaiting task waits on.
+ * Nothing is polled, and there are no periodic wakeups while waiting.
+ * The callback is registered when the awaitable is created (so events are not missed before it is awaited),
+ * and removed after it resolves the awaitable, or when the awaiting task is cancelled.
+ * LVGL callbacks only hold the waiter, not the awaitable itself. So an awaitable that is never awaited can be
+ * collected, and its callback removes itself the next time it is called.
+ */
 
-def gen_obj_methods(obj_name):
-    global enums
-    helper_members = ["{ MP_ROM_QSTR(MP_QSTR___cast__), MP_ROM_PTR(&cast_obj_class_method) }"] if len(obj_names) > 0 and obj_name == base_obj_name else []
-    members = ["{{ MP_ROM_QSTR(MP_QSTR_{method_name}), MP_ROM_PTR(&mp_{method}_mpobj) }}".
-                    format(method=method.name, method_name=sanitize(method_name_from_func_name(method.name))) for method in get_methods(obj_name)]
-    obj_metadata[obj_name]['members'].update({method_name_from_func_name(method.name): func_metadata[method.name] for method in get_methods(obj_name)})
-    # add parent methods
-    parent_members = []
-    if obj_name in parent_obj_names and parent_obj_names[obj_name] != None:
-        # parent_members += gen_obj_methods(parent_obj_names[obj_name])
-        obj_metadata[obj_name]['members'].update(obj_metadata[parent_obj_names[obj_name]]['members'])
-    # add enum members
-    enum_members = ["{{ MP_ROM_QSTR(MP_QSTR_{enum_member}), MP_ROM_PTR({enum_member_value}) }}".
-                    format(enum_member = sanitize(get_enum_member_name(enum_member_name)), enum_member_value = get_enum_value(obj_name, enum_member_name)) for enum_member_name in get_enum_members(obj_name)]
-    obj_metadata[obj_name]['members'].update({get_enum_member_name(enum_member_name): {'type':'enum_member'} for enum_member_name in get_enum_members(obj_name)})
-    # add enums that match object name
-    obj_enums = [enum_name for enum_name in enums.keys() if is_method_of(enum_name, obj_name)]
-    enum_types = ["{{ MP_ROM_QSTR(MP_QSTR_{name}), MP_ROM_PTR(&mp_lv_{enum}_type_base) }}".
-                    format(name=sanitize(method_name_from_func_name(enum_name)), enum=enum_name) for enum_name in obj_enums]
-    obj_metadata[obj_name]['members'].update({method_name_from_func_name(enum_name): {'type':'enum_type'} for enum_name in obj_enums})
-    for enum_name in obj_enums:
-        obj_metadata[obj_name]['members'][method_name_from_func_name(enum_name)].update(obj_metadata[enum_name])
-        enum_referenced[enum_name] = True
-    return members + parent_members + enum_members + enum_types + helper_members
+typedef struct mp_lv_waiter_t {
+    mp_obj_t flag;      // uasyncio.ThreadSafeFlag, set when resolved
+    mp_obj_t result;    // MP_OBJ_NULL until resolved
+    bool error;         // result is an exception to raise
+    bool abandoned;     // The awaitable was collected
+    bool removing;      // Removal of the callback is scheduled
+    uint32_t code;      // Awaited event code
+    void *target;       // Object, animation or display waited on. NULL when it's gone
+    void (*cleanup)(struct mp_lv_waiter_t *waiter);
+    void *chained_cb;   // Animation deleted_cb that was replaced
+    struct mp_lv_waiter_t *next;
+} mp_lv_waiter_t;
+
+typedef struct mp_lv_awaitable_t {
+    mp_obj_base_t base;
+    mp_obj_t wait;              // flag.wait() coroutine, while awaited
+    mp_lv_waiter_t *waiter;
+} mp_lv_awaitable_t;
 
-def gen_obj(obj_name):
-    # eprint('Generating object %s...' % obj_name)
-    is_obj = has_ctor(obj_name)
-    should_add_base_methods = is_obj and obj_name != 'obj'
-    obj_metadata[obj_name] = {'members' : collections.OrderedDict()}
+STATIC void mp_lv_waiter_finish(mp_lv_waiter_t *waiter)
+{
+    void (*cleanup)(mp_lv_waiter_t *waiter) = waiter->cleanup;
+    waiter->cleanup = NULL;
+    if (cleanup) cleanup(waiter);
+}
 
-    # Generate object methods
-    for method in get_methods(obj_name):
-        try:
-            gen_mp_func(method, obj_name)
-        except MissingConversionException as exp:
-            gen_func_error(method, exp)
+STATIC void mp_lv_waiter_finish_async(void *waiter)
+{
+    mp_lv_waiter_finish(waiter);
+}
 
-    # Generate object construction function, if needed
-    if is_obj:
-        ctor_func = get_ctor(obj_name)
-        try:
-            gen_mp_func(ctor_func, obj_name)
-        except MissingConversionException as exp:
-            gen_func_error(ctor_func, exp)
+STATIC void mp_lv_waiter_remove_later(mp_lv_waiter_t *waiter)
+{
+    // Called from the callback, while LVGL still iterates over the callbacks. Remove it when the event is done.
+    if (!waiter->cleanup || !waiter->target || waiter->removing) return;
+    waiter->removing = true;
+    lv_async_call(mp_lv_waiter_finish_async, waiter);
+}
 
-    # print([method.name for method in methods])
-    ctor = """
-STATIC mp_obj_t {obj}_make_new(
-    const mp_obj_type_t *type,
-    size_t n_args,
-    size_t n_kw,
-    const mp_obj_t *args)
-{{
-    return make_new(&mp_{ctor_name}_mpobj, type, n_args, n_kw, args);
-}}
-"""
+STATIC void mp_lv_waiter_set_flag(void *waiter)
+{
+    mp_obj_t dest[2];
+    mp_load_method(((mp_lv_waiter_t *)waiter)->flag, MP_QSTR_set, dest);
+    mp_call_method_n_kw(0, 0, dest);
+}
 
-    print("""
-/*
- * {module_name} {obj} object definitions
- */
-    """.format(
-            module_name = module_name,
-            obj = obj_name))
+STATIC void mp_lv_waiter_resolve(mp_lv_waiter_t *waiter, mp_obj_t result, bool error)
+{
+    if (waiter->result == MP_OBJ_NULL) {
+        waiter->result = result;
+        waiter->error = error;
+#if MP_LV_RENDER_THREAD
+        if (mp_lv_render_thread_is_current()) mp_lv_render_thread_call(mp_lv_waiter_set_flag, waiter);
+        else
+#endif
+        mp_lv_waiter_set_flag(waiter);
+    }
+    mp_lv_waiter_remove_later(waiter);
+}
 
-    print("""
-STATIC const mp_rom_map_elem_t {obj}_locals_dict_table[] = {{
-    {locals_dict_entries}
-}};
+STATIC void mp_lv_awaitable_finish(mp_lv_awaitable_t *self)
+{
+    MP_LV_LOCK_BEGIN();
+    mp_lv_waiter_finish(self->waiter);
+    MP_LV_LOCK_END();
+}
 
-STATIC MP_DEFINE_CONST_DICT({obj}_locals_dict, {obj}_locals_dict_table);
+STATIC mp_obj_t mp_lv_awaitable_iternext(mp_obj_t self_in)
+{
+    mp_lv_awaitable_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_lv_waiter_t *waiter = self->waiter;
+    if (waiter->result == MP_OBJ_NULL) {
+        if (self->wait == MP_OBJ_NULL) {
+            mp_obj_t dest[2];
+            mp_load_method(waiter->flag, MP_QSTR_wait, dest);
+            self->wait = mp_call_method_n_kw(0, 0, dest);
+        }
+        // Yield to uasyncio until the flag is set
+        mp_obj_t ret = mp_iternext(self->wait);
+        if (ret != MP_OBJ_STOP_ITERATION) return ret;
+        if (waiter->result == MP_OBJ_NULL) waiter->result = mp_const_none;
+    }
+    mp_lv_awaitable_finish(self);
+    if (waiter->error) nlr_raise(waiter->result);
+    return mp_make_stop_iteration(waiter->result);
+}
 
-STATIC void {obj}_print(const mp_print_t *print,
-    mp_obj_t self_in,
-    mp_print_kind_t kind)
-{{
-    mp_printf(print, "{module_name} {obj}");
-}}
+STATIC mp_obj_t mp_lv_awaitable_await(mp_obj_t self_in)
+{
+    return self_in;
+}
 
-{ctor}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_awaitable_await_obj, mp_lv_awaitable_await);
 
-STATIC MP_DEFINE_CONST_OBJ_TYPE(
-    mp_lv_{obj}_type_base,
-    MP_QSTR_{obj},
-    MP_TYPE_FLAG_NONE,
-    print, {obj}_print,
-    {make_new}
-    {binary_op}
-    attr, call_parent_methods,
-    {buffer}
-    {parent}
-    locals_dict, &{obj}_locals_dict
-);
+STATIC mp_obj_t mp_lv_awaitable_throw(size_t n_args, const mp_obj_t *args)
+{
+    // Called when the awaiting task is cancelled
+    mp_lv_awaitable_finish(MP_OBJ_TO_PTR(args[0]));
+    nlr_raise(mp_make_raise_obj(n_args > 2 && args[2] != mp_const_none ? args[2] : args[1]));
+}
 
-GENMPY_UNUSED STATIC const mp_lv_obj_type_t mp_lv_{obj}_type = {{
-#ifdef LV_OBJ_T
-    .lv_obj_class = {lv_class},
-#endif
-    .mp_obj_type = &mp_lv_{obj}_type_base,
-}};
-    """.format(
-            module_name = module_name,
-            obj = sanitize(obj_name), base_obj = base_obj_name,
-            base_class = '&mp_%s_type' % base_obj_name if should_add_base_methods else 'NULL',
-            locals_dict_entries = ",\n    ".join(gen_obj_methods(obj_name)),
-            ctor = ctor.format(obj = obj_name, ctor_name = ctor_func.name) if has_ctor(obj_name) else '',
-            make_new = 'make_new, %s_make_new,' % obj_name if is_obj else '',
-            binary_op = 'binary_op, mp_lv_obj_binary_op,' if is_obj else '',
-            buffer = 'buffer, mp_lv_obj_get_buffer,' if is_obj else '',
-            parent = 'parent, &mp_lv_%s_type_base,' % parent_obj_names[obj_name] if obj_name in parent_obj_names and parent_obj_names[obj_name] else '',
-            lv_class = '&lv_%s_class' % obj_name if is_obj else 'NULL',
-            ))
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_lv_awaitable_throw_obj, 2, 4, mp_lv_awaitable_throw);
 
-#
-# Generate Enum objects
-#
+STATIC mp_obj_t mp_lv_awaitable_close(mp_obj_t self_in)
+{
+    mp_lv_awaitable_finish(MP_OBJ_TO_PTR(self_in));
+    return mp_const_none;
+}
 
-for enum_name in list(enums.keys()):
-    gen_obj(enum_name)
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_awaitable_close_obj, mp_lv_awaitable_close);
 
-#
-# Generate all other objects. Generate parent objects first
-#
+STATIC mp_obj_t mp_lv_awaitable_del(mp_obj_t self_in)
+{
+    // Runs in the garbage collector, so it can't call LVGL. The callback removes itself when it sees the flag.
+    // The waiter is still held by LVGL, or it is unreachable too, and not reused before the collection ends.
+    mp_lv_awaitable_t *self = MP_OBJ_TO_PTR(self_in);
+    self->waiter->abandoned = true;
+    return mp_const_none;
+}
 
-generated_obj_names = collections.OrderedDict()
-for obj_name in obj_names:
-    # eprint("--> %s [%s]" % (obj_name, ", ".join([name for name in generated_obj_names])))
-    parent_obj_name = parent_obj_names[obj_name] if obj_name in parent_obj_names else None
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_awaitable_del_obj, mp_lv_awaitable_del);
 
-    while parent_obj_name != None and not parent_obj_name in generated_obj_names:
-        gen_obj(parent_obj_name)
-        generated_obj_names[parent_obj_name] = True
-        parent_obj_name = parent_obj_names[parent_obj_name] if parent_obj_name in parent_obj_names else None
+STATIC const mp_rom_map_elem_t mp_lv_awaitable_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR___await__), MP_ROM_PTR(&mp_lv_awaitable_await_obj) },
+    { MP_ROM_QSTR(MP_QSTR_throw), MP_ROM_PTR(&mp_lv_awaitable_throw_obj) },
+    { MP_ROM_QSTR(MP_QSTR_close), MP_ROM_PTR(&mp_lv_awaitable_close_obj) },
+    { MP_ROM_QSTR(MP_QSTR___del__), MP_ROM_PTR(&mp_lv_awaitable_del_obj) },
+};
 
-    if not obj_name in generated_obj_names:
-        # eprint("--> gen obj %s" % obj_name)
-        gen_obj(obj_name)
-        generated_obj_names[obj_name] = True
+STATIC MP_DEFINE_CONST_DICT(mp_lv_awaitable_locals_dict, mp_lv_awaitable_locals_dict_table);
 
-#
-# Generate structs which contain function members
-# First argument of a function could be it's parent struct
-# Need to make sure these structs are generated *before* struct-functions are
-# Otherwise we will not know of all the structs when generating struct-functions
-#
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_lv_awaitable_type,
+    MP_QSTR_awaitable,
+    MP_TYPE_FLAG_ITER_IS_ITERNEXT,
+    iter, mp_lv_awaitable_iternext,
+    locals_dict, &mp_lv_awaitable_locals_dict
+);
 
-def try_generate_structs_from_first_argument():
-    for func in funcs:
-        if func.name in generated_funcs: continue
-        args = func.type.args.params if func.type.args else []
-        if len(args) < 1: continue
-        arg_type = get_type(args[0].type, remove_quals = True)
-        if arg_type not in mp_to_lv or not mp_to_lv[arg_type]:
-            try:
-                try_generate_type(args[0].type)
-            except MissingConversionException as e:
-                print('''
+STATIC mp_lv_awaitable_t *mp_lv_awaitable_new(void *target, void (*cleanup)(mp_lv_waiter_t *waiter))
+{
+    mp_obj_t uasyncio = mp_import_name(MP_QSTR_uasyncio, mp_const_none, MP_OBJ_NEW_SMALL_INT(0));
+    mp_lv_waiter_t *waiter = m_new0(mp_lv_waiter_t, 1);
+    waiter->flag = mp_call_function_0(mp_load_attr(uasyncio, MP_QSTR_ThreadSafeFlag));
+    waiter->result = MP_OBJ_NULL;
+    waiter->target = target;
+    waiter->cleanup = cleanup;
+    mp_lv_awaitable_t *self = m_new_obj_with_finaliser(mp_lv_awaitable_t);
+    self->base.type = &mp_lv_awaitable_type;
+    self->wait = MP_OBJ_NULL;
+    self->waiter = waiter;
+    return self;
+}
+""")
+
+if awaitable_wait_event:
+    print("""
 /*
- * {struct} not generated: {err}
+ * obj.wait_event(code=lvgl.EVENT.ALL)
+ * Resolves to the code of the first matching event. Raises LvReferenceError if the object is deleted first.
  */
-                '''.format(struct=arg_type, err=e))
 
-#
-# Generate globals
-#
+STATIC void mp_lv_wait_event_cb(lv_event_t *e)
+{
+    mp_lv_waiter_t *waiter = lv_event_get_user_data(e);
+    lv_event_code_t code = lv_event_get_code(e);
+    if (code == LV_EVENT_DELETE) {
+        waiter->target = NULL; // The event list is freed with the object
+        mp_lv_waiter_resolve(waiter, mp_obj_new_exception_msg(
+            &mp_type_LvReferenceError, MP_ERROR_TEXT("Object was deleted while awaiting an event")), true);
+    } else if (waiter->abandoned) {
+        mp_lv_waiter_remove_later(waiter);
+    } else if (waiter->code == LV_EVENT_ALL || code == waiter->code) {
+        mp_lv_waiter_resolve(waiter, MP_OBJ_NEW_SMALL_INT(code), false);
+    }
+}
 
-# eprint("/* Generating globals */")
+STATIC void mp_lv_wait_event_cleanup(mp_lv_waiter_t *waiter)
+{
+    LV_OBJ_T *obj = waiter->target;
+    if (!obj) return;
+    for (uint32_t i = lv_obj_get_event_count(obj); i-- > 0;) {
+        if (lv_event_dsc_get_user_data(lv_obj_get_event_dsc(obj, i)) == waiter) {
+            lv_obj_remove_event(obj, i);
+            break;
+        }
+    }
+}
 
-def gen_global(global_name, global_type_ast):
-    global_type = get_type(global_type_ast, remove_quals=True)
-    generated_global = try_generate_type(global_type_ast)
-    # print("/* generated_global = %s */" % generated_global)
-    if global_type not in generated_structs:
-        wrapped_type = lv_mp_type[global_type]
-        if not wrapped_type:
-            raise MissingConversionException('Missing conversion to %s when generating global %s' % (wrapped_type, global_name))
-        global_type = sanitize("_lv_mp_%s_wrapper" % wrapped_type)
-        custom_struct_str = """
-typedef struct {{
-    {type} value;
-}} {name};
-        """.format(
-            type = wrapped_type,
-            name = global_type)
-        if global_type not in generated_structs:
-            print("/* Global struct wrapper for %s */" % wrapped_type)
-            print(custom_struct_str)
-            # eprint("%s: %s\n" % (wrapped_type, custom_struct_str))
-            try_generate_struct(global_type, parser.parse(custom_struct_str).ext[0].type.type)
+STATIC mp_obj_t mp_lv_obj_wait_event(size_t n_args, const mp_obj_t *args)
+{
+    LV_OBJ_T *obj = mp_to_lv(args[0]);
+    mp_lv_awaitable_t *self = mp_lv_awaitable_new(obj, mp_lv_wait_event_cleanup);
+    self->waiter->code = n_args > 1 ? mp_obj_get_int(args[1]) : LV_EVENT_ALL;
+    MP_LV_LOCK_BEGIN();
+    lv_obj_add_event(obj, mp_lv_wait_event_cb, LV_EVENT_ALL, self->waiter);
+    MP_LV_LOCK_END();
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_lv_obj_wait_event_obj, 1, 2, mp_lv_obj_wait_event);
+""")
+    obj_extension_members[base_obj_name].append('{ MP_ROM_QSTR(MP_QSTR_wait_event), MP_ROM_PTR(&mp_lv_obj_wait_event_obj) }')
 
+if awaitable_anim_done:
     print("""
 /*
- * {module_name} {global_name} global definitions
+ * anim.done()
+ * Resolves when a running animation (returned by anim.start()) completes or is deleted.
+ * The animation's deleted_cb is replaced, and called after resolving.
  */
 
-STATIC const mp_lv_struct_t mp_{global_name} = {{
-    {{ &mp_{struct_name}_type }},
-    ({cast}*)&{global_name}
-}};
-    """.format(
-            module_name = module_name,
-            global_name = global_name,
-            struct_name = global_type,
-            sanitized_struct_name = sanitize(global_type),
-            cast = gen.visit(global_type_ast)))
+MP_REGISTER_ROOT_POINTER(struct mp_lv_waiter_t *mp_lv_anim_waiters);
 
-generated_globals = []
-for global_name in blobs:
-    try:
-        gen_global(global_name, blobs[global_name])
-        generated_globals.append(global_name)
-    except MissingConversionException as exp:
-        gen_func_error(global_name, exp)
+STATIC bool mp_lv_anim_is_running(const lv_anim_t *a)
+{
+    // A completed animation is freed, so a is only compared with the running ones, not read.
+    // (A new animation can reuse its memory. done() then waits for the new one.)
+    lv_ll_t *anims = &LV_GC_ROOT(_lv_anim_ll);
+    for (lv_anim_t *running = _lv_ll_get_head(anims); running; running = _lv_ll_get_next(anims, running)) {
+        if (running == a) return true;
+    }
+    return false;
+}
 
-#
-# Generate struct-functions
-#
+STATIC void mp_lv_anim_done_deleted_cb(lv_anim_t *a)
+{
+    lv_anim_deleted_cb_t chained_cb = NULL;
+    mp_lv_waiter_t **p = &MP_STATE_VM(mp_lv_anim_waiters);
+    while (*p) {
+        mp_lv_waiter_t *waiter = *p;
+        if (waiter->target == a) {
+            *p = waiter->next;
+            waiter->target = NULL;
+            if (waiter->chained_cb) chained_cb = waiter->chained_cb;
+            mp_lv_waiter_resolve(waiter, mp_const_none, false);
+        } else {
+            p = &waiter->next;
+        }
+    }
+    if (chained_cb) chained_cb(a);
+}
 
-# eprint("/* Generating struct-functions */")
-try_generate_structs_from_first_argument()
+STATIC void mp_lv_anim_done_cleanup(mp_lv_waiter_t *waiter)
+{
+    lv_anim_t *a = waiter->target;
+    if (!a) return;
+    mp_lv_waiter_t *other = NULL;
+    mp_lv_waiter_t **p = &MP_STATE_VM(mp_lv_anim_waiters);
+    while (*p) {
+        if (*p == waiter) {
+            *p = waiter->next;
+        } else {
+            if ((*p)->target == a) other = *p;
+            p = &(*p)->next;
+        }
+    }
+    // Hand the replaced deleted_cb to another waiter, or restore it
+    if (other) {
+        if (waiter->chained_cb) other->chained_cb = waiter->chained_cb;
+    } else {
+        a->deleted_cb = waiter->chained_cb;
+    }
+}
 
-def generate_struct_functions(struct_list):
-    # print('/* List of structs: %s */' % repr(struct_list))
-    for struct_name in struct_list:
-        if not generated_structs[struct_name]: continue
-        sanitized_struct_name = sanitize(struct_name)
-        struct_funcs = get_struct_functions(struct_name)
-        # print('/* Struct %s contains: %s */' % (struct_name, [f.name for f in struct_funcs]))
-        for struct_func in struct_funcs[:]: # clone list because we are changing it in the loop.
-            try:
-                if struct_func.name not in generated_funcs:
-                    gen_mp_func(struct_func, struct_name)
-            except MissingConversionException as exp:
-                gen_func_error(struct_func, exp)
-                struct_funcs.remove(struct_func)
-        if struct_name not in structs or structs[struct_name].decls:
-            struct_size_attr = '{{ MP_ROM_QSTR(MP_QSTR___SIZE__), MP_ROM_PTR(MP_ROM_INT(sizeof({struct_tag}{struct_name}))) }},'.format(
-                struct_name = struct_name,
-                struct_tag = 'struct ' if struct_name in structs_without_typedef.keys() else '',
-            )
-        else:
-            struct_size_attr = ''
-        print('''
-STATIC const mp_rom_map_elem_t mp_{sanitized_struct_name}_locals_dict_table[] = {{
-    {struct_size}
-    {functions}
-}};
+STATIC mp_obj_t mp_lv_anim_done(mp_obj_t anim_in)
+{
+    lv_anim_t *a = mp_to_lv_struct(anim_in)->data;
+    mp_lv_awaitable_t *self = mp_lv_awaitable_new(a, mp_lv_anim_done_cleanup);
+    mp_lv_waiter_t *waiter = self->waiter;
+    MP_LV_LOCK_BEGIN();
+    if (!mp_lv_anim_is_running(a)) {
+        // Completed already
+        waiter->target = NULL;
+        waiter->result = mp_const_none;
+    } else {
+        if (a->deleted_cb != mp_lv_anim_done_deleted_cb) {
+            waiter->chained_cb = a->deleted_cb;
+            a->deleted_cb = mp_lv_anim_done_deleted_cb;
+        }
+        waiter->next = MP_STATE_VM(mp_lv_anim_waiters);
+        MP_STATE_VM(mp_lv_anim_waiters) = waiter;
+    }
+    MP_LV_LOCK_END();
+    return MP_OBJ_FROM_PTR(self);
+}
 
-STATIC MP_DEFINE_CONST_DICT(mp_{sanitized_struct_name}_locals_dict, mp_{sanitized_struct_name}_locals_dict_table);
-        '''.format(
-            struct_size = struct_size_attr,
-            sanitized_struct_name = sanitized_struct_name,
-            functions =  ''.join(['{{ MP_ROM_QSTR(MP_QSTR_{name}), MP_ROM_PTR(&mp_{func}_mpobj) }},\n    '.
-                format(name = sanitize(noncommon_part(f.name, struct_name)), func = f.name) for f in struct_funcs]),
-        ))
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_anim_done_obj, mp_lv_anim_done);
+""")
+    struct_extension_members['lv_anim_t'].append('{ MP_ROM_QSTR(MP_QSTR_done), MP_ROM_PTR(&mp_lv_anim_done_obj) }')
 
-        generated_struct_functions[struct_name] = True
+if awaitable_next_frame:
+    print("""
+/*
+ * lvgl.next_frame(disp=None)
+ * Resolves when the display (by default, the default display) finishes its next refresh.
+ */
 
-generate_struct_functions(list(generated_structs.keys()))
+STATIC void mp_lv_next_frame_cb(lv_event_t *e)
+{
+    mp_lv_waiter_resolve(lv_event_get_user_data(e), mp_const_none, false);
+}
 
-#
-# Generate all module functions (not including method functions which were already generated)
-#
+STATIC void mp_lv_next_frame_cleanup(mp_lv_waiter_t *waiter)
+{
+    // The display might have been deleted
+    lv_disp_t *disp = lv_disp_get_next(NULL);
+    while (disp && disp != waiter->target) disp = lv_disp_get_next(disp);
+    if (!disp) return;
+    for (uint32_t i = lv_disp_get_event_count(disp); i-- > 0;) {
+        if (lv_event_dsc_get_user_data(lv_disp_get_event_dsc(disp, i)) == waiter) {
+            lv_disp_remove_event(disp, i);
+            break;
+        }
+    }
+}
 
-print("""
-/*
- *
- * Global Module Functions
- *
- */
+STATIC mp_obj_t mp_lv_next_frame(size_t n_args, const mp_obj_t *args)
+{
+    MP_LV_LOCK_BEGIN();
+    lv_disp_t *disp = n_args > 0 && args[0] != mp_const_none ? mp_to_ptr(args[0]) : lv_disp_get_default();
+    if (!disp) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_RuntimeError, MP_ERROR_TEXT("No display")));
+    mp_lv_awaitable_t *self = mp_lv_awaitable_new(disp, mp_lv_next_frame_cleanup);
+    lv_disp_add_event(disp, mp_lv_next_frame_cb, LV_EVENT_REFR_FINISH, self->waiter);
+    MP_LV_LOCK_END();
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_lv_next_frame_obj, 0, 1, mp_lv_next_frame);
 """)
+    extension_globals.append(('next_frame', '&mp_lv_next_frame_obj'))
 
-# eprint("/* Generating global module functions /*")
-module_funcs = [func for func in funcs if not func.name in generated_funcs]
-for module_func in module_funcs[:]: # clone list because we are changing it in the loop.
-    if module_func.name in generated_funcs:
-        continue # generated_funcs could change inside the loop so need to recheck.
+def try_generate_arg_type(func_name, index):
+    # Generate the conversions of a function argument type, and return its type name
+    func = next(func for func in all_funcs if func.name == func_name)
+    arg = func.type.args.params[index]
     try:
-        gen_mp_func(module_func, None)
-        # A new function can create new struct with new function structs
-        new_structs = [s for s in generated_structs if s not in generated_struct_functions]
-        if new_structs:
-            generate_struct_functions(new_structs)
-    except MissingConversionException as exp:
-        gen_func_error(module_func, exp)
-        module_funcs.remove(module_func)
-
-functions_not_generated = [func.name for func in funcs if func.name not in generated_funcs]
-if len(functions_not_generated) > 0:
+        try_generate_type(arg.type)
+    except MissingConversionException:
+        pass
+    return get_type(arg.type, remove_quals = True)
+
+if len(obj_names) > 0 and has_funcs('lv_event_get_code') and \
+        lv_to_mp.get(try_generate_arg_type('lv_event_get_code', 0), '').startswith('mp_read_ptr_') and has_funcs(
+        'lv_obj_add_event', 'lv_obj_get_event_count', 'lv_obj_get_event_dsc', 'lv_obj_remove_event',
+        'lv_event_dsc_get_cb', 'lv_event_dsc_get_user_data', 'lv_event_get_user_data', 'lv_event_get_code',
+        'lv_event_get_target', 'lv_event_get_current_target', 'lv_timer_create', 'lv_timer_del', 'lv_timer_pause', 'lv_timer_resume', 'lv_timer_reset',
+        'lv_timer_set_period', 'lv_timer_get_user_data', 'lv_tick_get', 'lv_tick_elaps'):
     print("""
 /*
- * Functions not generated:
- * {funcs}
+ * Coalesced events
  *
+ *   obj.add_coalesced_event(event_cb, lvgl.EVENT.PRESSING, period=0)
+ *   obj.remove_coalesced_event(event_cb)
+ *
+ * Delivers events of the given code to event_cb at most once per period ms (0: once per refresh period,
+ * LV_DEF_REFR_PERIOD). The first event after a quiet period is delivered immediately. Events that arrive
+ * within the period only update the latest event, which is delivered when the period ends.
+ * Events dropped this way don't call into Python at all.
+ * A delayed event is a copy whose param is NULL, since the param of the original event is not valid anymore.
+ * A delayed event is dropped when its target (obj, or a child it bubbled from) is deleted.
  */
 
-""".format(funcs = "\n * ".join(functions_not_generated)))
-
-#
-# Generate callback functions
-#
+typedef struct mp_lv_coalesced_event_t {
+    mp_obj_t event_cb;
+    lv_timer_t *timer;          // Delivers the pending event
+    uint32_t period;
+    uint32_t last_delivery;     // lv_tick_get() of the last delivery
+    bool pending;
+    lv_event_t latest;          // Copy of the latest pending event
+    LV_OBJ_T *watched;          // Target of the pending event other than obj, watched for deletion
+} mp_lv_coalesced_event_t;
+
+typedef struct mp_lv_coalesced_delivery_t {
+    mp_lv_coalesced_event_t *self;
+    lv_event_t *e;
+} mp_lv_coalesced_delivery_t;
+
+STATIC void mp_lv_coalesced_event_call(void *arg)
+{
+    mp_lv_coalesced_delivery_t *delivery = arg;
+    MP_LV_CALLBACK_ENTER();
+    mp_call_function_1(delivery->self->event_cb, {event_convertor}(delivery->e));
+    MP_LV_CALLBACK_EXIT();
+}
+
+STATIC void mp_lv_coalesced_event_deliver(mp_lv_coalesced_event_t *self, lv_event_t *e)
+{
+    mp_lv_coalesced_delivery_t delivery = { .self = self, .e = e };
+    self->last_delivery = lv_tick_get();
+#if MP_LV_RENDER_THREAD
+    if (mp_lv_render_thread_is_current()) {
+        mp_lv_render_thread_call(mp_lv_coalesced_event_call, &delivery);
+        return;
+    }
+#endif
+    mp_lv_coalesced_event_call(&delivery);
+}
+
+STATIC void mp_lv_coalesced_event_target_delete_cb(lv_event_t *e)
+{
+    // The target of the pending event is being deleted
+    mp_lv_coalesced_event_t *self = lv_event_get_user_data(e);
+    self->watched = NULL;
+    self->pending = false;
+    if (self->timer) lv_timer_pause(self->timer);
+}
+
+STATIC void mp_lv_coalesced_event_unwatch(mp_lv_coalesced_event_t *self)
+{
+    LV_OBJ_T *target = self->watched;
+    if (!target) return;
+    self->watched = NULL;
+    for (uint32_t i = lv_obj_get_event_count(target); i-- > 0;) {
+        lv_event_dsc_t *dsc = lv_obj_get_event_dsc(target, i);
+        if (lv_event_dsc_get_cb(dsc) == mp_lv_coalesced_event_target_delete_cb && lv_event_dsc_get_user_data(dsc) == self) {
+            lv_obj_remove_event(target, i);
+            break;
+        }
+    }
+}
+
+STATIC void mp_lv_coalesced_event_timer_cb(lv_timer_t *timer)
+{
+    mp_lv_coalesced_event_t *self = lv_timer_get_user_data(timer);
+    lv_timer_pause(timer);
+    if (!self->pending) return;
+    self->pending = false;
+    mp_lv_coalesced_event_unwatch(self);
+    mp_lv_coalesced_event_deliver(self, &self->latest);
+}
+
+STATIC void mp_lv_coalesced_event_cb(lv_event_t *e)
+{
+    mp_lv_coalesced_event_t *self = lv_event_get_user_data(e);
+    if (!self->timer) return;
+    uint32_t elapsed = lv_tick_elaps(self->last_delivery);
+    if (!self->pending && elapsed >= self->period) {
+        mp_lv_coalesced_event_deliver(self, e);
+        return;
+    }
+    // Deletion of obj stops the delivery (mp_lv_coalesced_event_delete_cb). Watch the target if it's another object.
+    LV_OBJ_T *target = lv_event_get_target(e);
+    if (target == lv_event_get_current_target(e)) target = NULL;
+    if (target != self->watched) {
+        mp_lv_coalesced_event_unwatch(self);
+        if (target) {
+            lv_obj_add_event(target, mp_lv_coalesced_event_target_delete_cb, LV_EVENT_DELETE, self);
+            self->watched = target;
+        }
+    }
+    self->latest = *e;
+    self->latest.param = NULL;
+    self->latest.prev = NULL;
+    if (!self->pending) {
+        self->pending = true;
+        lv_timer_set_period(self->timer, self->period - elapsed);
+        lv_timer_reset(self->timer);
+        lv_timer_resume(self->timer);
+    }
+}
+
+STATIC void mp_lv_coalesced_event_stop(mp_lv_coalesced_event_t *self)
+{
+    self->pending = false;
+    mp_lv_coalesced_event_unwatch(self);
+    if (self->timer) {
+        lv_timer_del(self->timer);
+        self->timer = NULL;
+    }
+}
+
+STATIC void mp_lv_coalesced_event_delete_cb(lv_event_t *e)
+{
+    mp_lv_coalesced_event_stop(lv_event_get_user_data(e));
+}
+
+STATIC mp_obj_t mp_lv_obj_add_coalesced_event(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
+{
+    enum { ARG_self, ARG_event_cb, ARG_filter, ARG_period };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_self, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+        { MP_QSTR_event_cb, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+        { MP_QSTR_filter, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_period, MP_ARG_INT, {.u_int = 0} },
+    };
+    mp_arg_val_t parsed[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, parsed);
+
+    LV_OBJ_T *obj = mp_to_lv(parsed[ARG_self].u_obj);
+    if (!mp_obj_is_callable(parsed[ARG_event_cb].u_obj)) nlr_raise(
+        mp_obj_new_exception_msg(&mp_type_TypeError, MP_ERROR_TEXT("event_cb must be callable")));
+    if (parsed[ARG_period].u_int < 0) nlr_raise(
+        mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("period must not be negative")));
+
+    mp_lv_coalesced_event_t *self = m_new0(mp_lv_coalesced_event_t, 1);
+    self->event_cb = parsed[ARG_event_cb].u_obj;
+    self->period = parsed[ARG_period].u_int > 0? parsed[ARG_period].u_int: LV_DEF_REFR_PERIOD;
+    MP_LV_LOCK_BEGIN();
+    self->last_delivery = lv_tick_get() - self->period;
+    self->timer = lv_timer_create(mp_lv_coalesced_event_timer_cb, self->period, self);
+    lv_timer_pause(self->timer);
+    lv_obj_add_event(obj, mp_lv_coalesced_event_cb, parsed[ARG_filter].u_int, self);
+    lv_obj_add_event(obj, mp_lv_coalesced_event_delete_cb, LV_EVENT_DELETE, self);
+    MP_LV_LOCK_END();
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(mp_lv_obj_add_coalesced_event_obj, 3, mp_lv_obj_add_coalesced_event);
+
+STATIC mp_obj_t mp_lv_obj_remove_coalesced_event(mp_obj_t obj_in, mp_obj_t event_cb)
+{
+    // Removes all the registrations of event_cb. Returns whether any was found.
+    LV_OBJ_T *obj = mp_to_lv(obj_in);
+    bool found = false;
+    MP_LV_LOCK_BEGIN();
+    for (uint32_t i = lv_obj_get_event_count(obj); i-- > 0;) {
+        lv_event_dsc_t *dsc = lv_obj_get_event_dsc(obj, i);
+        lv_event_cb_t cb = lv_event_dsc_get_cb(dsc);
+        if (cb != mp_lv_coalesced_event_cb && cb != mp_lv_coalesced_event_delete_cb) continue;
+        mp_lv_coalesced_event_t *self = lv_event_dsc_get_user_data(dsc);
+        if (!mp_obj_equal(self->event_cb, event_cb)) continue;
+        mp_lv_coalesced_event_stop(self);
+        lv_obj_remove_event(obj, i);
+        found = true;
+    }
+    MP_LV_LOCK_END();
+    return mp_obj_new_bool(found);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(mp_lv_obj_remove_coalesced_event_obj, mp_lv_obj_remove_coalesced_event);
+""".replace('{event_convertor}', lv_to_mp[try_generate_arg_type('lv_event_get_code', 0)]))
+    obj_extension_members[base_obj_name].append('{ MP_ROM_QSTR(MP_QSTR_add_coalesced_event), MP_ROM_PTR(&mp_lv_obj_add_coalesced_event_obj) }')
+    obj_extension_members[base_obj_name].append('{ MP_ROM_QSTR(MP_QSTR_remove_coalesced_event), MP_ROM_PTR(&mp_lv_obj_remove_coalesced_event_obj) }')
+
+# Properties that obj.animate can animate: (name, setter, expression that sets the value on var)
+animate_props = [
+    ('x', 'lv_obj_set_x', 'lv_obj_set_x(var, value)'),
+    ('y', 'lv_obj_set_y', 'lv_obj_set_y(var, value)'),
+    ('width', 'lv_obj_set_width', 'lv_obj_set_width(var, value)'),
+    ('height', 'lv_obj_set_height', 'lv_obj_set_height(var, value)'),
+    ('opa', 'lv_obj_set_style_opa', 'lv_obj_set_style_opa(var, value, 0)'),
+    ('bg_opa', 'lv_obj_set_style_bg_opa', 'lv_obj_set_style_bg_opa(var, value, 0)'),
+    ('translate_x', 'lv_obj_set_style_translate_x', 'lv_obj_set_style_translate_x(var, value, 0)'),
+    ('translate_y', 'lv_obj_set_style_translate_y', 'lv_obj_set_style_translate_y(var, value, 0)'),
+    ('transform_angle', 'lv_obj_set_style_transform_angle', 'lv_obj_set_style_transform_angle(var, value, 0)'),
+    ('transform_zoom', 'lv_obj_set_style_transform_zoom', 'lv_obj_set_style_transform_zoom(var, value, 0)'),
+    ('scroll_x', 'lv_obj_scroll_to_x', 'lv_obj_scroll_to_x(var, value, LV_ANIM_OFF)'),
+    ('scroll_y', 'lv_obj_scroll_to_y', 'lv_obj_scroll_to_y(var, value, LV_ANIM_OFF)'),
+]
+animate_props = [prop for prop in animate_props if has_funcs(prop[1])]
+animate_paths = [path for path in ['linear', 'ease_in', 'ease_out', 'ease_in_out', 'overshoot', 'bounce', 'step']
+    if has_funcs('lv_anim_path_%s' % path)]
+
+if len(obj_names) > 0 and len(animate_props) > 0 and 'linear' in animate_paths and has_funcs(
+        'lv_anim_init', 'lv_anim_set_var', 'lv_anim_set_exec_cb', 'lv_anim_set_values', 'lv_anim_set_time',
+        'lv_anim_set_delay', 'lv_anim_set_path_cb', 'lv_anim_set_playback_time', 'lv_anim_set_repeat_count',
+        'lv_anim_set_ready_cb', 'lv_anim_set_user_data', 'lv_anim_get_user_data', 'lv_anim_start') and \
+        lv_to_mp.get(try_generate_arg_type('lv_anim_init', 0), '').startswith('mp_read_ptr_'):
+    print("""
+/*
+ * Native property animations
+ *
+ *   obj.animate('x', 0, 100, time=500, path=lvgl.anim_t.path_ease_out, delay=0, playback=False, repeat=1, ready_cb=None)
+ *
+ * Animates a property of the object with LVGL's own setter and path functions, so no Python code runs on
+ * animation frames. path is a built-in path function (lvgl.anim_t.path_*) or its name ('ease_out'), and defaults
+ * to linear. playback plays the animation backwards when it ends, and repeat is the number of times it runs
+ * (-1: forever). ready_cb(obj) is called when the animation completes.
+ * Starting an animation replaces a running animation of the same property of the object.
+ * Returns the running animation, which can be awaited with anim.done().
+ */
+
+typedef struct mp_lv_animate_prop_t {
+    qstr name;
+    lv_anim_exec_xcb_t exec_cb;
+} mp_lv_animate_prop_t;
+
+typedef struct mp_lv_animate_path_t {
+    qstr name;
+    lv_anim_path_cb_t path_cb;
+} mp_lv_animate_path_t;
+""")
+    for name, setter, expression in animate_props:
+        print("STATIC void mp_lv_animate_%s(void *var, int32_t value) { %s; }" % (name, expression))
+    print("""
+STATIC const mp_lv_animate_prop_t mp_lv_animate_props[] = {
+    %s
+};
+
+STATIC const mp_lv_animate_path_t mp_lv_animate_paths[] = {
+    %s
+};
+""" % (',\n    '.join('{ MP_QSTR_%s, mp_lv_animate_%s }' % (name, name) for name, _, _ in animate_props),
+       ',\n    '.join('{ MP_QSTR_%s, lv_anim_path_%s }' % (path, path) for path in animate_paths)))
+    print("""
+STATIC lv_anim_exec_xcb_t mp_lv_animate_get_exec_cb(mp_obj_t prop)
+{
+    size_t len;
+    const char *name = mp_obj_str_get_data(prop, &len);
+    qstr name_qstr = qstr_find_strn(name, len);
+    for (size_t i = 0; i < MP_ARRAY_SIZE(mp_lv_animate_props); i++) {
+        if (mp_lv_animate_props[i].name == name_qstr) return mp_lv_animate_props[i].exec_cb;
+    }
+    nlr_raise(mp_obj_new_exception_msg_varg(&mp_type_ValueError, MP_ERROR_TEXT("Cannot animate '%s'"), name));
+}
+
+STATIC lv_anim_path_cb_t mp_lv_animate_get_path_cb(mp_obj_t path)
+{
+    // Only built-in paths are accepted, so the path is never a Python callback
+    if (path == mp_const_none) return lv_anim_path_linear;
+    qstr name_qstr = MP_QSTRnull;
+    void *lv_fun = NULL;
+    if (mp_obj_is_str(path)) {
+        size_t len;
+        const char *name = mp_obj_str_get_data(path, &len);
+        name_qstr = qstr_find_strn(name, len);
+    } else if (mp_obj_is_type(path, &mp_lv_type_fun_builtin_var) || mp_obj_is_type(path, &mp_lv_type_fun_builtin_static_var)) {
+        lv_fun = ((mp_lv_obj_fun_builtin_var_t *)MP_OBJ_TO_PTR(path))->lv_fun;
+    }
+    for (size_t i = 0; i < MP_ARRAY_SIZE(mp_lv_animate_paths); i++) {
+        if (mp_lv_animate_paths[i].name == name_qstr || (void*)mp_lv_animate_paths[i].path_cb == lv_fun)
+            return mp_lv_animate_paths[i].path_cb;
+    }
+    nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("path must be a built-in path function")));
+}
+
+STATIC void mp_lv_animate_ready_call(void *arg)
+{
+    // The user data of the animation is a (ready_cb, obj) tuple
+    mp_obj_tuple_t *ready = lv_anim_get_user_data(arg);
+    MP_LV_CALLBACK_ENTER();
+    mp_call_function_1(ready->items[0], ready->items[1]);
+    MP_LV_CALLBACK_EXIT();
+}
+
+STATIC void mp_lv_animate_ready_cb(lv_anim_t *a)
+{
+#if MP_LV_RENDER_THREAD
+    if (mp_lv_render_thread_is_current()) {
+        mp_lv_render_thread_call(mp_lv_animate_ready_call, a);
+        return;
+    }
+#endif
+    mp_lv_animate_ready_call(a);
+}
+
+STATIC mp_obj_t mp_lv_obj_animate(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
+{
+    enum { ARG_self, ARG_prop, ARG_start, ARG_end, ARG_time, ARG_path, ARG_delay, ARG_playback, ARG_repeat, ARG_ready_cb };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_self, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+        { MP_QSTR_prop, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+        { MP_QSTR_start, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_end, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_time, MP_ARG_INT, {.u_int = 500} },
+        { MP_QSTR_path, MP_ARG_OBJ, {.u_obj = mp_const_none} },
+        { MP_QSTR_delay, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_playback, MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = false} },
+        { MP_QSTR_repeat, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 1} },
+        { MP_QSTR_ready_cb, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = mp_const_none} },
+    };
+    mp_arg_val_t parsed[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, parsed);
+
+    LV_OBJ_T *obj = mp_to_lv(parsed[ARG_self].u_obj);
+    lv_anim_exec_xcb_t exec_cb = mp_lv_animate_get_exec_cb(parsed[ARG_prop].u_obj);
+    lv_anim_path_cb_t path_cb = mp_lv_animate_get_path_cb(parsed[ARG_path].u_obj);
+    mp_int_t time = parsed[ARG_time].u_int;
+    mp_int_t repeat = parsed[ARG_repeat].u_int;
+    mp_obj_t ready = mp_const_none;
+    if (parsed[ARG_ready_cb].u_obj != mp_const_none) {
+        mp_obj_t items[] = { parsed[ARG_ready_cb].u_obj, parsed[ARG_self].u_obj };
+        ready = mp_obj_new_tuple(2, items);
+    }
+
+    lv_anim_t a;
+    lv_anim_t *running;
+    MP_LV_LOCK_BEGIN();
+    lv_anim_init(&a);
+    lv_anim_set_var(&a, obj);
+    lv_anim_set_exec_cb(&a, exec_cb);
+    lv_anim_set_values(&a, parsed[ARG_start].u_int, parsed[ARG_end].u_int);
+    lv_anim_set_time(&a, time);
+    lv_anim_set_delay(&a, parsed[ARG_delay].u_int);
+    lv_anim_set_path_cb(&a, path_cb);
+    if (parsed[ARG_playback].u_bool) lv_anim_set_playback_time(&a, time);
+    lv_anim_set_repeat_count(&a, repeat < 0? LV_ANIM_REPEAT_INFINITE: repeat);
+    if (ready != mp_const_none) {
+        lv_anim_set_user_data(&a, MP_OBJ_TO_PTR(ready));
+        lv_anim_set_ready_cb(&a, mp_lv_animate_ready_cb);
+    }
+    running = lv_anim_start(&a);
+    MP_LV_LOCK_END();
+    return {anim_convertor}(running);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(mp_lv_obj_animate_obj, 4, mp_lv_obj_animate);
+""".replace('{anim_convertor}', lv_to_mp[try_generate_arg_type('lv_anim_init', 0)]))
+    obj_extension_members[base_obj_name].append('{ MP_ROM_QSTR(MP_QSTR_animate), MP_ROM_PTR(&mp_lv_obj_animate_obj) }')
+
+#
+# Emit Mpy objects definitions
+#
+
+enum_referenced = collections.OrderedDict()
+
+def gen_obj_methods(obj_name):
+    global enums
+    helper_members = ["{ MP_ROM_QSTR(MP_QSTR___cast__), MP_ROM_PTR(&cast_obj_class_method) }"] if len(obj_names) > 0 and obj_name == base_obj_name else []
+    members = ["{{ MP_ROM_QSTR(MP_QSTR_{method_name}), MP_ROM_PTR(&mp_{method}_mpobj) }}".
+                    format(method=method.name, method_name=sanitize(method_name_from_func_name(method.name))) for method in get_methods(obj_name)]
+    obj_metadata[obj_name]['members'].update({method_name_from_func_name(method.name): func_metadata[method.name] for method in get_methods(obj_name)})
+    # add parent methods
+    parent_members = []
+    if obj_name in parent_obj_names and parent_obj_names[obj_name] != None:
+        # parent_members += gen_obj_methods(parent_obj_names[obj_name])
+        obj_metadata[obj_name]['members'].update(obj_metadata[parent_obj_names[obj_name]]['members'])
+    # add enum members
+    enum_members = ["{{ MP_ROM_QSTR(MP_QSTR_{enum_member}), MP_ROM_PTR({enum_member_value}) }}".
+                    format(enum_member = sanitize(get_enum_member_name(enum_member_name)), enum_member_value = get_enum_value(obj_name, enum_member_name)) for enum_member_name in get_enum_members(obj_name)]
+    obj_metadata[obj_name]['members'].update({get_enum_member_name(enum_member_name): {'type':'enum_member'} for enum_member_name in get_enum_members(obj_name)})
+    # add enums that match object name
+    obj_enums = [enum_name for enum_name in enums.keys() if is_method_of(enum_name, obj_name)]
+    enum_types = ["{{ MP_ROM_QSTR(MP_QSTR_{name}), MP_ROM_PTR(&mp_lv_{enum}_type_base) }}".
+                    format(name=sanitize(method_name_from_func_name(enum_name)), enum=enum_name) for enum_name in obj_enums]
+    obj_metadata[obj_name]['members'].update({method_name_from_func_name(enum_name): {'type':'enum_type'} for enum_name in obj_enums})
+    for enum_name in obj_enums:
+        obj_metadata[obj_name]['members'][method_name_from_func_name(enum_name)].update(obj_metadata[enum_name])
+        enum_referenced[enum_name] = True
+    return members + parent_members + enum_members + enum_types + helper_members + obj_extension_members[obj_name]
+
+def gen_obj(obj_name):
+    # eprint('Generating object %s...' % obj_name)
+    is_obj = has_ctor(obj_name)
+    should_add_base_methods = is_obj and obj_name != 'obj'
+    obj_metadata[obj_name] = {'members' : collections.OrderedDict()}
+
+    # Generate object methods
+    for method in get_methods(obj_name):
+        try:
+            gen_mp_func(method, obj_name)
+        except MissingConversionException as exp:
+            gen_func_error(method, exp)
+
+    # Generate object construction function, if needed
+    if is_obj:
+        ctor_func = get_ctor(obj_name)
+        try:
+            gen_mp_func(ctor_func, obj_name)
+        except MissingConversionException as exp:
+            gen_func_error(ctor_func, exp)
+
+    # print([method.name for method in methods])
+    ctor = """
+STATIC mp_obj_t {obj}_make_new(
+    const mp_obj_type_t *type,
+    size_t n_args,
+    size_t n_kw,
+    const mp_obj_t *args)
+{{
+    return make_new(&mp_{ctor_name}_mpobj, type, n_args, n_kw, args);
+}}
+"""
+
+    print("""
+/*
+ * {module_name} {obj} object definitions
+ */
+    """.format(
+            module_name = module_name,
+            obj = obj_name))
+
+    print("""
+STATIC const mp_rom_map_elem_t {obj}_locals_dict_table[] = {{
+    {locals_dict_entries}
+}};
+
+STATIC MP_DEFINE_CONST_DICT({obj}_locals_dict, {obj}_locals_dict_table);
+
+STATIC void {obj}_print(const mp_print_t *print,
+    mp_obj_t self_in,
+    mp_print_kind_t kind)
+{{
+    mp_printf(print, "{module_name} {obj}");
+}}
+
+{ctor}
+
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_lv_{obj}_type_base,
+    MP_QSTR_{obj},
+    MP_TYPE_FLAG_NONE,
+    print, {obj}_print,
+    {make_new}
+    {binary_op}
+    attr, call_parent_methods,
+    {buffer}
+    {parent}
+    locals_dict, &{obj}_locals_dict
+);
+
+GENMPY_UNUSED STATIC const mp_lv_obj_type_t mp_lv_{obj}_type = {{
+#ifdef LV_OBJ_T
+    .lv_obj_class = {lv_class},
+#endif
+    .mp_obj_type = &mp_lv_{obj}_type_base,
+}};
+    """.format(
+            module_name = module_name,
+            obj = sanitize(obj_name), base_obj = base_obj_name,
+            base_class = '&mp_%s_type' % base_obj_name if should_add_base_methods else 'NULL',
+            locals_dict_entries = ",\n    ".join(gen_obj_methods(obj_name)),
+            ctor = ctor.format(obj = obj_name, ctor_name = ctor_func.name) if has_ctor(obj_name) else '',
+            make_new = 'make_new, %s_make_new,' % obj_name if is_obj else '',
+            binary_op = 'binary_op, mp_lv_obj_binary_op,' if is_obj else '',
+            buffer = 'buffer, mp_lv_obj_get_buffer,' if is_obj else '',
+            parent = 'parent, &mp_lv_%s_type_base,' % parent_obj_names[obj_name] if obj_name in parent_obj_names and parent_obj_names[obj_name] else '',
+            lv_class = '&lv_%s_class' % obj_name if is_obj else 'NULL',
+            ))
+
+#
+# Generate Enum objects
+#
+
+for enum_name in list(enums.keys()):
+    gen_obj(enum_name)
+
+#
+# Generate all other objects. Generate parent objects first
+#
+
+generated_obj_names = collections.OrderedDict()
+for obj_name in obj_names:
+    # eprint("--> %s [%s]" % (obj_name, ", ".join([name for name in generated_obj_names])))
+    parent_obj_name = parent_obj_names[obj_name] if obj_name in parent_obj_names else None
+
+    while parent_obj_name != None and not parent_obj_name in generated_obj_names:
+        gen_obj(parent_obj_name)
+        generated_obj_names[parent_obj_name] = True
+        parent_obj_name = parent_obj_names[parent_obj_name] if parent_obj_name in parent_obj_names else None
+
+    if not obj_name in generated_obj_names:
+        # eprint("--> gen obj %s" % obj_name)
+        gen_obj(obj_name)
+        generated_obj_names[obj_name] = True
+
+#
+# Generate structs which contain function members
+# First argument of a function could be it's parent struct
+# Need to make sure these structs are generated *before* struct-functions are
+# Otherwise we will not know of all the structs when generating struct-functions
+#
+
+def try_generate_structs_from_first_argument():
+    for func in funcs:
+        if func.name in generated_funcs: continue
+        args = func.type.args.params if func.type.args else []
+        if len(args) < 1: continue
+        arg_type = get_type(args[0].type, remove_quals = True)
+        if arg_type not in mp_to_lv or not mp_to_lv[arg_type]:
+            try:
+                try_generate_type(args[0].type)
+            except MissingConversionException as e:
+                print('''
+/*
+ * {struct} not generated: {err}
+ */
+                '''.format(struct=arg_type, err=e))
+
+#
+# Generate globals
+#
+
+# eprint("/* Generating globals */")
+
+def gen_global(global_name, global_type_ast):
+    global_type = get_type(global_type_ast, remove_quals=True)
+    generated_global = try_generate_type(global_type_ast)
+    # print("/* generated_global = %s */" % generated_global)
+    if global_type not in generated_structs:
+        wrapped_type = lv_mp_type[global_type]
+        if not wrapped_type:
+            raise MissingConversionException('Missing conversion to %s when generating global %s' % (wrapped_type, global_name))
+        global_type = sanitize("_lv_mp_%s_wrapper" % wrapped_type)
+        custom_struct_str = """
+typedef struct {{
+    {type} value;
+}} {name};
+        """.format(
+            type = wrapped_type,
+            name = global_type)
+        if global_type not in generated_structs:
+            print("/* Global struct wrapper for %s */" % wrapped_type)
+            print(custom_struct_str)
+            # eprint("%s: %s\n" % (wrapped_type, custom_struct_str))
+            try_generate_struct(global_type, parser.parse(custom_struct_str).ext[0].type.type)
+
+    print("""
+/*
+ * {module_name} {global_name} global definitions
+ */
+
+STATIC const mp_lv_struct_t mp_{global_name} = {{
+    {{ &mp_{struct_name}_type }},
+    ({cast}*)&{global_name}
+}};
+    """.format(
+            module_name = module_name,
+            global_name = global_name,
+            struct_name = global_type,
+            sanitized_struct_name = sanitize(global_type),
+            cast = gen.visit(global_type_ast)))
+
+generated_globals = []
+for global_name in blobs:
+    try:
+        gen_global(global_name, blobs[global_name])
+        generated_globals.append(global_name)
+    except MissingConversionException as exp:
+        gen_func_error(global_name, exp)
+
+#
+# Generate struct-functions
+#
+
+# eprint("/* Generating struct-functions */")
+try_generate_structs_from_first_argument()
+
+def generate_struct_functions(struct_list):
+    # print('/* List of structs: %s */' % repr(struct_list))
+    for struct_name in struct_list:
+        if not generated_structs[struct_name]: continue
+        sanitized_struct_name = sanitize(struct_name)
+        struct_funcs = get_struct_functions(struct_name)
+        # print('/* Struct %s contains: %s */' % (struct_name, [f.name for f in struct_funcs]))
+        for struct_func in struct_funcs[:]: # clone list because we are changing it in the loop.
+            try:
+                if struct_func.name not in generated_funcs:
+                    gen_mp_func(struct_func, struct_name)
+            except MissingConversionException as exp:
+                gen_func_error(struct_func, exp)
+                struct_funcs.remove(struct_func)
+        if struct_name not in structs or structs[struct_name].decls:
+            struct_size_attr = '{{ MP_ROM_QSTR(MP_QSTR___SIZE__), MP_ROM_PTR(MP_ROM_INT(sizeof({struct_tag}{struct_name}))) }},'.format(
+                struct_name = struct_name,
+                struct_tag = 'struct ' if struct_name in structs_without_typedef.keys() else '',
+            )
+        else:
+            struct_size_attr = ''
+        print('''
+STATIC const mp_rom_map_elem_t mp_{sanitized_struct_name}_locals_dict_table[] = {{
+    {struct_size}
+    {functions}
+    {extension_members}
+}};
+
+STATIC MP_DEFINE_CONST_DICT(mp_{sanitized_struct_name}_locals_dict, mp_{sanitized_struct_name}_locals_dict_table);
+        '''.format(
+            struct_size = struct_size_attr,
+            sanitized_struct_name = sanitized_struct_name,
+            functions =  ''.join(['{{ MP_ROM_QSTR(MP_QSTR_{name}), MP_ROM_PTR(&mp_{func}_mpobj) }},\n    '.
+                format(name = sanitize(noncommon_part(f.name, struct_name)), func = f.name) for f in struct_funcs]),
+            extension_members = ''.join(['%s,\n    ' % member for member in struct_extension_members[struct_name]]),
+        ))
+
+        generated_struct_functions[struct_name] = True
+
+generate_struct_functions(list(generated_structs.keys()))
+
+#
+# Generate all module functions (not including method functions which were already generated)
+#
+
+print("""
+/*
+ *
+ * Global Module Functions
+ *
+ */
+""")
+
+# eprint("/* Generating global module functions /*")
+module_funcs = [func for func in funcs if not func.name in generated_funcs]
+for module_func in module_funcs[:]: # clone list because we are changing it in the loop.
+    if module_func.name in generated_funcs:
+        continue # generated_funcs could change inside the loop so need to recheck.
+    try:
+        gen_mp_func(module_func, None)
+        # A new function can create new struct with new function structs
+        new_structs = [s for s in generated_structs if s not in generated_struct_functions]
+        if new_structs:
+            generate_struct_functions(new_structs)
+    except MissingConversionException as exp:
+        gen_func_error(module_func, exp)
+        module_funcs.remove(module_func)
+
+functions_not_generated = [func.name for func in funcs if func.name not in generated_funcs]
+if len(functions_not_generated) > 0:
+    print("""
+/*
+ * Functions not generated:
+ * {funcs}
+ *
+ */
+
+""".format(funcs = "\n * ".join(functions_not_generated)))
+
+#
+# Generate callback functions
+#
 
 # for func_typedef in func_typedefs:
 #     func = func_typedef.type.type
@@ -2860,16 +4152,3272 @@ if len(functions_not_generated) > 0:
 #         lv_to_mp[func_name] = lv_to_mp['void *']
 #         mp_to_lv[func_name] = mp_to_lv['void *']
 
-# eprint("/* Generating callback functions */")
-for (func_name, func, struct_name) in callbacks_used_on_structs:
-    try:
-        # print('/* --> gen_callback_func %s */' % func_name)
-        gen_callback_func(func, func_name = '%s_%s' % (struct_name, func_name))
-    except MissingConversionException as exp:
-        gen_func_error(func, exp)
-        # func_name = get_arg_name(func.type)
-        # lv_to_mp[func_name] = lv_to_mp['void *']
-        # mp_to_lv[func_name] = mp_to_lv['void *']
+# eprint("/* Generating callback functions */")
+for (func_name, func, struct_name) in callbacks_used_on_structs:
+    try:
+        # print('/* --> gen_callback_func %s */' % func_name)
+        gen_callback_func(func, func_name = '%s_%s' % (struct_name, func_name))
+    except MissingConversionException as exp:
+        gen_func_error(func, exp)
+        # func_name = get_arg_name(func.type)
+        # lv_to_mp[func_name] = lv_to_mp['void *']
+        # mp_to_lv[func_name] = mp_to_lv['void *']
+
+#
+# Binding extensions
+# Helpers implemented in C on top of LVGL functions, added to the module globals.
+# Each extension is emitted only when the LVGL functions it uses are available.
+# An extension_globals entry is (name, c_obj) or (name, c_obj, preprocessor condition).
+# Extensions that add members to objects or structs are emitted before the objects (see Awaitables).
+#
+
+if len(obj_names) > 0 and has_funcs(
+        'lv_obj_enable_style_refresh', 'lv_obj_refresh_style', 'lv_obj_update_layout', 'lv_obj_invalidate',
+        'lv_obj_get_disp', 'lv_disp_enable_invalidation', 'lv_disp_is_invalidation_enabled', 'lv_disp_get_next',
+        'lv_disp_get_layer_top', 'lv_disp_get_layer_sys') and \
+        struct_has_fields('lv_disp_t', 'screens', 'screen_cnt'):
+    print("""
+/*
+ * Batch context manager
+ *
+ *   with lvgl.batch(obj):
+ *       ...
+ *
+ * Suspends style refresh and invalidation while the block runs, and refreshes
+ * the style, layout and drawing once when it exits.
+ * Style refresh is suspended globally (LVGL has no per-object switch) and invalidation is suspended on the display of obj.
+ * Changes made in the block are therefore not tracked per object, so on exit the styles of every screen and layer of
+ * every display are refreshed, and they are redrawn. This also redraws what was suppressed, such as the old area
+ * of a moved object or running animations.
+ * Batches can be nested. The refresh takes place when the outermost batch exits.
+ */
+
+typedef struct mp_lv_batch_t {
+    mp_obj_base_t base;
+    mp_obj_t obj;
+} mp_lv_batch_t;
+
+STATIC int mp_lv_batch_depth = 0;
+STATIC lv_disp_t *mp_lv_batch_disp = NULL;
+STATIC bool mp_lv_batch_invalidation_enabled = true;
+
+STATIC mp_obj_t mp_lv_batch_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args)
+{
+    mp_arg_check_num(n_args, n_kw, 1, 1, false);
+    mp_lv_batch_t *self = m_new_obj(mp_lv_batch_t);
+    self->base.type = type;
+    // Keep the mp object registered in user_data, which is notified when the lv_obj is deleted
+    MP_LV_LOCK_BEGIN();
+    self->obj = lv_to_mp(mp_to_lv(args[0]));
+    MP_LV_LOCK_END();
+    if (self->obj == mp_const_none) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_SyntaxError, MP_ERROR_TEXT("batch requires an lv object!")));
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC mp_obj_t mp_lv_batch_enter(mp_obj_t self_in)
+{
+    mp_lv_batch_t *self = MP_OBJ_TO_PTR(self_in);
+    LV_OBJ_T *lv_obj = mp_to_lv(self->obj);
+    MP_LV_LOCK_BEGIN();
+    if (mp_lv_batch_depth++ == 0) {
+        lv_obj_enable_style_refresh(false);
+        mp_lv_batch_disp = lv_obj_get_disp(lv_obj);
+        if (mp_lv_batch_disp) {
+            mp_lv_batch_invalidation_enabled = lv_disp_is_invalidation_enabled(mp_lv_batch_disp);
+            lv_disp_enable_invalidation(mp_lv_batch_disp, false);
+        }
+    }
+    MP_LV_LOCK_END();
+    return self_in;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_batch_enter_obj, mp_lv_batch_enter);
+
+STATIC mp_obj_t mp_lv_batch_exit(size_t n_args, const mp_obj_t *args)
+{
+    mp_lv_batch_t *self = MP_OBJ_TO_PTR(args[0]);
+    MP_LV_LOCK_BEGIN();
+    if (mp_lv_batch_depth > 0 && --mp_lv_batch_depth == 0) {
+        lv_obj_enable_style_refresh(true);
+        if (mp_lv_batch_disp) {
+            lv_disp_enable_invalidation(mp_lv_batch_disp, mp_lv_batch_invalidation_enabled);
+            mp_lv_batch_disp = NULL;
+        }
+
+        // Refreshing the style of a screen refreshes and invalidates its children.
+        // Screens that are not loaded are refreshed too, but not redrawn.
+        for (lv_disp_t *disp = lv_disp_get_next(NULL); disp; disp = lv_disp_get_next(disp)) {
+            for (uint32_t i = 0; i < disp->screen_cnt; i++) {
+                lv_obj_refresh_style(disp->screens[i], LV_PART_ANY, LV_STYLE_PROP_ANY);
+            }
+            lv_obj_refresh_style(lv_disp_get_layer_top(disp), LV_PART_ANY, LV_STYLE_PROP_ANY);
+            lv_obj_refresh_style(lv_disp_get_layer_sys(disp), LV_PART_ANY, LV_STYLE_PROP_ANY);
+        }
+
+        // obj might have been deleted inside the block
+        LV_OBJ_T *lv_obj = ((mp_lv_obj_t*)MP_OBJ_TO_PTR(self->obj))->lv_obj;
+        if (lv_obj) lv_obj_update_layout(lv_obj);
+    }
+    MP_LV_LOCK_END();
+    return mp_const_none; // Don't suppress exceptions raised in the block
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_lv_batch_exit_obj, 4, 4, mp_lv_batch_exit);
+
+STATIC const mp_rom_map_elem_t mp_lv_batch_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR___enter__), MP_ROM_PTR(&mp_lv_batch_enter_obj) },
+    { MP_ROM_QSTR(MP_QSTR___exit__), MP_ROM_PTR(&mp_lv_batch_exit_obj) },
+};
+
+STATIC MP_DEFINE_CONST_DICT(mp_lv_batch_locals_dict, mp_lv_batch_locals_dict_table);
+
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_lv_batch_type,
+    MP_QSTR_batch,
+    MP_TYPE_FLAG_NONE,
+    make_new, mp_lv_batch_make_new,
+    locals_dict, &mp_lv_batch_locals_dict
+);
+""")
+    extension_globals.append(('batch', '&mp_lv_batch_type'))
+
+if len(obj_names) > 0:
+    print("""
+/*
+ * Widget tree builder
+ *
+ *   names = lvgl.build(spec, parent=None)
+ *
+ * Creates a tree of widgets in a single call, and returns a dict that maps names to widgets.
+ * spec is a node or a list of nodes. A node is either:
+ * - A tuple (type, props) or (type, props, children)
+ * - A dict of props which also includes 'type'
+ * type is a widget type (lvgl.btn) or its name ('btn').
+ * props is a dict, or a list of (key, value) pairs when the order of props matters.
+ * Special props are:
+ * - 'name': Add the widget to the returned dict under this name
+ * - 'styles': List of styles or (style, selector) tuples to add
+ * - 'events': List of (callback, event_code) tuples to add
+ * - 'children': List of child nodes, created after all other props are set
+ * Any other prop calls a method of the widget with the prop value as an argument, or with its items if the value
+ * is a tuple. The method is set_<prop>, or <prop> when there is no such setter or when only <prop> takes that
+ * number of arguments. For example ('align', lvgl.ALIGN.CENTER) calls set_align(), and
+ * ('align', (lvgl.ALIGN.CENTER, 0, 10)) calls align().
+ */
+
+#define MP_LV_BUILD_MAX_ARGS 8
+#define MP_LV_BUILD_MAX_NAME 64
+
+STATIC mp_obj_t mp_lv_build_node(mp_obj_t node, mp_obj_t parent, mp_obj_t names);
+
+STATIC mp_obj_t mp_lv_build_type(mp_obj_t type)
+{
+    if (!mp_obj_is_str(type)) return type;
+    size_t len;
+    const char *str = mp_obj_str_get_data(type, &len);
+    qstr type_name = qstr_find_strn(str, len);
+    if (type_name != MP_QSTRnull) {
+        for (const mp_lv_obj_type_t **iter = &mp_lv_obj_types[0]; *iter; iter++) {
+            if ((*iter)->mp_obj_type->name == type_name)
+                return MP_OBJ_FROM_PTR((*iter)->mp_obj_type);
+        }
+    }
+    nlr_raise(
+        mp_obj_new_exception_msg_varg(
+            &mp_type_ValueError, MP_ERROR_TEXT("Unknown widget type '%s'!"), str));
+}
+
+STATIC bool mp_lv_build_load(mp_obj_t obj, const char *name, size_t len, size_t n_args, mp_obj_t *call)
+{
+    // Method names are already qstrs. Look them up without interning new strings.
+    // Returns whether the method was found and takes n_args, as far as that is known.
+    qstr method = qstr_find_strn(name, len);
+    if (method == MP_QSTRnull) return false;
+    mp_load_method_maybe(obj, method, call);
+    if (call[0] == MP_OBJ_NULL) return false;
+    if (!mp_obj_is_type(call[0], &mp_lv_type_fun_builtin_var)) return true;
+    const mp_lv_obj_fun_builtin_var_t *fun = MP_OBJ_TO_PTR(call[0]);
+    return fun->n_args == n_args + (call[1] != MP_OBJ_NULL);
+}
+
+STATIC void mp_lv_build_call(mp_obj_t obj, mp_obj_t key, mp_obj_t value)
+{
+    mp_obj_t call[2 + MP_LV_BUILD_MAX_ARGS] = {MP_OBJ_NULL};
+    size_t len;
+    const char *str = mp_obj_str_get_data(key, &len);
+    char setter_name[MP_LV_BUILD_MAX_NAME];
+
+    size_t n_args = 1;
+    mp_obj_t *items = &value;
+    if (mp_obj_is_type(value, &mp_type_tuple)) {
+        mp_obj_tuple_get(value, &n_args, &items);
+        if (n_args > MP_LV_BUILD_MAX_ARGS) nlr_raise(
+            mp_obj_new_exception_msg_varg(
+                &mp_type_ValueError, MP_ERROR_TEXT("Too many arguments for property '%s'!"), str));
+    }
+
+    // set_<prop> first, unless only <prop> takes these arguments
+    bool setter_matches = false;
+    if (len + 4 < sizeof(setter_name)) {
+        memcpy(setter_name, "set_", 4);
+        memcpy(setter_name + 4, str, len);
+        setter_matches = mp_lv_build_load(obj, setter_name, len + 4, n_args, call);
+    }
+    if (!setter_matches) {
+        mp_obj_t exact[2] = {MP_OBJ_NULL};
+        if (mp_lv_build_load(obj, str, len, n_args, exact) || call[0] == MP_OBJ_NULL) {
+            call[0] = exact[0];
+            call[1] = exact[1];
+        }
+    }
+    if (call[0] == MP_OBJ_NULL) nlr_raise(
+        mp_obj_new_exception_msg_varg(
+            &mp_type_AttributeError, MP_ERROR_TEXT("Unknown property '%s' of '%s'!"), str, mp_obj_get_type_str(obj)));
+
+    memcpy(&call[2], items, n_args * sizeof(mp_obj_t));
+    mp_call_method_n_kw(n_args, 0, call);
+}
+
+STATIC void mp_lv_build_styles(mp_obj_t obj, mp_obj_t styles)
+{
+    mp_obj_t iter = mp_getiter(styles, NULL);
+    mp_obj_t item;
+    while ((item = mp_iternext(iter)) != MP_OBJ_STOP_ITERATION) {
+        mp_obj_t call[4];
+        mp_load_method(obj, MP_QSTR_add_style, call);
+        if (mp_obj_is_type(item, &mp_type_tuple)) {
+            mp_obj_t *style_selector;
+            mp_obj_get_array_fixed_n(item, 2, &style_selector);
+            call[2] = style_selector[0];
+            call[3] = style_selector[1];
+        } else {
+            call[2] = item;
+            call[3] = MP_OBJ_NEW_SMALL_INT(0);
+        }
+        mp_call_method_n_kw(2, 0, call);
+    }
+}
+
+STATIC void mp_lv_build_events(mp_obj_t obj, mp_obj_t events)
+{
+    mp_obj_t iter = mp_getiter(events, NULL);
+    mp_obj_t item;
+    while ((item = mp_iternext(iter)) != MP_OBJ_STOP_ITERATION) {
+        mp_obj_t call[5];
+        mp_obj_t *callback_code;
+        mp_obj_get_array_fixed_n(item, 2, &callback_code);
+        mp_load_method(obj, MP_QSTR_add_event, call);
+        call[2] = callback_code[0];
+        call[3] = callback_code[1];
+        call[4] = mp_const_none;
+        mp_call_method_n_kw(3, 0, call);
+    }
+}
+
+// Returns the children, if key is 'children'. They are created only after all props are set.
+
+STATIC mp_obj_t mp_lv_build_prop(mp_obj_t obj, mp_obj_t key, mp_obj_t value, mp_obj_t names)
+{
+    if (mp_obj_equal(key, MP_OBJ_NEW_QSTR(MP_QSTR_children))) return value;
+    if (mp_obj_equal(key, MP_OBJ_NEW_QSTR(MP_QSTR_type))) return MP_OBJ_NULL;
+    if (mp_obj_equal(key, MP_OBJ_NEW_QSTR(MP_QSTR_name))) mp_obj_dict_store(names, value, obj);
+    else if (mp_obj_equal(key, MP_OBJ_NEW_QSTR(MP_QSTR_styles))) mp_lv_build_styles(obj, value);
+    else if (mp_obj_equal(key, MP_OBJ_NEW_QSTR(MP_QSTR_events))) mp_lv_build_events(obj, value);
+    else mp_lv_build_call(obj, key, value);
+    return MP_OBJ_NULL;
+}
+
+STATIC void mp_lv_build_children(mp_obj_t children, mp_obj_t parent, mp_obj_t names)
+{
+    mp_obj_t iter = mp_getiter(children, NULL);
+    mp_obj_t child;
+    while ((child = mp_iternext(iter)) != MP_OBJ_STOP_ITERATION) {
+        mp_lv_build_node(child, parent, names);
+    }
+}
+
+STATIC mp_obj_t mp_lv_build_node(mp_obj_t node, mp_obj_t parent, mp_obj_t names)
+{
+    MP_STACK_CHECK();
+    mp_obj_t type, props = mp_const_none, children = mp_const_none;
+    if (mp_obj_is_type(node, &mp_type_dict)) {
+        type = mp_obj_dict_get(node, MP_OBJ_NEW_QSTR(MP_QSTR_type));
+        props = node;
+    } else {
+        size_t len;
+        mp_obj_t *items;
+        mp_obj_get_array(node, &len, &items);
+        if (len < 1 || len > 3) nlr_raise(
+            mp_obj_new_exception_msg(
+                &mp_type_ValueError, MP_ERROR_TEXT("Node must be (type, props) or (type, props, children)!")));
+        type = items[0];
+        if (len > 1) props = items[1];
+        if (len > 2) children = items[2];
+    }
+
+    mp_obj_t obj = mp_call_function_1(mp_lv_build_type(type), parent);
+
+    if (mp_obj_is_type(props, &mp_type_dict)) {
+        mp_map_t *map = mp_obj_dict_get_map(props);
+        for (size_t i = 0; i < map->alloc; i++) {
+            if (mp_map_slot_is_filled(map, i)) {
+                mp_obj_t prop_children = mp_lv_build_prop(obj, map->table[i].key, map->table[i].value, names);
+                if (prop_children != MP_OBJ_NULL) children = prop_children;
+            }
+        }
+    } else if (props != mp_const_none) {
+        mp_obj_t iter = mp_getiter(props, NULL);
+        mp_obj_t item;
+        while ((item = mp_iternext(iter)) != MP_OBJ_STOP_ITERATION) {
+            mp_obj_t *key_value;
+            mp_obj_get_array_fixed_n(item, 2, &key_value);
+            mp_obj_t prop_children = mp_lv_build_prop(obj, key_value[0], key_value[1], names);
+            if (prop_children != MP_OBJ_NULL) children = prop_children;
+        }
+    }
+
+    if (children != mp_const_none) mp_lv_build_children(children, obj, names);
+    return obj;
+}
+
+STATIC mp_obj_t mp_lv_build(size_t n_args, const mp_obj_t *args)
+{
+    mp_obj_t spec = args[0];
+    mp_obj_t parent = n_args > 1? args[1]: mp_const_none;
+    mp_obj_t names = mp_obj_new_dict(0);
+    if (mp_obj_is_type(spec, &mp_type_list)) mp_lv_build_children(spec, parent, names);
+    else mp_lv_build_node(spec, parent, names);
+    return names;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_lv_build_obj, 1, 2, mp_lv_build);
+""")
+    extension_globals.append(('build', '&mp_lv_build_obj'))
+
+if len(obj_names) > 0:
+    print("""
+/*
+ * Deferred callbacks
+ *
+ *   obj.add_event(lvgl.deferred(handler), lvgl.EVENT.CLICKED, None)
+ *
+ * lvgl.deferred(cb) wraps a callback so that when LVGL calls it, its arguments are captured and the call is queued
+ * instead of running inside the LVGL call (and possibly in the middle of rendering).
+ * Struct arguments (such as lv.event_t) are copied, since LVGL might free them when the callback returns.
+ * Pointers inside them (such as the event param) are not copied and must not be used by a deferred callback.
+ * Queued calls run from lvgl.run_deferred(), which event loops call after lv_timer_handler returns.
+ * The return value of a deferred callback is ignored. When the queue is full the callback runs immediately.
+ * On the render thread, callbacks don't marshal a deferred call to a MicroPython thread, they queue it themselves
+ * (see gen_callback_marshaling), so the render thread doesn't wait for one.
+ */
+
+#define MP_LV_DEFERRED 1
+#define MP_LV_DEFERRED_QUEUE_SIZE 32
+#define MP_LV_DEFERRED_MAX_ARGS 4
+
+typedef struct mp_lv_deferred_call_t {
+    mp_obj_t fun;
+    size_t n_args;
+    mp_obj_t args[MP_LV_DEFERRED_MAX_ARGS];
+} mp_lv_deferred_call_t;
+
+// Single producer (LVGL callbacks), single consumer (run_deferred) ring buffer.
+// With the render thread, calls are queued holding the LVGL lock, on the render thread or on a MicroPython thread,
+// and run_deferred runs them on a MicroPython thread without waiting for the lock.
+typedef struct mp_lv_deferred_queue_t {
+    volatile uint16_t head;
+    volatile uint16_t tail;
+    mp_lv_deferred_call_t calls[MP_LV_DEFERRED_QUEUE_SIZE];
+} mp_lv_deferred_queue_t;
+
+#if MP_LV_RENDER_THREAD
+#define MP_LV_DEFERRED_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define MP_LV_DEFERRED_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#else
+#define MP_LV_DEFERRED_LOAD(x) (x)
+#define MP_LV_DEFERRED_STORE(x, v) ((x) = (v))
+#endif
+
+MP_REGISTER_ROOT_POINTER(struct mp_lv_deferred_queue_t *mp_lv_deferred_queue);
+
+typedef struct mp_lv_deferred_t {
+    mp_obj_base_t base;
+    mp_obj_t fun;
+} mp_lv_deferred_t;
+
+STATIC mp_obj_t mp_lv_deferred_capture(mp_obj_t arg)
+{
+    // Copy structs, their data might not outlive the callback
+    if (MP_OBJ_IS_OBJ(arg)) {
+        const mp_obj_type_t *type = mp_obj_get_type(arg);
+        if (MP_OBJ_TYPE_GET_SLOT_OR_NULL(type, make_new) == &make_new_lv_struct && get_lv_struct_size(type) > 0)
+            return make_new_lv_struct(type, 1, 0, &arg);
+    }
+    return arg;
+}
+
+STATIC mp_obj_t mp_lv_deferred_call(mp_obj_t self_in, size_t n_args, size_t n_kw, const mp_obj_t *args)
+{
+    mp_lv_deferred_t *self = MP_OBJ_TO_PTR(self_in);
+    bool queued = false;
+    MP_LV_LOCK_BEGIN();
+    mp_lv_deferred_queue_t *queue = MP_STATE_VM(mp_lv_deferred_queue);
+    if (!queue) queue = MP_STATE_VM(mp_lv_deferred_queue) = m_new0(mp_lv_deferred_queue_t, 1);
+    uint16_t head = queue->head;
+    if (n_kw == 0 && n_args <= MP_LV_DEFERRED_MAX_ARGS &&
+            (uint16_t)(head - MP_LV_DEFERRED_LOAD(queue->tail)) < MP_LV_DEFERRED_QUEUE_SIZE) {
+        mp_lv_deferred_call_t *call = &queue->calls[head % MP_LV_DEFERRED_QUEUE_SIZE];
+        call->fun = self->fun;
+        call->n_args = n_args;
+        for (size_t i = 0; i < n_args; i++) call->args[i] = mp_lv_deferred_capture(args[i]);
+        MP_LV_DEFERRED_STORE(queue->head, (uint16_t)(head + 1));
+        queued = true;
+    }
+    MP_LV_LOCK_END();
+    return queued? mp_const_none: mp_call_function_n_kw(self->fun, n_args, n_kw, args);
+}
+
+STATIC mp_obj_t mp_lv_deferred_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args)
+{
+    mp_arg_check_num(n_args, n_kw, 1, 1, false);
+    if (!mp_obj_is_callable(args[0])) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_TypeError, MP_ERROR_TEXT("deferred requires a callable!")));
+    mp_lv_deferred_t *self = m_new_obj(mp_lv_deferred_t);
+    self->base.type = type;
+    self->fun = args[0];
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_lv_deferred_type,
+    MP_QSTR_deferred,
+    MP_TYPE_FLAG_NONE,
+    make_new, mp_lv_deferred_make_new,
+    call, mp_lv_deferred_call
+);
+
+#if MP_LV_RENDER_THREAD
+
+// Called on the render thread, holding the LVGL lock, by a callback before it marshals its call (see
+// gen_callback_marshaling). When the Python callback is an lvgl.deferred that can queue the call, calling it
+// runs no Python code, so the render thread calls it itself instead of waiting for a MicroPython thread.
+GENMPY_UNUSED STATIC bool mp_lv_deferred_can_queue(mp_obj_t callbacks, qstr name, size_t n_args)
+{
+    if (!callbacks || !mp_obj_is_type(callbacks, &mp_type_dict) || n_args > MP_LV_DEFERRED_MAX_ARGS) return false;
+    mp_map_elem_t *elem = mp_map_lookup(mp_obj_dict_get_map(callbacks), MP_OBJ_NEW_QSTR(name), MP_MAP_LOOKUP);
+    if (!elem || !mp_obj_is_type(elem->value, &mp_lv_deferred_type)) return false;
+    mp_lv_deferred_queue_t *queue = MP_STATE_VM(mp_lv_deferred_queue);
+    return !queue || (uint16_t)(queue->head - MP_LV_DEFERRED_LOAD(queue->tail)) < MP_LV_DEFERRED_QUEUE_SIZE;
+}
+
+#endif // MP_LV_RENDER_THREAD
+
+// Run the calls that were queued before it was called. Returns how many ran.
+STATIC mp_obj_t mp_lv_run_deferred(void)
+{
+    mp_lv_deferred_queue_t *queue = MP_STATE_VM(mp_lv_deferred_queue);
+    if (!queue) return MP_OBJ_NEW_SMALL_INT(0);
+    uint16_t head = MP_LV_DEFERRED_LOAD(queue->head);
+    uint16_t tail = queue->tail;
+    mp_int_t count = 0;
+    while (tail != head) {
+        mp_lv_deferred_call_t *queued = &queue->calls[tail % MP_LV_DEFERRED_QUEUE_SIZE];
+        mp_lv_deferred_call_t call = *queued;
+        *queued = (mp_lv_deferred_call_t){0}; // Don't keep the arguments alive
+        MP_LV_DEFERRED_STORE(queue->tail, ++tail);
+        count++;
+        mp_call_function_n_kw(call.fun, call.n_args, 0, call.args);
+    }
+    return MP_OBJ_NEW_SMALL_INT(count);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(mp_lv_run_deferred_obj, mp_lv_run_deferred);
+""")
+    extension_globals.append(('deferred', '&mp_lv_deferred_type'))
+    extension_globals.append(('run_deferred', '&mp_lv_run_deferred_obj'))
+
+if has_funcs('lv_timer_handler', 'lv_disp_get_default', 'lv_disp_get_next', 'lv_disp_add_event', 'lv_disp_get_event_count',
+        'lv_disp_get_event_dsc', 'lv_disp_remove_event', 'lv_event_dsc_get_cb', 'lv_event_get_code') and \
+        struct_has_fields('lv_disp_t', 'flush_cb', 'wait_cb', 'inv_areas', 'inv_area_joined', 'inv_p'):
+    print("""
+/*
+ * Frame telemetry
+ *
+ *   lvgl.telemetry.enable(disp=None, frames=128)
+ *   lvgl.telemetry.read(0, buf)                                 # Latest frame, buf is array('I', [0] * lvgl.telemetry.FIELDS)
+ *   lvgl.telemetry.percentiles(lvgl.telemetry.FLUSH, out)       # out is array('I', [0] * 3): p50, p95, p99
+ *
+ * Records the following for each refresh of a display, in a ring buffer of the last `frames` frames:
+ *   HANDLER    - Time of the lv_timer_handler call that refreshed the display, when called through
+ *                lvgl.telemetry.timer_handler() or the native event loop
+ *   FRAME      - Time from LV_EVENT_REFR_START to LV_EVENT_REFR_FINISH
+ *   RENDER     - FRAME minus FLUSH and FLUSH_WAIT
+ *   FLUSH      - Time in the display flush_cb
+ *   FLUSH_WAIT - Time LVGL waited for lv_disp_flush_ready (measured through wait_cb)
+ *   AREAS      - Number of areas that were redrawn
+ *   PIXELS     - Number of pixels that were redrawn
+ *   CALLBACK   - Time in Python callbacks since the previous frame
+ * Times are in microseconds. Only one display is monitored at a time, and flush_cb must be set before enable().
+ * The reader functions don't allocate, so they can be called from the render loop itself.
+ */
+
+#define MP_LV_TELEMETRY 1
+
+enum {
+    MP_LV_TELEMETRY_HANDLER,
+    MP_LV_TELEMETRY_FRAME,
+    MP_LV_TELEMETRY_RENDER,
+    MP_LV_TELEMETRY_FLUSH,
+    MP_LV_TELEMETRY_FLUSH_WAIT,
+    MP_LV_TELEMETRY_AREAS,
+    MP_LV_TELEMETRY_PIXELS,
+    MP_LV_TELEMETRY_CALLBACK,
+    MP_LV_TELEMETRY_FIELDS
+};
+
+typedef void (*mp_lv_telemetry_flush_cb_t)(lv_disp_t *, const lv_area_t *, void *);
+
+typedef struct mp_lv_telemetry_t {
+    lv_disp_t *disp;            // NULL when disabled
+    mp_lv_telemetry_flush_cb_t flush_cb;
+    void (*wait_cb)(lv_disp_t *);
+    uint32_t *frames;           // size * MP_LV_TELEMETRY_FIELDS
+    uint32_t *scratch;          // size, for computing percentiles
+    uint32_t size;
+    uint32_t count;             // Number of frames recorded since enable() or reset()
+    uint32_t current[MP_LV_TELEMETRY_FIELDS];
+    mp_uint_t frame_start;
+    mp_uint_t wait_start;
+    mp_uint_t wait_last;
+    mp_uint_t callback_mark;
+    bool in_frame;
+    bool waiting;
+} mp_lv_telemetry_t;
+
+MP_REGISTER_ROOT_POINTER(struct mp_lv_telemetry_t *mp_lv_telemetry);
+
+STATIC mp_lv_telemetry_t *mp_lv_telemetry_get(void)
+{
+    mp_lv_telemetry_t *tm = MP_STATE_VM(mp_lv_telemetry);
+    if (!tm) nlr_raise(mp_obj_new_exception_msg(&mp_type_RuntimeError, MP_ERROR_TEXT("Telemetry is not enabled")));
+    return tm;
+}
+
+STATIC void mp_lv_telemetry_end_wait(mp_lv_telemetry_t *tm)
+{
+    // A wait episode lasts from the first to the last wait_cb call before the next flush
+    if (tm->waiting) {
+        tm->current[MP_LV_TELEMETRY_FLUSH_WAIT] += tm->wait_last - tm->wait_start;
+        tm->waiting = false;
+    }
+}
+
+STATIC void mp_lv_telemetry_flush_cb(lv_disp_t *disp, const lv_area_t *area, void *px_map)
+{
+    mp_lv_telemetry_t *tm = MP_STATE_VM(mp_lv_telemetry);
+    mp_lv_telemetry_end_wait(tm);
+    mp_uint_t start = mp_hal_ticks_us();
+    tm->flush_cb(disp, area, px_map);
+    tm->current[MP_LV_TELEMETRY_FLUSH] += mp_hal_ticks_us() - start;
+}
+
+STATIC void mp_lv_telemetry_wait_cb(lv_disp_t *disp)
+{
+    mp_lv_telemetry_t *tm = MP_STATE_VM(mp_lv_telemetry);
+    mp_uint_t now = mp_hal_ticks_us();
+    if (!tm->waiting) {
+        tm->waiting = true;
+        tm->wait_start = now;
+    }
+    tm->wait_last = now;
+    if (tm->wait_cb) tm->wait_cb(disp);
+}
+
+STATIC void mp_lv_telemetry_event_cb(lv_event_t *e)
+{
+    mp_lv_telemetry_t *tm = MP_STATE_VM(mp_lv_telemetry);
+    if (!tm || !tm->disp) return;
+    uint32_t *current = tm->current;
+    switch (lv_event_get_code(e)) {
+        case LV_EVENT_REFR_START:
+            memset(current, 0, sizeof(tm->current));
+            tm->in_frame = true;
+            tm->waiting = false;
+            tm->frame_start = mp_hal_ticks_us();
+            break;
+        case LV_EVENT_RENDER_START:
+            // Areas are joined by now, so count only the ones that will be redrawn
+            for (uint32_t i = 0; i < tm->disp->inv_p; i++) {
+                if (tm->disp->inv_area_joined[i]) continue;
+                const lv_area_t *area = &tm->disp->inv_areas[i];
+                current[MP_LV_TELEMETRY_AREAS]++;
+                current[MP_LV_TELEMETRY_PIXELS] += (uint32_t)(area->x2 - area->x1 + 1) * (area->y2 - area->y1 + 1);
+            }
+            break;
+        case LV_EVENT_REFR_FINISH: {
+            if (!tm->in_frame) break;
+            tm->in_frame = false;
+            mp_lv_telemetry_end_wait(tm);
+            current[MP_LV_TELEMETRY_FRAME] = mp_hal_ticks_us() - tm->frame_start;
+            uint32_t io = current[MP_LV_TELEMETRY_FLUSH] + current[MP_LV_TELEMETRY_FLUSH_WAIT];
+            current[MP_LV_TELEMETRY_RENDER] = current[MP_LV_TELEMETRY_FRAME] > io? current[MP_LV_TELEMETRY_FRAME] - io: 0;
+            current[MP_LV_TELEMETRY_CALLBACK] = mp_lv_callback_us - tm->callback_mark;
+            tm->callback_mark = mp_lv_callback_us;
+            memcpy(&tm->frames[(tm->count % tm->size) * MP_LV_TELEMETRY_FIELDS], current, sizeof(tm->current));
+            tm->count++;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+STATIC uint32_t mp_lv_telemetry_timer_handler_run(void)
+{
+    mp_lv_telemetry_t *tm = MP_STATE_VM(mp_lv_telemetry);
+    if (!tm || !tm->disp) return lv_timer_handler();
+    uint32_t count = tm->count;
+    mp_uint_t start = mp_hal_ticks_us();
+    uint32_t delay = lv_timer_handler();
+    if (tm->count != count) {
+        tm->frames[((tm->count - 1) % tm->size) * MP_LV_TELEMETRY_FIELDS + MP_LV_TELEMETRY_HANDLER] = mp_hal_ticks_us() - start;
+    }
+    return delay;
+}
+
+STATIC mp_obj_t mp_lv_telemetry_timer_handler(void)
+{
+    MP_LV_LOCK_BEGIN();
+    uint32_t delay = mp_lv_telemetry_timer_handler_run();
+    MP_LV_LOCK_END();
+    return mp_obj_new_int_from_uint(delay);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(mp_lv_telemetry_timer_handler_obj, mp_lv_telemetry_timer_handler);
+
+STATIC bool mp_lv_telemetry_disp_exists(lv_disp_t *disp)
+{
+    for (lv_disp_t *d = lv_disp_get_next(NULL); d; d = lv_disp_get_next(d)) {
+        if (d == disp) return true;
+    }
+    return false;
+}
+
+STATIC mp_obj_t mp_lv_telemetry_disable(void)
+{
+    // Keeps the recorded frames readable until the next enable()
+    mp_lv_telemetry_t *tm = MP_STATE_VM(mp_lv_telemetry);
+    MP_LV_LOCK_BEGIN();
+    lv_disp_t *disp = tm? tm->disp: NULL;
+    if (disp && mp_lv_telemetry_disp_exists(disp)) {
+        // A wrapper installed after enable() still calls the telemetry wrappers. Removing them under it would make
+        // a later enable() wrap that wrapper, which then calls itself.
+        if ((void*)disp->flush_cb != (void*)mp_lv_telemetry_flush_cb || disp->wait_cb != mp_lv_telemetry_wait_cb) nlr_raise(
+            mp_obj_new_exception_msg(
+                &mp_type_RuntimeError, MP_ERROR_TEXT("flush_cb or wait_cb was wrapped after enable(), remove the wrapper first")));
+        disp->flush_cb = (__typeof__(disp->flush_cb))tm->flush_cb;
+        disp->wait_cb = tm->wait_cb;
+        for (uint32_t i = lv_disp_get_event_count(disp); i-- > 0;) {
+            if (lv_event_dsc_get_cb(lv_disp_get_event_dsc(disp, i)) == mp_lv_telemetry_event_cb) lv_disp_remove_event(disp, i);
+        }
+    }
+    if (disp) {
+        tm->disp = NULL;
+        mp_lv_callback_timing = false;
+    }
+    MP_LV_LOCK_END();
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(mp_lv_telemetry_disable_obj, mp_lv_telemetry_disable);
+
+STATIC mp_obj_t mp_lv_telemetry_enable(size_t n_args, const mp_obj_t *args)
+{
+    mp_int_t size = n_args > 1? mp_obj_get_int(args[1]): 128;
+    MP_LV_LOCK_BEGIN();
+    lv_disp_t *disp = n_args > 0 && args[0] != mp_const_none? mp_to_ptr(args[0]): lv_disp_get_default();
+    if (!disp) nlr_raise(mp_obj_new_exception_msg(&mp_type_RuntimeError, MP_ERROR_TEXT("No display")));
+    if (!disp->flush_cb) nlr_raise(mp_obj_new_exception_msg(&mp_type_RuntimeError, MP_ERROR_TEXT("Display has no flush_cb")));
+    if (size <= 0) nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("frames must be positive")));
+    mp_lv_telemetry_disable();
+
+    mp_lv_telemetry_t *tm = m_new0(mp_lv_telemetry_t, 1);
+    tm->frames = m_new0(uint32_t, size * MP_LV_TELEMETRY_FIELDS);
+    tm->scratch = m_new(uint32_t, size);
+    tm->size = size;
+    tm->disp = disp;
+    tm->flush_cb = (mp_lv_telemetry_flush_cb_t)disp->flush_cb;
+    tm->wait_cb = disp->wait_cb;
+    tm->callback_mark = mp_lv_callback_us;
+    MP_STATE_VM(mp_lv_telemetry) = tm;
+
+    disp->flush_cb = (__typeof__(disp->flush_cb))mp_lv_telemetry_flush_cb;
+    disp->wait_cb = mp_lv_telemetry_wait_cb;
+    lv_disp_add_event(disp, mp_lv_telemetry_event_cb, LV_EVENT_REFR_START, NULL);
+    lv_disp_add_event(disp, mp_lv_telemetry_event_cb, LV_EVENT_RENDER_START, NULL);
+    lv_disp_add_event(disp, mp_lv_telemetry_event_cb, LV_EVENT_REFR_FINISH, NULL);
+    mp_lv_callback_timing = true;
+    MP_LV_LOCK_END();
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_lv_telemetry_enable_obj, 0, 2, mp_lv_telemetry_enable);
+
+STATIC mp_obj_t mp_lv_telemetry_reset(void)
+{
+    mp_lv_telemetry_t *tm = mp_lv_telemetry_get();
+    MP_LV_LOCK_BEGIN();
+    tm->count = 0;
+    tm->callback_mark = mp_lv_callback_us;
+    MP_LV_LOCK_END();
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(mp_lv_telemetry_reset_obj, mp_lv_telemetry_reset);
+
+STATIC inline uint32_t mp_lv_telemetry_available(mp_lv_telemetry_t *tm)
+{
+    return tm->count < tm->size? tm->count: tm->size;
+}
+
+STATIC mp_obj_t mp_lv_telemetry_count(void)
+{
+    mp_lv_telemetry_t *tm = MP_STATE_VM(mp_lv_telemetry);
+    return MP_OBJ_NEW_SMALL_INT(tm? mp_lv_telemetry_available(tm): 0);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(mp_lv_telemetry_count_obj, mp_lv_telemetry_count);
+
+STATIC uint32_t *mp_lv_telemetry_get_out(mp_obj_t out, size_t n)
+{
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(out, &bufinfo, MP_BUFFER_WRITE);
+    if (bufinfo.len < n * sizeof(uint32_t)) {
+        nlr_raise(mp_obj_new_exception_msg_varg(&mp_type_ValueError, MP_ERROR_TEXT("Buffer too small, need %d uint32"), (int)n));
+    }
+    return bufinfo.buf;
+}
+
+STATIC mp_obj_t mp_lv_telemetry_read(mp_obj_t index_in, mp_obj_t out)
+{
+    // Index 0 is the latest frame. Returns False when there is no such frame.
+    mp_lv_telemetry_t *tm = mp_lv_telemetry_get();
+    uint32_t *buf = mp_lv_telemetry_get_out(out, MP_LV_TELEMETRY_FIELDS);
+    mp_int_t index = mp_obj_get_int(index_in);
+    MP_LV_LOCK_BEGIN();
+    bool found = index >= 0 && (uint32_t)index < mp_lv_telemetry_available(tm);
+    if (found) memcpy(buf, &tm->frames[((tm->count - 1 - index) % tm->size) * MP_LV_TELEMETRY_FIELDS], MP_LV_TELEMETRY_FIELDS * sizeof(uint32_t));
+    MP_LV_LOCK_END();
+    return mp_obj_new_bool(found);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(mp_lv_telemetry_read_obj, mp_lv_telemetry_read);
+
+STATIC int mp_lv_telemetry_compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+STATIC uint32_t mp_lv_telemetry_sort(mp_lv_telemetry_t *tm, mp_obj_t field_in)
+{
+    mp_int_t field = mp_obj_get_int(field_in);
+    if (field < 0 || field >= MP_LV_TELEMETRY_FIELDS) nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Invalid field")));
+    MP_LV_LOCK_BEGIN();
+    uint32_t n = mp_lv_telemetry_available(tm);
+    for (uint32_t i = 0; i < n; i++) tm->scratch[i] = tm->frames[i * MP_LV_TELEMETRY_FIELDS + field];
+    MP_LV_LOCK_END();
+    qsort(tm->scratch, n, sizeof(uint32_t), mp_lv_telemetry_compare);
+    return n;
+}
+
+STATIC uint32_t mp_lv_telemetry_rank(const uint32_t *sorted, uint32_t n, uint32_t p)
+{
+    // Nearest rank
+    if (n == 0) return 0;
+    uint32_t rank = (p * n + 99) / 100;
+    return sorted[rank > 0? rank - 1: 0];
+}
+
+STATIC mp_obj_t mp_lv_telemetry_percentile(mp_obj_t field_in, mp_obj_t p_in)
+{
+    mp_lv_telemetry_t *tm = mp_lv_telemetry_get();
+    mp_int_t p = mp_obj_get_int(p_in);
+    if (p < 0 || p > 100) nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Percentile must be 0..100")));
+    uint32_t n = mp_lv_telemetry_sort(tm, field_in);
+    return mp_obj_new_int_from_uint(mp_lv_telemetry_rank(tm->scratch, n, p));
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(mp_lv_telemetry_percentile_obj, mp_lv_telemetry_percentile);
+
+STATIC mp_obj_t mp_lv_telemetry_percentiles(mp_obj_t field_in, mp_obj_t out)
+{
+    // Writes p50, p95 and p99 to out, and returns the number of frames they were computed from
+    mp_lv_telemetry_t *tm = mp_lv_telemetry_get();
+    uint32_t *buf = mp_lv_telemetry_get_out(out, 3);
+    uint32_t n = mp_lv_telemetry_sort(tm, field_in);
+    buf[0] = mp_lv_telemetry_rank(tm->scratch, n, 50);
+    buf[1] = mp_lv_telemetry_rank(tm->scratch, n, 95);
+    buf[2] = mp_lv_telemetry_rank(tm->scratch, n, 99);
+    return MP_OBJ_NEW_SMALL_INT(n);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(mp_lv_telemetry_percentiles_obj, mp_lv_telemetry_percentiles);
+
+STATIC const mp_rom_map_elem_t mp_lv_telemetry_globals_table[] = {
+    { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_telemetry) },
+    { MP_ROM_QSTR(MP_QSTR_enable), MP_ROM_PTR(&mp_lv_telemetry_enable_obj) },
+    { MP_ROM_QSTR(MP_QSTR_disable), MP_ROM_PTR(&mp_lv_telemetry_disable_obj) },
+    { MP_ROM_QSTR(MP_QSTR_reset), MP_ROM_PTR(&mp_lv_telemetry_reset_obj) },
+    { MP_ROM_QSTR(MP_QSTR_count), MP_ROM_PTR(&mp_lv_telemetry_count_obj) },
+    { MP_ROM_QSTR(MP_QSTR_read), MP_ROM_PTR(&mp_lv_telemetry_read_obj) },
+    { MP_ROM_QSTR(MP_QSTR_percentile), MP_ROM_PTR(&mp_lv_telemetry_percentile_obj) },
+    { MP_ROM_QSTR(MP_QSTR_percentiles), MP_ROM_PTR(&mp_lv_telemetry_percentiles_obj) },
+    { MP_ROM_QSTR(MP_QSTR_timer_handler), MP_ROM_PTR(&mp_lv_telemetry_timer_handler_obj) },
+    { MP_ROM_QSTR(MP_QSTR_HANDLER), MP_ROM_INT(MP_LV_TELEMETRY_HANDLER) },
+    { MP_ROM_QSTR(MP_QSTR_FRAME), MP_ROM_INT(MP_LV_TELEMETRY_FRAME) },
+    { MP_ROM_QSTR(MP_QSTR_RENDER), MP_ROM_INT(MP_LV_TELEMETRY_RENDER) },
+    { MP_ROM_QSTR(MP_QSTR_FLUSH), MP_ROM_INT(MP_LV_TELEMETRY_FLUSH) },
+    { MP_ROM_QSTR(MP_QSTR_FLUSH_WAIT), MP_ROM_INT(MP_LV_TELEMETRY_FLUSH_WAIT) },
+    { MP_ROM_QSTR(MP_QSTR_AREAS), MP_ROM_INT(MP_LV_TELEMETRY_AREAS) },
+    { MP_ROM_QSTR(MP_QSTR_PIXELS), MP_ROM_INT(MP_LV_TELEMETRY_PIXELS) },
+    { MP_ROM_QSTR(MP_QSTR_CALLBACK), MP_ROM_INT(MP_LV_TELEMETRY_CALLBACK) },
+    { MP_ROM_QSTR(MP_QSTR_FIELDS), MP_ROM_INT(MP_LV_TELEMETRY_FIELDS) },
+};
+
+STATIC MP_DEFINE_CONST_DICT(mp_lv_telemetry_globals, mp_lv_telemetry_globals_table);
+
+STATIC const mp_obj_module_t mp_lv_telemetry_module = {
+    .base = { &mp_type_module },
+    .globals = (mp_obj_dict_t *)&mp_lv_telemetry_globals,
+};
+""")
+    extension_globals.append(('telemetry', '&mp_lv_telemetry_module'))
+
+if has_funcs('lv_timer_handler', 'lv_disp_get_next', 'lv_disp_add_event',
+        'lv_disp_get_event_count', 'lv_disp_get_event_dsc', 'lv_event_dsc_get_cb'):
+    print("""
+/*
+ * Deadline driven event loop
+ *
+ *   loop = lvgl.event_loop(timer, max_delay=500, refresh_cb=None, exception_sink=None)
+ *
+ * Runs lv_timer_handler from a machine.Timer compatible timer, and re-arms the timer with the time until
+ * the next LVGL timer is due (up to max_delay ms), instead of polling at a fixed frequency.
+ * Unless LVGL reads the tick from the port clock (LV_TICK_CUSTOM), the tick is advanced by the time that
+ * actually elapsed according to mp_hal_ticks_ms.
+ * The loop wakes up early when a display is invalidated outside of lv_timer_handler, or when wake() is called
+ * (for example by an input driver). wake() and the timer callback don't allocate and can be called from an ISR.
+ * Only one loop can run at a time. lv_utils.event_loop uses it when available.
+ */
+
+#if MICROPY_ENABLE_SCHEDULER
+
+#define MP_LV_EVENT_LOOP_RETRY_MS 10    // Retry interval when the handler is called while LVGL is busy
+#define MP_LV_EVENT_LOOP_SLACK_MS 1     // Don't re-arm the timer for smaller deadline changes
+
+typedef struct mp_lv_event_loop_t {
+    mp_obj_base_t base;
+    mp_obj_t timer;
+    mp_obj_t timer_init;
+    mp_obj_t timer_init_args[6];
+    mp_obj_t refresh_cb;
+    mp_obj_t exception_sink;
+    uint32_t max_delay;
+    uint32_t period;
+    uint32_t next_fire;
+    uint32_t last_tick;
+    int disabled;
+    volatile bool scheduled;
+    volatile bool fired;
+    bool running;
+    bool in_handler;
+} mp_lv_event_loop_t;
+
+MP_REGISTER_ROOT_POINTER(struct mp_lv_event_loop_t *mp_lv_event_loop);
+
+STATIC mp_obj_t mp_lv_event_loop_task_handler(mp_obj_t self_in);
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_event_loop_task_handler_obj, mp_lv_event_loop_task_handler);
+
+STATIC void mp_lv_event_loop_schedule(mp_lv_event_loop_t *self)
+{
+    if (self->running && !self->scheduled && self->disabled == 0) {
+        self->scheduled = mp_sched_schedule(MP_OBJ_FROM_PTR(&mp_lv_event_loop_task_handler_obj), MP_OBJ_FROM_PTR(self));
+    }
+}
+
+STATIC mp_obj_t mp_lv_event_loop_timer_cb(mp_obj_t self_in, mp_obj_t timer)
+{
+    // Can be called in interrupt context
+    mp_lv_event_loop_t *self = MP_OBJ_TO_PTR(self_in);
+    self->fired = true;
+    self->next_fire = mp_hal_ticks_ms() + self->period;
+    mp_lv_event_loop_schedule(self);
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(mp_lv_event_loop_timer_cb_obj, mp_lv_event_loop_timer_cb);
+
+STATIC void mp_lv_event_loop_invalidate_cb(lv_event_t *e)
+{
+    mp_lv_event_loop_t *self = MP_STATE_VM(mp_lv_event_loop);
+    if (self && !self->in_handler) mp_lv_event_loop_schedule(self);
+}
+
+STATIC void mp_lv_hook_invalidation(lv_event_cb_t invalidate_cb)
+{
+    // Add invalidate_cb to displays that were created since the last call
+    for (lv_disp_t *disp = lv_disp_get_next(NULL); disp; disp = lv_disp_get_next(disp)) {
+        uint32_t count = lv_disp_get_event_count(disp);
+        uint32_t i;
+        for (i = 0; i < count; i++) {
+            if (lv_event_dsc_get_cb(lv_disp_get_event_dsc(disp, i)) == invalidate_cb) break;
+        }
+        if (i == count) lv_disp_add_event(disp, invalidate_cb, LV_EVENT_INVALIDATE_AREA, NULL);
+    }
+}
+
+STATIC void mp_lv_event_loop_arm(mp_lv_event_loop_t *self, uint32_t delay)
+{
+    // The timer is periodic, so a lost mp_sched_schedule is retried on the next period
+    self->period = delay;
+    self->next_fire = mp_hal_ticks_ms() + delay;
+    self->timer_init_args[3] = MP_OBJ_NEW_SMALL_INT(delay);
+    mp_call_function_n_kw(self->timer_init, 0, 3, self->timer_init_args);
+}
+
+STATIC mp_obj_t mp_lv_event_loop_deinit(mp_obj_t self_in)
+{
+    mp_lv_event_loop_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->running) return mp_const_none;
+    self->running = false;
+    if (MP_STATE_VM(mp_lv_event_loop) == self) MP_STATE_VM(mp_lv_event_loop) = NULL;
+    mp_obj_t dest[2];
+    mp_load_method(self->timer, MP_QSTR_deinit, dest);
+    mp_call_method_n_kw(0, 0, dest);
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_event_loop_deinit_obj, mp_lv_event_loop_deinit);
+
+STATIC mp_obj_t mp_lv_event_loop_task_handler(mp_obj_t self_in)
+{
+    mp_lv_event_loop_t *self = MP_OBJ_TO_PTR(self_in);
+    bool fired = self->fired;
+    self->fired = false;
+    self->scheduled = false;
+    if (!self->running || self->disabled > 0) return mp_const_none;
+
+    uint32_t delay = MP_LV_EVENT_LOOP_RETRY_MS;
+    mp_obj_t exception = MP_OBJ_NULL;
+    if (_nesting == 0) {
+        nlr_buf_t nlr;
+        self->in_handler = true;
+        if (nlr_push(&nlr) == 0) {
+#if !LV_TICK_CUSTOM
+            uint32_t now = mp_hal_ticks_ms();
+            lv_tick_inc(now - self->last_tick);
+            self->last_tick = now;
+#endif
+            mp_lv_hook_invalidation(mp_lv_event_loop_invalidate_cb);
+#ifdef MP_LV_TELEMETRY
+            delay = mp_lv_telemetry_timer_handler_run();
+#else
+            delay = lv_timer_handler();
+#endif
+#ifdef MP_LV_DEFERRED
+            mp_lv_run_deferred();
+#endif
+            if (self->refresh_cb != mp_const_none) mp_call_function_0(self->refresh_cb);
+            nlr_pop();
+        } else {
+            exception = MP_OBJ_FROM_PTR(nlr.ret_val);
+        }
+        self->in_handler = false;
+    }
+
+    if (exception != MP_OBJ_NULL) {
+        if (self->exception_sink != mp_const_none) {
+            mp_call_function_1(self->exception_sink, exception);
+        } else {
+            mp_obj_print_exception(&mp_plat_print, exception);
+            mp_lv_event_loop_deinit(self_in);
+        }
+    }
+    if (!self->running) return mp_const_none;
+
+    // lv_timer_handler returns LV_NO_TIMER_READY when there are no timers
+    if (delay > self->max_delay) delay = self->max_delay;
+    if (delay == 0) delay = 1;
+
+    // Re-arm when the next deadline is earlier than the timer, or when the timer would fire needlessly early.
+    // After an early wake-up a later deadline is left as is, to avoid re-arming the timer on every invalidation.
+    int32_t diff = (int32_t)(mp_hal_ticks_ms() + delay - self->next_fire);
+    if (diff < -MP_LV_EVENT_LOOP_SLACK_MS || (fired && diff > MP_LV_EVENT_LOOP_SLACK_MS))
+        mp_lv_event_loop_arm(self, delay);
+    return mp_const_none;
+}
+
+STATIC mp_obj_t mp_lv_event_loop_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args)
+{
+    enum { ARG_timer, ARG_max_delay, ARG_refresh_cb, ARG_exception_sink };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_timer, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+        { MP_QSTR_max_delay, MP_ARG_INT, {.u_int = 500} },
+        { MP_QSTR_refresh_cb, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = mp_const_none} },
+        { MP_QSTR_exception_sink, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = mp_const_none} },
+    };
+    mp_arg_val_t parsed[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, args, MP_ARRAY_SIZE(allowed_args), allowed_args, parsed);
+
+    if (MP_STATE_VM(mp_lv_event_loop)) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_RuntimeError, MP_ERROR_TEXT("Event loop is already running!")));
+#if MP_LV_RENDER_THREAD
+    if (mp_lv_lock_state.active) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_RuntimeError, MP_ERROR_TEXT("Render thread is running!")));
+#endif
+    if (parsed[ARG_max_delay].u_int <= 0) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_ValueError, MP_ERROR_TEXT("max_delay must be positive")));
+
+    mp_lv_event_loop_t *self = m_new0(mp_lv_event_loop_t, 1);
+    self->base.type = type;
+    self->timer = parsed[ARG_timer].u_obj;
+    self->refresh_cb = parsed[ARG_refresh_cb].u_obj;
+    self->exception_sink = parsed[ARG_exception_sink].u_obj;
+    self->max_delay = parsed[ARG_max_delay].u_int;
+
+    // Prepare timer.init(mode=PERIODIC, period=<delay>, callback=<bound timer_cb>) once, so arming doesn't allocate
+    self->timer_init = mp_load_attr(self->timer, MP_QSTR_init);
+    self->timer_init_args[0] = MP_OBJ_NEW_QSTR(MP_QSTR_mode);
+    self->timer_init_args[1] = mp_load_attr(self->timer, MP_QSTR_PERIODIC);
+    self->timer_init_args[2] = MP_OBJ_NEW_QSTR(MP_QSTR_period);
+    self->timer_init_args[4] = MP_OBJ_NEW_QSTR(MP_QSTR_callback);
+    self->timer_init_args[5] = mp_obj_new_bound_meth(MP_OBJ_FROM_PTR(&mp_lv_event_loop_timer_cb_obj), MP_OBJ_FROM_PTR(self));
+
+    self->running = true;
+    self->last_tick = mp_hal_ticks_ms();
+    MP_STATE_VM(mp_lv_event_loop) = self;
+    mp_lv_event_loop_arm(self, 1);
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC mp_obj_t mp_lv_event_loop_disable(mp_obj_t self_in)
+{
+    mp_lv_event_loop_t *self = MP_OBJ_TO_PTR(self_in);
+    self->disabled++;
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_event_loop_disable_obj, mp_lv_event_loop_disable);
+
+STATIC mp_obj_t mp_lv_event_loop_enable(mp_obj_t self_in)
+{
+    mp_lv_event_loop_t *self = MP_OBJ_TO_PTR(self_in);
+    if (self->disabled > 0 && --self->disabled == 0) mp_lv_event_loop_schedule(self);
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_event_loop_enable_obj, mp_lv_event_loop_enable);
+
+STATIC mp_obj_t mp_lv_event_loop_wake(mp_obj_t self_in)
+{
+    mp_lv_event_loop_schedule(MP_OBJ_TO_PTR(self_in));
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_event_loop_wake_obj, mp_lv_event_loop_wake);
+
+STATIC mp_obj_t mp_lv_event_loop_is_running(mp_obj_t self_in)
+{
+    mp_lv_event_loop_t *self = MP_OBJ_TO_PTR(self_in);
+    return mp_obj_new_bool(self->running);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_event_loop_is_running_obj, mp_lv_event_loop_is_running);
+
+STATIC const mp_rom_map_elem_t mp_lv_event_loop_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_deinit), MP_ROM_PTR(&mp_lv_event_loop_deinit_obj) },
+    { MP_ROM_QSTR(MP_QSTR_disable), MP_ROM_PTR(&mp_lv_event_loop_disable_obj) },
+    { MP_ROM_QSTR(MP_QSTR_enable), MP_ROM_PTR(&mp_lv_event_loop_enable_obj) },
+    { MP_ROM_QSTR(MP_QSTR_wake), MP_ROM_PTR(&mp_lv_event_loop_wake_obj) },
+    { MP_ROM_QSTR(MP_QSTR_is_running), MP_ROM_PTR(&mp_lv_event_loop_is_running_obj) },
+};
+
+STATIC MP_DEFINE_CONST_DICT(mp_lv_event_loop_locals_dict, mp_lv_event_loop_locals_dict_table);
+
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_lv_event_loop_type,
+    MP_QSTR_event_loop,
+    MP_TYPE_FLAG_NONE,
+    make_new, mp_lv_event_loop_make_new,
+    locals_dict, &mp_lv_event_loop_locals_dict
+);
+
+#endif // MICROPY_ENABLE_SCHEDULER
+""")
+    extension_globals.append(('event_loop', '&mp_lv_event_loop_type', 'MICROPY_ENABLE_SCHEDULER'))
+    print("""
+/*
+ * Render thread
+ *
+ *   thread = lvgl.render_thread(max_delay=500, exception_sink=None)
+ *
+ * Runs lv_timer_handler, and with it rendering and flushing, on a dedicated pthread, so that LVGL renders
+ * while Python code runs. Binding calls from Python take the LVGL lock, and Python callbacks that LVGL calls
+ * on the render thread run on a MicroPython thread (see "LVGL lock"). Exceptions they raise are passed to
+ * exception_sink, or printed. The render thread queues the calls of callbacks wrapped with lvgl.deferred itself,
+ * without waiting for a MicroPython thread, and schedules lvgl.run_deferred after lv_timer_handler returns.
+ * The thread sleeps until the next LVGL timer is due (up to max_delay ms), or until a display is invalidated
+ * or wake() is called. Display and input drivers implemented in C must not call into MicroPython.
+ * Only one render thread can run, and not together with lvgl.event_loop.
+ * Rendering overlaps Python code only on ports without a GIL (such as unix), otherwise it holds the GIL
+ * while lv_timer_handler runs.
+ */
+
+#if MP_LV_RENDER_THREAD
+
+#ifndef MP_LV_RENDER_THREAD_STACK_SIZE
+#define MP_LV_RENDER_THREAD_STACK_SIZE (256 * 1024)
+#endif
+
+typedef struct mp_lv_render_thread_t {
+    mp_obj_base_t base;
+    mp_obj_t exception_sink;
+    size_t stack_size;
+    pthread_cond_t wake_cond;   // Uses the mutex of the LVGL lock
+    uint32_t max_delay;
+    int disabled;
+    volatile bool running;
+    bool woken;
+    volatile bool deferred_scheduled;
+} mp_lv_render_thread_t;
+
+MP_REGISTER_ROOT_POINTER(struct mp_lv_render_thread_t *mp_lv_render_thread);
+
+STATIC void mp_lv_render_thread_lock(void)
+{
+    // Unlike mp_lv_lock_acquire, the render thread doesn't serve marshaled calls
+    mp_lv_lock_t *lock = &mp_lv_lock_state;
+    MP_THREAD_GIL_EXIT();
+    pthread_mutex_lock(&lock->mutex);
+    while (lock->depth > 0) pthread_cond_wait(&lock->cond, &lock->mutex);
+    lock->owner = pthread_self();
+    lock->depth = 1;
+    pthread_mutex_unlock(&lock->mutex);
+    MP_THREAD_GIL_ENTER();
+}
+
+STATIC void mp_lv_render_thread_wake_locked(mp_lv_render_thread_t *self)
+{
+    self->woken = true;
+    pthread_cond_signal(&self->wake_cond);
+}
+
+STATIC void mp_lv_render_thread_invalidate_cb(lv_event_t *e)
+{
+    mp_lv_render_thread_t *self = MP_STATE_VM(mp_lv_render_thread);
+    if (!self || mp_lv_render_thread_is_current()) return;
+    pthread_mutex_lock(&mp_lv_lock_state.mutex);
+    mp_lv_render_thread_wake_locked(self);
+    pthread_mutex_unlock(&mp_lv_lock_state.mutex);
+}
+
+#ifdef MP_LV_DEFERRED
+
+STATIC mp_obj_t mp_lv_render_thread_run_deferred(mp_obj_t self_in)
+{
+    mp_lv_render_thread_t *self = MP_OBJ_TO_PTR(self_in);
+    self->deferred_scheduled = false;
+    return mp_lv_run_deferred();
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_render_thread_run_deferred_obj, mp_lv_render_thread_run_deferred);
+
+#endif // MP_LV_DEFERRED
+
+STATIC void mp_lv_render_thread_reraise(void *exception)
+{
+    // Marshaled, so that mp_lv_lock_serve passes the exception to exception_sink on a MicroPython thread
+    nlr_raise(MP_OBJ_FROM_PTR(exception));
+}
+
+STATIC void *mp_lv_render_thread_run(void *arg)
+{
+    // The render thread is a MicroPython thread, since LVGL allocates from the GC heap (lv_conf.h).
+    // It never runs Python code.
+    mp_lv_render_thread_t *self = arg;
+    mp_lv_lock_t *lock = &mp_lv_lock_state;
+    mp_state_thread_t ts;
+    memset(&ts, 0, sizeof(ts));
+    mp_thread_set_state(&ts);
+    mp_stack_set_top(&ts + 1);
+    mp_stack_set_limit(self->stack_size);
+    mp_lv_on_render_thread = true;
+    MP_THREAD_GIL_ENTER();
+    mp_thread_start();
+
+#if !LV_TICK_CUSTOM
+    uint32_t last_tick = mp_hal_ticks_ms();
+#endif
+    while (self->running) {
+        uint32_t delay = self->max_delay;
+        if (self->disabled == 0) {
+            mp_lv_render_thread_lock();
+#if !LV_TICK_CUSTOM
+            uint32_t now = mp_hal_ticks_ms();
+            lv_tick_inc(now - last_tick);
+            last_tick = now;
+#endif
+            nlr_buf_t nlr;
+            if (nlr_push(&nlr) == 0) {
+                mp_lv_hook_invalidation(mp_lv_render_thread_invalidate_cb);
+#ifdef MP_LV_TELEMETRY
+                delay = mp_lv_telemetry_timer_handler_run();
+#else
+                delay = lv_timer_handler();
+#endif
+                nlr_pop();
+            } else {
+                // Raised by the binding (e.g. MemoryError), not by Python code
+                mp_lv_render_thread_call(mp_lv_render_thread_reraise, nlr.ret_val);
+                delay = self->max_delay;
+            }
+            mp_lv_lock_release();
+        }
+
+#ifdef MP_LV_DEFERRED
+        mp_lv_deferred_queue_t *queue = MP_STATE_VM(mp_lv_deferred_queue);
+        if (queue && MP_LV_DEFERRED_LOAD(queue->head) != MP_LV_DEFERRED_LOAD(queue->tail) && !self->deferred_scheduled) {
+            self->deferred_scheduled = mp_sched_schedule(MP_OBJ_FROM_PTR(&mp_lv_render_thread_run_deferred_obj), MP_OBJ_FROM_PTR(self));
+        }
+#endif
+
+        // lv_timer_handler returns LV_NO_TIMER_READY when there are no timers
+        if (delay > self->max_delay) delay = self->max_delay;
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += delay / 1000;
+        deadline.tv_nsec += (delay % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        MP_THREAD_GIL_EXIT();
+        pthread_mutex_lock(&lock->mutex);
+        while (self->running && !self->woken) {
+            if (pthread_cond_timedwait(&self->wake_cond, &lock->mutex, &deadline) != 0) break;
+        }
+        self->woken = false;
+        pthread_mutex_unlock(&lock->mutex);
+        MP_THREAD_GIL_ENTER();
+    }
+
+    mp_thread_finish();
+    MP_THREAD_GIL_EXIT();
+    pthread_mutex_lock(&lock->mutex);
+    lock->active = false;
+    pthread_cond_broadcast(&lock->cond);
+    pthread_mutex_unlock(&lock->mutex);
+    return NULL;
+}
+
+STATIC mp_obj_t mp_lv_render_thread_deinit(mp_obj_t self_in)
+{
+    mp_lv_render_thread_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_lv_lock_t *lock = &mp_lv_lock_state;
+    if (!self->running) return mp_const_none;
+
+    pthread_mutex_lock(&lock->mutex);
+    self->running = false;
+    mp_lv_render_thread_wake_locked(self);
+    if (lock->call_pending && !lock->call) {
+        // Called from a callback the render thread waits for. It exits once the callback returns.
+        pthread_mutex_unlock(&lock->mutex);
+        return mp_const_none;
+    }
+    while (lock->active) {
+        if (lock->call) {
+            mp_lv_lock_serve();
+            continue;
+        }
+        MP_THREAD_GIL_EXIT();
+        pthread_cond_wait(&lock->cond, &lock->mutex);
+        pthread_mutex_unlock(&lock->mutex);
+        MP_THREAD_GIL_ENTER();
+        pthread_mutex_lock(&lock->mutex);
+    }
+    pthread_mutex_unlock(&lock->mutex);
+    pthread_cond_destroy(&self->wake_cond);
+    if (MP_STATE_VM(mp_lv_render_thread) == self) MP_STATE_VM(mp_lv_render_thread) = NULL;
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_render_thread_deinit_obj, mp_lv_render_thread_deinit);
+
+STATIC mp_obj_t mp_lv_render_thread_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args)
+{
+    enum { ARG_max_delay, ARG_exception_sink };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_max_delay, MP_ARG_INT, {.u_int = 500} },
+        { MP_QSTR_exception_sink, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = mp_const_none} },
+    };
+    mp_arg_val_t parsed[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, args, MP_ARRAY_SIZE(allowed_args), allowed_args, parsed);
+
+    if (mp_lv_lock_state.active) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_RuntimeError, MP_ERROR_TEXT("Render thread is already running!")));
+    if (MP_STATE_VM(mp_lv_event_loop)) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_RuntimeError, MP_ERROR_TEXT("Event loop is already running!")));
+    if (parsed[ARG_max_delay].u_int <= 0) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_ValueError, MP_ERROR_TEXT("max_delay must be positive")));
+
+    mp_lv_render_thread_t *self = m_new0(mp_lv_render_thread_t, 1);
+    self->base.type = type;
+    self->exception_sink = parsed[ARG_exception_sink].u_obj;
+    self->max_delay = parsed[ARG_max_delay].u_int;
+    self->running = true;
+    pthread_cond_init(&self->wake_cond, NULL);
+    MP_STATE_VM(mp_lv_render_thread) = self;
+
+    // From now on binding calls take the lock
+    mp_lv_lock_state.exception_sink = self->exception_sink;
+    mp_lv_lock_state.active = true;
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+        self->stack_size = MP_LV_RENDER_THREAD_STACK_SIZE;
+        mp_thread_create(mp_lv_render_thread_run, self, &self->stack_size);
+        nlr_pop();
+    } else {
+        mp_lv_lock_state.active = false;
+        self->running = false;
+        nlr_jump(nlr.ret_val);
+    }
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC mp_obj_t mp_lv_render_thread_wake(mp_obj_t self_in)
+{
+    mp_lv_render_thread_t *self = MP_OBJ_TO_PTR(self_in);
+    pthread_mutex_lock(&mp_lv_lock_state.mutex);
+    mp_lv_render_thread_wake_locked(self);
+    pthread_mutex_unlock(&mp_lv_lock_state.mutex);
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_render_thread_wake_obj, mp_lv_render_thread_wake);
+
+STATIC mp_obj_t mp_lv_render_thread_disable(mp_obj_t self_in)
+{
+    mp_lv_render_thread_t *self = MP_OBJ_TO_PTR(self_in);
+    self->disabled++;
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_render_thread_disable_obj, mp_lv_render_thread_disable);
+
+STATIC mp_obj_t mp_lv_render_thread_enable(mp_obj_t self_in)
+{
+    mp_lv_render_thread_t *self = MP_OBJ_TO_PTR(self_in);
+    if (self->disabled > 0 && --self->disabled == 0) mp_lv_render_thread_wake(self_in);
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_render_thread_enable_obj, mp_lv_render_thread_enable);
+
+STATIC mp_obj_t mp_lv_render_thread_is_running(mp_obj_t self_in)
+{
+    mp_lv_render_thread_t *self = MP_OBJ_TO_PTR(self_in);
+    return mp_obj_new_bool(self->running);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_render_thread_is_running_obj, mp_lv_render_thread_is_running);
+
+STATIC const mp_rom_map_elem_t mp_lv_render_thread_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_deinit), MP_ROM_PTR(&mp_lv_render_thread_deinit_obj) },
+    { MP_ROM_QSTR(MP_QSTR_disable), MP_ROM_PTR(&mp_lv_render_thread_disable_obj) },
+    { MP_ROM_QSTR(MP_QSTR_enable), MP_ROM_PTR(&mp_lv_render_thread_enable_obj) },
+    { MP_ROM_QSTR(MP_QSTR_wake), MP_ROM_PTR(&mp_lv_render_thread_wake_obj) },
+    { MP_ROM_QSTR(MP_QSTR_is_running), MP_ROM_PTR(&mp_lv_render_thread_is_running_obj) },
+};
+
+STATIC MP_DEFINE_CONST_DICT(mp_lv_render_thread_locals_dict, mp_lv_render_thread_locals_dict_table);
+
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_lv_render_thread_type,
+    MP_QSTR_render_thread,
+    MP_TYPE_FLAG_NONE,
+    make_new, mp_lv_render_thread_make_new,
+    locals_dict, &mp_lv_render_thread_locals_dict
+);
+
+#endif // MP_LV_RENDER_THREAD
+""")
+    extension_globals.append(('render_thread', '&mp_lv_render_thread_type', 'MP_LV_RENDER_THREAD'))
+
+if has_funcs('lv_disp_create', 'lv_disp_remove', 'lv_disp_set_flush_cb', 'lv_disp_set_draw_buffers', 'lv_disp_flush_ready',
+        'lv_disp_set_color_format', 'lv_color_format_get_size', 'lv_disp_set_driver_data', 'lv_disp_get_driver_data') and \
+        struct_has_fields('lv_disp_t', 'flush_cb'):
+    print("""
+/*
+ * Headless display
+ *
+ *   disp = lvgl.headless(width, height, render_mode=lvgl.DISP_RENDER_MODE.FULL, buf_size=0, color_format=lvgl.COLOR_FORMAT.NATIVE)
+ *   fb = memoryview(disp)      # The framebuffer: height rows of width * pixel size bytes
+ *   disp.hash()                # FNV-1a hash of the framebuffer
+ *   disp.dump(stream)          # Write the framebuffer to stream as a binary PPM (P6) image
+ *
+ * A display that renders into a framebuffer in RAM, for benchmarks and pixel exact tests without SDL or hardware.
+ * In FULL and DIRECT render modes LVGL renders directly into the framebuffer. In PARTIAL mode it renders into a
+ * draw buffer of buf_size bytes (by default a tenth of the framebuffer), and flush_cb copies it into the framebuffer.
+ * get_disp() returns the lv_disp_t, and flush_count() the number of flushes so far.
+ */
+
+typedef struct mp_lv_headless_t {
+    mp_obj_base_t base;
+    lv_disp_t *disp;            // NULL after deinit()
+    uint8_t *fb;
+    uint8_t *draw_buf;          // PARTIAL render mode only
+    size_t fb_size;
+    size_t stride;
+    uint32_t width;
+    uint32_t height;
+    uint32_t px_size;
+    uint32_t render_mode;
+    uint32_t flush_count;
+    bool reversed;              // Byte swapped 16 bit colors
+} mp_lv_headless_t;
+
+STATIC void mp_lv_headless_flush_cb(lv_disp_t *disp, const lv_area_t *area, void *px_map)
+{
+    mp_lv_headless_t *self = lv_disp_get_driver_data(disp);
+    if (self->render_mode == LV_DISP_RENDER_MODE_PARTIAL) {
+        // The draw buffer holds the area rows back to back
+        size_t row_size = (size_t)(area->x2 - area->x1 + 1) * self->px_size;
+        const uint8_t *src = px_map;
+        for (lv_coord_t y = area->y1; y <= area->y2; y++) {
+            memcpy(self->fb + y * self->stride + area->x1 * self->px_size, src, row_size);
+            src += row_size;
+        }
+    }
+    self->flush_count++;
+    lv_disp_flush_ready(disp);
+}
+
+STATIC mp_lv_headless_t *mp_lv_headless_get(mp_obj_t self_in)
+{
+    mp_lv_headless_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->disp) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_RuntimeError, MP_ERROR_TEXT("Headless display was deinitialized")));
+    return self;
+}
+
+STATIC mp_obj_t mp_lv_headless_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args)
+{
+    enum { ARG_width, ARG_height, ARG_render_mode, ARG_buf_size, ARG_color_format };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_width, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_height, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_render_mode, MP_ARG_INT, {.u_int = LV_DISP_RENDER_MODE_FULL} },
+        { MP_QSTR_buf_size, MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_color_format, MP_ARG_INT, {.u_int = LV_COLOR_FORMAT_NATIVE} },
+    };
+    mp_arg_val_t parsed[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, args, MP_ARRAY_SIZE(allowed_args), allowed_args, parsed);
+
+    mp_int_t width = parsed[ARG_width].u_int;
+    mp_int_t height = parsed[ARG_height].u_int;
+    mp_int_t render_mode = parsed[ARG_render_mode].u_int;
+    lv_color_format_t color_format = parsed[ARG_color_format].u_int;
+    uint32_t px_size = lv_color_format_get_size(color_format);
+    if (width <= 0 || height <= 0) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_ValueError, MP_ERROR_TEXT("Invalid display size")));
+    if (render_mode != LV_DISP_RENDER_MODE_PARTIAL && render_mode != LV_DISP_RENDER_MODE_DIRECT &&
+            render_mode != LV_DISP_RENDER_MODE_FULL) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_ValueError, MP_ERROR_TEXT("Invalid render mode")));
+    if (px_size == 0) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_ValueError, MP_ERROR_TEXT("Unsupported color format")));
+
+    mp_lv_headless_t *self = m_new0(mp_lv_headless_t, 1);
+    self->base.type = type;
+    self->width = width;
+    self->height = height;
+    self->px_size = px_size;
+    self->render_mode = render_mode;
+    self->reversed = color_format == LV_COLOR_FORMAT_NATIVE_REVERSED;
+    self->stride = width * px_size;
+    self->fb_size = self->stride * height;
+    self->fb = m_new0(uint8_t, self->fb_size);
+
+    uint8_t *buf = self->fb;
+    size_t buf_size = self->fb_size;
+    if (render_mode == LV_DISP_RENDER_MODE_PARTIAL) {
+        // At least one row
+        buf_size = parsed[ARG_buf_size].u_int > 0? parsed[ARG_buf_size].u_int: self->fb_size / 10;
+        if (buf_size < self->stride) buf_size = self->stride;
+        self->draw_buf = m_new(uint8_t, buf_size);
+        buf = self->draw_buf;
+    }
+
+    lv_disp_t *disp;
+    MP_LV_LOCK_BEGIN();
+    disp = lv_disp_create(width, height);
+    lv_disp_set_color_format(disp, color_format);
+    lv_disp_set_driver_data(disp, self);
+    lv_disp_set_flush_cb(disp, (__typeof__(disp->flush_cb))mp_lv_headless_flush_cb);
+    lv_disp_set_draw_buffers(disp, buf, NULL, buf_size, render_mode);
+    MP_LV_LOCK_END();
+    self->disp = disp;
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC mp_int_t mp_lv_headless_get_buffer(mp_obj_t self_in, mp_buffer_info_t *bufinfo, mp_uint_t flags)
+{
+    mp_lv_headless_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->disp) return 1;
+    bufinfo->buf = self->fb;
+    bufinfo->len = self->fb_size;
+    bufinfo->typecode = BYTEARRAY_TYPECODE;
+    return 0;
+}
+
+STATIC mp_obj_t mp_lv_headless_get_disp(mp_obj_t self_in)
+{
+    mp_lv_headless_t *self = mp_lv_headless_get(self_in);
+    return {disp_convertor}(self->disp);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_headless_get_disp_obj, mp_lv_headless_get_disp);
+
+STATIC mp_obj_t mp_lv_headless_flush_count(mp_obj_t self_in)
+{
+    mp_lv_headless_t *self = MP_OBJ_TO_PTR(self_in);
+    return mp_obj_new_int_from_uint(self->flush_count);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_headless_flush_count_obj, mp_lv_headless_flush_count);
+
+STATIC mp_obj_t mp_lv_headless_hash(mp_obj_t self_in)
+{
+    mp_lv_headless_t *self = mp_lv_headless_get(self_in);
+    uint32_t hash = 2166136261u;
+    MP_LV_LOCK_BEGIN();
+    for (size_t i = 0; i < self->fb_size; i++) {
+        hash ^= self->fb[i];
+        hash *= 16777619u;
+    }
+    MP_LV_LOCK_END();
+    return mp_obj_new_int_from_uint(hash);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_headless_hash_obj, mp_lv_headless_hash);
+
+STATIC void mp_lv_headless_convert_row(mp_lv_headless_t *self, uint32_t y, uint8_t *rgb)
+{
+    // LVGL colors are little endian: RGB565, B G R (RGB888) or B G R X (XRGB8888)
+    const uint8_t *px = self->fb + y * self->stride;
+    for (uint32_t x = 0; x < self->width; x++, px += self->px_size, rgb += 3) {
+        if (self->px_size == 2) {
+            uint16_t c = self->reversed? (px[0] << 8) | px[1]: (px[1] << 8) | px[0];
+            rgb[0] = ((c >> 11) & 0x1F) * 255 / 31;
+            rgb[1] = ((c >> 5) & 0x3F) * 255 / 63;
+            rgb[2] = (c & 0x1F) * 255 / 31;
+        } else {
+            rgb[0] = px[2];
+            rgb[1] = px[1];
+            rgb[2] = px[0];
+        }
+    }
+}
+
+STATIC mp_obj_t mp_lv_headless_dump(mp_obj_t self_in, mp_obj_t stream)
+{
+    mp_lv_headless_t *self = mp_lv_headless_get(self_in);
+    if (self->px_size < 2 || self->px_size > 4) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_ValueError, MP_ERROR_TEXT("Cannot dump this color format")));
+    mp_obj_t write = mp_load_attr(stream, MP_QSTR_write);
+    char header[32];
+    int len = snprintf(header, sizeof(header), "P6\\n%u %u\\n255\\n", (unsigned)self->width, (unsigned)self->height);
+    mp_call_function_1(write, mp_obj_new_bytes((const byte *)header, len));
+    size_t row_size = self->width * 3;
+    uint8_t *row = m_new(uint8_t, row_size);
+    mp_obj_t row_obj = mp_obj_new_bytearray_by_ref(row_size, row);
+    for (uint32_t y = 0; y < self->height; y++) {
+        MP_LV_LOCK_BEGIN();
+        mp_lv_headless_convert_row(self, y, row);
+        MP_LV_LOCK_END();
+        mp_call_function_1(write, row_obj);
+    }
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(mp_lv_headless_dump_obj, mp_lv_headless_dump);
+
+STATIC mp_obj_t mp_lv_headless_deinit(mp_obj_t self_in)
+{
+    mp_lv_headless_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->disp) return mp_const_none;
+    MP_LV_LOCK_BEGIN();
+    lv_disp_remove(self->disp);
+    MP_LV_LOCK_END();
+    self->disp = NULL;
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_headless_deinit_obj, mp_lv_headless_deinit);
+
+STATIC const mp_rom_map_elem_t mp_lv_headless_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_get_disp), MP_ROM_PTR(&mp_lv_headless_get_disp_obj) },
+    { MP_ROM_QSTR(MP_QSTR_flush_count), MP_ROM_PTR(&mp_lv_headless_flush_count_obj) },
+    { MP_ROM_QSTR(MP_QSTR_hash), MP_ROM_PTR(&mp_lv_headless_hash_obj) },
+    { MP_ROM_QSTR(MP_QSTR_dump), MP_ROM_PTR(&mp_lv_headless_dump_obj) },
+    { MP_ROM_QSTR(MP_QSTR_deinit), MP_ROM_PTR(&mp_lv_headless_deinit_obj) },
+};
+
+STATIC MP_DEFINE_CONST_DICT(mp_lv_headless_locals_dict, mp_lv_headless_locals_dict_table);
+
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_lv_headless_type,
+    MP_QSTR_headless,
+    MP_TYPE_FLAG_NONE,
+    make_new, mp_lv_headless_make_new,
+    buffer, mp_lv_headless_get_buffer,
+    locals_dict, &mp_lv_headless_locals_dict
+);
+""".replace('{disp_convertor}', lv_to_mp[try_generate_arg_type('lv_disp_remove', 0)]))
+    extension_globals.append(('headless', '&mp_lv_headless_type'))
+
+if has_funcs('lv_disp_create', 'lv_disp_remove', 'lv_disp_set_flush_cb', 'lv_disp_set_draw_buffers', 'lv_disp_flush_ready',
+        'lv_disp_flush_is_last', 'lv_disp_set_color_format', 'lv_color_format_get_size', 'lv_disp_set_driver_data',
+        'lv_disp_get_driver_data') and \
+        struct_has_fields('lv_disp_t', 'flush_cb'):
+    print("""
+/*
+ * Direct framebuffer display (Linux fbdev)
+ *
+ *   disp = lvgl.fbdev(path='/dev/fb0', render_mode=lvgl.DISP_RENDER_MODE.DIRECT, double_buffer=True, vsync=True,
+ *                     width=0, height=0, color_format=lvgl.COLOR_FORMAT.NATIVE)
+ *   disp.stats()               # dict: flushes, flips, pan_errors, pages, page
+ *   fb = disp.displayed()      # The page on screen: height rows of stride bytes
+ *
+ * Maps the framebuffer and uses it as LVGL's draw buffers (DIRECT or FULL render mode), so nothing is copied.
+ * With double_buffer=True, the framebuffer's virtual height is doubled (FBIOPUT_VSCREENINFO) and LVGL renders into
+ * the page that is not on screen. When the last area of a frame is flushed, that page is presented by moving the
+ * y offset to it with FBIOPAN_DISPLAY, then waiting for vertical sync (FBIO_WAITFORVSYNC) if vsync=True.
+ * If the device can't double its virtual height, a single page is used, and so it is after a failed pan: the
+ * frame is copied to the page on screen, and LVGL renders there from then on.
+ * Width, height and color format come from the device, and its lines must not be padded.
+ *
+ * path may also be a regular file, a stand-in framebuffer for tests: width, height and color_format are then
+ * required, the file is created or extended to hold the pages, and flips only move the page that displayed() returns.
+ */
+
+#ifndef MP_LV_FBDEV
+#if defined(__linux__)
+#define MP_LV_FBDEV 1
+#else
+#define MP_LV_FBDEV 0
+#endif
+#endif
+
+#if MP_LV_FBDEV
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fb.h>
+
+typedef struct mp_lv_fbdev_t {
+    mp_obj_base_t base;
+    lv_disp_t *disp;            // NULL after deinit()
+    int fd;
+    bool is_device;             // false for a file-backed stand-in
+    bool vsync;
+    uint8_t *fb;                // The mapping, pages back to back
+    size_t map_size;
+    size_t page_size;
+    size_t stride;
+    uint32_t height;
+    uint32_t pages;
+    uint32_t page;              // The page on screen
+    lv_disp_render_mode_t render_mode;
+    uint32_t flushes;
+    uint32_t flips;
+    uint32_t pan_errors;
+    struct fb_var_screeninfo vinfo;
+} mp_lv_fbdev_t;
+
+STATIC bool mp_lv_fbdev_pan(mp_lv_fbdev_t *self, uint32_t page)
+{
+    if (self->is_device) {
+        self->vinfo.xoffset = 0;
+        self->vinfo.yoffset = page * self->height;
+        if (ioctl(self->fd, FBIOPAN_DISPLAY, &self->vinfo) < 0) {
+            self->pan_errors++;
+            return false;
+        }
+        if (self->vsync) {
+            int screen = 0;
+            ioctl(self->fd, FBIO_WAITFORVSYNC, &screen);
+        }
+    }
+    self->page = page;
+    self->flips++;
+    return true;
+}
+
+STATIC void mp_lv_fbdev_flush_cb(lv_disp_t *disp, const lv_area_t *area, void *px_map)
+{
+    mp_lv_fbdev_t *self = lv_disp_get_driver_data(disp);
+    self->flushes++;
+    if (self->pages > 1 && lv_disp_flush_is_last(disp)) {
+        uint32_t page = (uint8_t *)px_map >= self->fb + self->page_size;
+        if (!mp_lv_fbdev_pan(self, page)) {
+            // Otherwise LVGL would render the next frame into the page on screen while it still swaps pages.
+            // Without a swap to come, it keeps rendering into the single buffer.
+            uint8_t *shown = self->fb + self->page * self->page_size;
+            memcpy(shown, self->fb + page * self->page_size, self->page_size);
+            self->pages = 1;
+            lv_disp_set_draw_buffers(disp, shown, NULL, self->page_size, self->render_mode);
+        }
+    }
+    lv_disp_flush_ready(disp);
+}
+
+STATIC mp_lv_fbdev_t *mp_lv_fbdev_get(mp_obj_t self_in)
+{
+    mp_lv_fbdev_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->disp) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_RuntimeError, MP_ERROR_TEXT("fbdev display was deinitialized")));
+    return self;
+}
+
+STATIC void mp_lv_fbdev_close(mp_lv_fbdev_t *self)
+{
+    if (self->fb) munmap(self->fb, self->map_size);
+    if (self->fd >= 0) close(self->fd);
+    self->fb = NULL;
+    self->fd = -1;
+}
+
+STATIC NORETURN void mp_lv_fbdev_raise(mp_lv_fbdev_t *self, const mp_rom_error_text_t msg)
+{
+    mp_lv_fbdev_close(self);
+    nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, msg));
+}
+
+STATIC NORETURN void mp_lv_fbdev_raise_errno(mp_lv_fbdev_t *self)
+{
+    int err = errno;
+    mp_lv_fbdev_close(self);
+    mp_raise_OSError(err);
+}
+
+STATIC lv_color_format_t mp_lv_fbdev_open_device(mp_lv_fbdev_t *self, uint32_t *width, bool double_buffer)
+{
+    struct fb_fix_screeninfo finfo;
+    if (ioctl(self->fd, FBIOGET_VSCREENINFO, &self->vinfo) < 0) mp_lv_fbdev_raise_errno(self);
+    lv_color_format_t color_format;
+    switch (self->vinfo.bits_per_pixel) {
+        case 16: color_format = LV_COLOR_FORMAT_RGB565; break;
+        case 24: color_format = LV_COLOR_FORMAT_RGB888; break;
+        case 32: color_format = LV_COLOR_FORMAT_XRGB8888; break;
+        default: mp_lv_fbdev_raise(self, MP_ERROR_TEXT("Unsupported framebuffer pixel format"));
+    }
+    *width = self->vinfo.xres;
+    self->height = self->vinfo.yres;
+    if (double_buffer && self->vinfo.yres_virtual < 2 * self->vinfo.yres) {
+        // Failure is fine, FBIOGET_VSCREENINFO below tells what the device settled on
+        struct fb_var_screeninfo vinfo = self->vinfo;
+        vinfo.yres_virtual = 2 * vinfo.yres;
+        vinfo.xoffset = vinfo.yoffset = 0;
+        vinfo.activate = FB_ACTIVATE_NOW;
+        ioctl(self->fd, FBIOPUT_VSCREENINFO, &vinfo);
+        if (ioctl(self->fd, FBIOGET_VSCREENINFO, &self->vinfo) < 0) mp_lv_fbdev_raise_errno(self);
+    }
+    if (ioctl(self->fd, FBIOGET_FSCREENINFO, &finfo) < 0) mp_lv_fbdev_raise_errno(self);
+    self->stride = finfo.line_length;
+    if (self->stride != *width * (self->vinfo.bits_per_pixel / 8)) {
+        mp_lv_fbdev_raise(self, MP_ERROR_TEXT("Padded framebuffer lines are not supported, use linux_fbdev_create()"));
+    }
+    self->page_size = self->stride * self->height;
+    self->pages = double_buffer && self->vinfo.yres_virtual >= 2 * self->height &&
+        finfo.smem_len >= 2 * self->page_size? 2: 1;
+    return color_format;
+}
+
+STATIC mp_obj_t mp_lv_fbdev_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args)
+{
+    enum { ARG_path, ARG_render_mode, ARG_double_buffer, ARG_vsync, ARG_width, ARG_height, ARG_color_format };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_path, MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_render_mode, MP_ARG_INT, {.u_int = LV_DISP_RENDER_MODE_DIRECT} },
+        { MP_QSTR_double_buffer, MP_ARG_BOOL, {.u_bool = true} },
+        { MP_QSTR_vsync, MP_ARG_BOOL, {.u_bool = true} },
+        { MP_QSTR_width, MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_height, MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_color_format, MP_ARG_INT, {.u_int = LV_COLOR_FORMAT_NATIVE} },
+    };
+    mp_arg_val_t parsed[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, args, MP_ARRAY_SIZE(allowed_args), allowed_args, parsed);
+
+    const char *path = parsed[ARG_path].u_obj != mp_const_none? mp_obj_str_get_str(parsed[ARG_path].u_obj): "/dev/fb0";
+    mp_int_t render_mode = parsed[ARG_render_mode].u_int;
+    bool double_buffer = parsed[ARG_double_buffer].u_bool;
+    if (render_mode != LV_DISP_RENDER_MODE_DIRECT && render_mode != LV_DISP_RENDER_MODE_FULL) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_ValueError, MP_ERROR_TEXT("Render mode must be DIRECT or FULL")));
+
+    // The finaliser releases the mapping and the file when deinit() was not called
+    mp_lv_fbdev_t *self = m_new_obj_with_finaliser(mp_lv_fbdev_t);
+    memset(self, 0, sizeof(*self));
+    self->base.type = type;
+    self->fd = -1;
+    self->render_mode = render_mode;
+    self->vsync = parsed[ARG_vsync].u_bool;
+    // With a size given, path may be a new stand-in file
+    bool sized = parsed[ARG_width].u_int > 0 && parsed[ARG_height].u_int > 0;
+    self->fd = open(path, O_RDWR | O_CLOEXEC | (sized? O_CREAT: 0), 0644);
+    if (self->fd < 0) mp_raise_OSError(errno);
+
+    struct stat st;
+    if (fstat(self->fd, &st) < 0) mp_lv_fbdev_raise_errno(self);
+    self->is_device = S_ISCHR(st.st_mode);
+
+    uint32_t width;
+    lv_color_format_t color_format;
+    if (self->is_device) {
+        color_format = mp_lv_fbdev_open_device(self, &width, double_buffer);
+        self->map_size = self->page_size * self->pages;
+    } else {
+        color_format = parsed[ARG_color_format].u_int;
+        mp_int_t w = parsed[ARG_width].u_int, h = parsed[ARG_height].u_int;
+        uint32_t px_size = lv_color_format_get_size(color_format);
+        if (w <= 0 || h <= 0) mp_lv_fbdev_raise(self, MP_ERROR_TEXT("A file-backed framebuffer needs width and height"));
+        if (px_size == 0) mp_lv_fbdev_raise(self, MP_ERROR_TEXT("Unsupported color format"));
+        width = w;
+        self->height = h;
+        self->stride = width * px_size;
+        self->page_size = self->stride * self->height;
+        self->pages = double_buffer? 2: 1;
+        self->map_size = self->page_size * self->pages;
+        if ((size_t)st.st_size < self->map_size && ftruncate(self->fd, self->map_size) < 0) mp_lv_fbdev_raise_errno(self);
+    }
+
+    void *fb = mmap(NULL, self->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+    if (fb == MAP_FAILED) mp_lv_fbdev_raise_errno(self);
+    self->fb = fb;
+    // Show page 0, LVGL renders the first frame into page 1 when double buffered
+    if (!mp_lv_fbdev_pan(self, 0)) self->pages = 1;
+    self->flips = 0;
+
+    lv_disp_t *disp;
+    MP_LV_LOCK_BEGIN();
+    disp = lv_disp_create(width, self->height);
+    lv_disp_set_color_format(disp, color_format);
+    lv_disp_set_driver_data(disp, self);
+    lv_disp_set_flush_cb(disp, (__typeof__(disp->flush_cb))mp_lv_fbdev_flush_cb);
+    lv_disp_set_draw_buffers(disp, self->pages > 1? self->fb + self->page_size: self->fb,
+        self->pages > 1? self->fb: NULL, self->page_size, render_mode);
+    MP_LV_LOCK_END();
+    self->disp = disp;
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC mp_int_t mp_lv_fbdev_get_buffer(mp_obj_t self_in, mp_buffer_info_t *bufinfo, mp_uint_t flags)
+{
+    mp_lv_fbdev_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->disp) return 1;
+    bufinfo->buf = self->fb;
+    bufinfo->len = self->map_size;
+    bufinfo->typecode = BYTEARRAY_TYPECODE;
+    return 0;
+}
+
+STATIC mp_obj_t mp_lv_fbdev_get_disp(mp_obj_t self_in)
+{
+    mp_lv_fbdev_t *self = mp_lv_fbdev_get(self_in);
+    return {disp_convertor}(self->disp);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_fbdev_get_disp_obj, mp_lv_fbdev_get_disp);
+
+STATIC mp_obj_t mp_lv_fbdev_displayed(mp_obj_t self_in)
+{
+    mp_lv_fbdev_t *self = mp_lv_fbdev_get(self_in);
+    return mp_obj_new_bytearray_by_ref(self->page_size, self->fb + self->page * self->page_size);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_fbdev_displayed_obj, mp_lv_fbdev_displayed);
+
+STATIC mp_obj_t mp_lv_fbdev_stats(mp_obj_t self_in)
+{
+    mp_lv_fbdev_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_t stats = mp_obj_new_dict(5);
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_flushes), mp_obj_new_int_from_uint(self->flushes));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_flips), mp_obj_new_int_from_uint(self->flips));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_pan_errors), mp_obj_new_int_from_uint(self->pan_errors));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_pages), mp_obj_new_int_from_uint(self->pages));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_page), mp_obj_new_int_from_uint(self->page));
+    return stats;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_fbdev_stats_obj, mp_lv_fbdev_stats);
+
+STATIC mp_obj_t mp_lv_fbdev_deinit(mp_obj_t self_in)
+{
+    mp_lv_fbdev_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->disp) return mp_const_none;
+    MP_LV_LOCK_BEGIN();
+    lv_disp_remove(self->disp);
+    MP_LV_LOCK_END();
+    self->disp = NULL;
+    mp_lv_fbdev_close(self);
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_fbdev_deinit_obj, mp_lv_fbdev_deinit);
+
+STATIC mp_obj_t mp_lv_fbdev_del(mp_obj_t self_in)
+{
+    // The display keeps self alive (driver data), so it was removed already, e.g. by lv.deinit()
+    mp_lv_fbdev_t *self = MP_OBJ_TO_PTR(self_in);
+    self->disp = NULL;
+    mp_lv_fbdev_close(self);
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_fbdev_del_obj, mp_lv_fbdev_del);
+
+STATIC const mp_rom_map_elem_t mp_lv_fbdev_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR___del__), MP_ROM_PTR(&mp_lv_fbdev_del_obj) },
+    { MP_ROM_QSTR(MP_QSTR_get_disp), MP_ROM_PTR(&mp_lv_fbdev_get_disp_obj) },
+    { MP_ROM_QSTR(MP_QSTR_displayed), MP_ROM_PTR(&mp_lv_fbdev_displayed_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&mp_lv_fbdev_stats_obj) },
+    { MP_ROM_QSTR(MP_QSTR_deinit), MP_ROM_PTR(&mp_lv_fbdev_deinit_obj) },
+};
+
+STATIC MP_DEFINE_CONST_DICT(mp_lv_fbdev_locals_dict, mp_lv_fbdev_locals_dict_table);
+
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_lv_fbdev_type,
+    MP_QSTR_fbdev,
+    MP_TYPE_FLAG_NONE,
+    make_new, mp_lv_fbdev_make_new,
+    buffer, mp_lv_fbdev_get_buffer,
+    locals_dict, &mp_lv_fbdev_locals_dict
+);
+
+#endif // MP_LV_FBDEV
+""".replace('{disp_convertor}', lv_to_mp[try_generate_arg_type('lv_disp_remove', 0)]))
+    extension_globals.append(('fbdev', '&mp_lv_fbdev_type', 'MP_LV_FBDEV'))
+
+if has_funcs('lv_disp_create', 'lv_disp_remove', 'lv_disp_set_flush_cb', 'lv_disp_set_draw_buffers', 'lv_disp_flush_ready',
+        'lv_disp_flush_is_last', 'lv_disp_set_color_format', 'lv_color_format_get_size', 'lv_disp_set_driver_data',
+        'lv_disp_get_driver_data') and \
+        struct_has_fields('lv_disp_t', 'flush_cb'):
+    print("""
+/*
+ * Remote display
+ *
+ *   disp = lvgl.remote_display(width, height, fd=-1, tile=16, render_mode=lvgl.DISP_RENDER_MODE.PARTIAL, buf_size=0,
+ *                              color_format=lvgl.COLOR_FORMAT.NATIVE)
+ *   disp.connect(sock.fileno())  # Send the stream header and the current frame, then the changes
+ *   disp.connect(-1)             # Stop streaming
+ *   disp.stats()                 # dict: frames, flushes, tiles, tiles_rle, bytes, raw_bytes, write_errors
+ *
+ * Streams the display to a file descriptor (a socket, pipe or file), for viewing a UI remotely.
+ * The screen is divided into tile x tile pixel tiles. Flushed areas are compared with a copy of the frame that
+ * was last sent, and when the last area of a frame is flushed, only the tiles that changed are sent.
+ * Comparing costs time proportional to the flushed area, and the stream grows with the changed area.
+ * The frame that was last sent is exposed through the buffer protocol.
+ *
+ * Stream format, integers little endian, pixels in the LVGL color format:
+ *   Header:  'LVRD' version:u8 (1) px_size:u8 color_format:u8 tile:u8 width:u16 height:u16
+ *   Tile:    'T' x:u16 y:u16 w:u16 h:u16 encoding:u8 length:u32 data
+ *            encoding 0: w * h pixels, row by row
+ *            encoding 1: runs of count - 1:u8 pixel, covering the w * h pixels row by row
+ *   Frame:   'E' frame:u32  (the tiles before it make up the frame)
+ * driver/linux/lv_remote.py decodes it.
+ * fd must be blocking, the frame is written before flush returns. When writing fails (the viewer went away),
+ * the display disconnects and counts a write error. Sockets don't raise SIGPIPE, pipes do unless it is ignored.
+ */
+
+#ifndef MP_LV_REMOTE
+#if defined(__unix__)
+#define MP_LV_REMOTE 1
+#else
+#define MP_LV_REMOTE 0
+#endif
+#endif
+
+#if MP_LV_REMOTE
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define MP_LV_REMOTE_HEADER_SIZE 12
+#define MP_LV_REMOTE_TILE_HEADER_SIZE 14
+#define MP_LV_REMOTE_OUT_SIZE 16384
+
+typedef struct mp_lv_remote_t {
+    mp_obj_base_t base;
+    lv_disp_t *disp;            // NULL after deinit()
+    int fd;                     // -1 when not connected
+    uint8_t *shadow;            // The frame last sent
+    uint8_t *draw_buf;
+    uint8_t *dirty;             // A flag per tile, changed since the last frame was sent
+    uint8_t *out;
+    size_t out_len;
+    size_t out_size;
+    size_t stride;
+    uint32_t width;
+    uint32_t height;
+    uint32_t px_size;
+    uint32_t tile;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    uint32_t color_format;
+    uint32_t render_mode;
+    uint32_t frames;
+    uint32_t flushes;
+    uint32_t tiles;
+    uint32_t tiles_rle;
+    uint32_t write_errors;
+    uint64_t bytes;
+    uint64_t raw_bytes;
+} mp_lv_remote_t;
+
+STATIC void mp_lv_remote_write_out(mp_lv_remote_t *self)
+{
+    const uint8_t *p = self->out;
+    size_t len = self->out_len;
+    self->out_len = 0;
+    while (len > 0 && self->fd >= 0) {
+        ssize_t n = send(self->fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK) n = write(self->fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            self->write_errors++;
+            self->fd = -1;
+            return;
+        }
+        self->bytes += n;
+        p += n;
+        len -= n;
+    }
+}
+
+STATIC uint8_t *mp_lv_remote_put(uint8_t *p, uint32_t value, int size)
+{
+    for (int i = 0; i < size; i++, value >>= 8) *p++ = value;
+    return p;
+}
+
+STATIC void mp_lv_remote_send_tile(mp_lv_remote_t *self, uint32_t tx, uint32_t ty)
+{
+    uint32_t x = tx * self->tile, y = ty * self->tile;
+    uint32_t w = LV_MIN(self->tile, self->width - x), h = LV_MIN(self->tile, self->height - y);
+    size_t raw_len = (size_t)w * h * self->px_size;
+    if (self->out_size - self->out_len < MP_LV_REMOTE_TILE_HEADER_SIZE + raw_len) mp_lv_remote_write_out(self);
+
+    uint8_t *header = self->out + self->out_len;
+    uint8_t *data = header + MP_LV_REMOTE_TILE_HEADER_SIZE, *end = data + raw_len, *p = data;
+    uint32_t px_size = self->px_size;
+
+    // Run length encoding, given up when it gets longer than the raw pixels
+    uint8_t encoding = 1;
+    const uint8_t *run = NULL;
+    uint32_t run_len = 0;
+    for (uint32_t row = 0; row < h && encoding; row++) {
+        const uint8_t *px = self->shadow + (y + row) * self->stride + x * px_size;
+        for (uint32_t col = 0; col < w; col++, px += px_size) {
+            if (run && run_len < 256 && memcmp(px, run, px_size) == 0) {
+                run_len++;
+                continue;
+            }
+            if (run) {
+                p[0] = run_len - 1;
+                memcpy(p + 1, run, px_size);
+                p += 1 + px_size;
+            }
+            if ((size_t)(end - p) < 1 + px_size) {
+                encoding = 0;
+                break;
+            }
+            run = px;
+            run_len = 1;
+        }
+    }
+    if (encoding) {
+        p[0] = run_len - 1;
+        memcpy(p + 1, run, px_size);
+        p += 1 + px_size;
+        self->tiles_rle++;
+    } else {
+        p = data;
+        for (uint32_t row = 0; row < h; row++, p += w * px_size) {
+            memcpy(p, self->shadow + (y + row) * self->stride + x * px_size, w * px_size);
+        }
+    }
+
+    *header = 'T';
+    uint8_t *q = mp_lv_remote_put(header + 1, x, 2);
+    q = mp_lv_remote_put(q, y, 2);
+    q = mp_lv_remote_put(q, w, 2);
+    q = mp_lv_remote_put(q, h, 2);
+    *q++ = encoding;
+    mp_lv_remote_put(q, p - data, 4);
+    self->out_len += p - header;
+    self->tiles++;
+    self->raw_bytes += raw_len;
+}
+
+STATIC void mp_lv_remote_send_frame(mp_lv_remote_t *self)
+{
+    size_t n = (size_t)self->tiles_x * self->tiles_y;
+    for (size_t i = 0; i < n; i++) {
+        if (self->dirty[i] && self->fd >= 0) mp_lv_remote_send_tile(self, i % self->tiles_x, i / self->tiles_x);
+    }
+    memset(self->dirty, 0, n);
+    if (self->fd < 0) return;
+    if (self->out_size - self->out_len < 5) mp_lv_remote_write_out(self);
+    self->out[self->out_len] = 'E';
+    mp_lv_remote_put(self->out + self->out_len + 1, self->frames++, 4);
+    self->out_len += 5;
+    mp_lv_remote_write_out(self);
+}
+
+STATIC void mp_lv_remote_flush_cb(lv_disp_t *disp, const lv_area_t *area, void *px_map)
+{
+    mp_lv_remote_t *self = lv_disp_get_driver_data(disp);
+    uint32_t px_size = self->px_size, tile = self->tile;
+    size_t area_stride = self->render_mode == LV_DISP_RENDER_MODE_PARTIAL?
+        (size_t)(area->x2 - area->x1 + 1) * px_size: self->stride;
+    const uint8_t *area_px = self->render_mode == LV_DISP_RENDER_MODE_PARTIAL?
+        (const uint8_t *)px_map: (const uint8_t *)px_map + area->y1 * self->stride + area->x1 * px_size;
+
+    // Compare the area with the shadow frame tile by tile, and take the changed parts
+    for (uint32_t ty = area->y1 / tile; ty <= area->y2 / tile; ty++) {
+        uint32_t y1 = LV_MAX(ty * tile, (uint32_t)area->y1), y2 = LV_MIN(ty * tile + tile - 1, (uint32_t)area->y2);
+        for (uint32_t tx = area->x1 / tile; tx <= area->x2 / tile; tx++) {
+            uint32_t x1 = LV_MAX(tx * tile, (uint32_t)area->x1), x2 = LV_MIN(tx * tile + tile - 1, (uint32_t)area->x2);
+            size_t len = (x2 - x1 + 1) * px_size;
+            for (uint32_t y = y1; y <= y2; y++) {
+                const uint8_t *src = area_px + (y - area->y1) * area_stride + (x1 - area->x1) * px_size;
+                uint8_t *dst = self->shadow + y * self->stride + x1 * px_size;
+                if (memcmp(dst, src, len)) {
+                    memcpy(dst, src, len);
+                    self->dirty[ty * self->tiles_x + tx] = 1;
+                }
+            }
+        }
+    }
+    self->flushes++;
+    if (lv_disp_flush_is_last(disp)) mp_lv_remote_send_frame(self);
+    lv_disp_flush_ready(disp);
+}
+
+STATIC mp_lv_remote_t *mp_lv_remote_get(mp_obj_t self_in)
+{
+    mp_lv_remote_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->disp) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_RuntimeError, MP_ERROR_TEXT("Remote display was deinitialized")));
+    return self;
+}
+
+STATIC void mp_lv_remote_connect_fd(mp_lv_remote_t *self, mp_int_t fd)
+{
+    self->fd = fd < 0? -1: fd;
+    if (self->fd < 0) return;
+    // A new viewer gets the header and then the whole frame
+    uint8_t *p = self->out;
+    memcpy(p, "LVRD", 4);
+    p[4] = 1;
+    p[5] = self->px_size;
+    p[6] = self->color_format;
+    p[7] = self->tile;
+    mp_lv_remote_put(mp_lv_remote_put(p + 8, self->width, 2), self->height, 2);
+    self->out_len = MP_LV_REMOTE_HEADER_SIZE;
+    memset(self->dirty, 1, (size_t)self->tiles_x * self->tiles_y);
+    mp_lv_remote_send_frame(self);
+}
+
+STATIC mp_obj_t mp_lv_remote_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args)
+{
+    enum { ARG_width, ARG_height, ARG_fd, ARG_tile, ARG_render_mode, ARG_buf_size, ARG_color_format };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_width, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_height, MP_ARG_REQUIRED | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_fd, MP_ARG_INT, {.u_int = -1} },
+        { MP_QSTR_tile, MP_ARG_INT, {.u_int = 16} },
+        { MP_QSTR_render_mode, MP_ARG_INT, {.u_int = LV_DISP_RENDER_MODE_PARTIAL} },
+        { MP_QSTR_buf_size, MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_color_format, MP_ARG_INT, {.u_int = LV_COLOR_FORMAT_NATIVE} },
+    };
+    mp_arg_val_t parsed[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, args, MP_ARRAY_SIZE(allowed_args), allowed_args, parsed);
+
+    mp_int_t width = parsed[ARG_width].u_int;
+    mp_int_t height = parsed[ARG_height].u_int;
+    mp_int_t tile = parsed[ARG_tile].u_int;
+    mp_int_t render_mode = parsed[ARG_render_mode].u_int;
+    lv_color_format_t color_format = parsed[ARG_color_format].u_int;
+    uint32_t px_size = lv_color_format_get_size(color_format);
+    if (width <= 0 || height <= 0 || width > 0xFFFF || height > 0xFFFF) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_ValueError, MP_ERROR_TEXT("Invalid display size")));
+    if (tile < 1 || tile > 255) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_ValueError, MP_ERROR_TEXT("Tile size must be 1..255")));
+    if (render_mode != LV_DISP_RENDER_MODE_PARTIAL && render_mode != LV_DISP_RENDER_MODE_DIRECT &&
+            render_mode != LV_DISP_RENDER_MODE_FULL) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_ValueError, MP_ERROR_TEXT("Invalid render mode")));
+    if (px_size == 0) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_ValueError, MP_ERROR_TEXT("Unsupported color format")));
+
+    mp_lv_remote_t *self = m_new0(mp_lv_remote_t, 1);
+    self->base.type = type;
+    self->fd = -1;
+    self->width = width;
+    self->height = height;
+    self->px_size = px_size;
+    self->tile = tile;
+    self->tiles_x = (width + tile - 1) / tile;
+    self->tiles_y = (height + tile - 1) / tile;
+    self->color_format = color_format;
+    self->render_mode = render_mode;
+    self->stride = width * px_size;
+    self->shadow = m_new0(uint8_t, self->stride * height);
+    self->dirty = m_new0(uint8_t, self->tiles_x * self->tiles_y);
+    // Room for a tile that doesn't compress at all
+    self->out_size = LV_MAX(MP_LV_REMOTE_OUT_SIZE, MP_LV_REMOTE_TILE_HEADER_SIZE + tile * tile * px_size);
+    self->out = m_new(uint8_t, self->out_size);
+
+    size_t buf_size = self->stride * height;
+    if (render_mode == LV_DISP_RENDER_MODE_PARTIAL) {
+        buf_size = parsed[ARG_buf_size].u_int > 0? parsed[ARG_buf_size].u_int: buf_size / 10;
+        if (buf_size < self->stride) buf_size = self->stride;
+    }
+    self->draw_buf = m_new(uint8_t, buf_size);
+
+    lv_disp_t *disp;
+    MP_LV_LOCK_BEGIN();
+    disp = lv_disp_create(width, height);
+    lv_disp_set_color_format(disp, color_format);
+    lv_disp_set_driver_data(disp, self);
+    lv_disp_set_flush_cb(disp, (__typeof__(disp->flush_cb))mp_lv_remote_flush_cb);
+    lv_disp_set_draw_buffers(disp, self->draw_buf, NULL, buf_size, render_mode);
+    MP_LV_LOCK_END();
+    self->disp = disp;
+    mp_lv_remote_connect_fd(self, parsed[ARG_fd].u_int);
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC mp_int_t mp_lv_remote_get_buffer(mp_obj_t self_in, mp_buffer_info_t *bufinfo, mp_uint_t flags)
+{
+    mp_lv_remote_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->disp) return 1;
+    bufinfo->buf = self->shadow;
+    bufinfo->len = self->stride * self->height;
+    bufinfo->typecode = BYTEARRAY_TYPECODE;
+    return 0;
+}
+
+STATIC mp_obj_t mp_lv_remote_get_disp(mp_obj_t self_in)
+{
+    mp_lv_remote_t *self = mp_lv_remote_get(self_in);
+    return {disp_convertor}(self->disp);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_remote_get_disp_obj, mp_lv_remote_get_disp);
+
+STATIC mp_obj_t mp_lv_remote_connect(mp_obj_t self_in, mp_obj_t fd)
+{
+    mp_lv_remote_t *self = mp_lv_remote_get(self_in);
+    MP_LV_LOCK_BEGIN();
+    mp_lv_remote_connect_fd(self, fd == mp_const_none? -1: mp_obj_get_int(fd));
+    MP_LV_LOCK_END();
+    return mp_obj_new_bool(self->fd >= 0);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(mp_lv_remote_connect_obj, mp_lv_remote_connect);
+
+STATIC mp_obj_t mp_lv_remote_stats(mp_obj_t self_in)
+{
+    mp_lv_remote_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_t stats = mp_obj_new_dict(7);
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_frames), mp_obj_new_int_from_uint(self->frames));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_flushes), mp_obj_new_int_from_uint(self->flushes));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_tiles), mp_obj_new_int_from_uint(self->tiles));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_tiles_rle), mp_obj_new_int_from_uint(self->tiles_rle));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_bytes), mp_obj_new_int_from_ull(self->bytes));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_raw_bytes), mp_obj_new_int_from_ull(self->raw_bytes));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_write_errors), mp_obj_new_int_from_uint(self->write_errors));
+    return stats;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_remote_stats_obj, mp_lv_remote_stats);
+
+STATIC mp_obj_t mp_lv_remote_deinit(mp_obj_t self_in)
+{
+    mp_lv_remote_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->disp) return mp_const_none;
+    MP_LV_LOCK_BEGIN();
+    lv_disp_remove(self->disp);
+    MP_LV_LOCK_END();
+    self->disp = NULL;
+    self->fd = -1;
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_remote_deinit_obj, mp_lv_remote_deinit);
+
+STATIC const mp_rom_map_elem_t mp_lv_remote_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_get_disp), MP_ROM_PTR(&mp_lv_remote_get_disp_obj) },
+    { MP_ROM_QSTR(MP_QSTR_connect), MP_ROM_PTR(&mp_lv_remote_connect_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&mp_lv_remote_stats_obj) },
+    { MP_ROM_QSTR(MP_QSTR_deinit), MP_ROM_PTR(&mp_lv_remote_deinit_obj) },
+};
+
+STATIC MP_DEFINE_CONST_DICT(mp_lv_remote_locals_dict, mp_lv_remote_locals_dict_table);
+
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_lv_remote_type,
+    MP_QSTR_remote_display,
+    MP_TYPE_FLAG_NONE,
+    make_new, mp_lv_remote_make_new,
+    buffer, mp_lv_remote_get_buffer,
+    locals_dict, &mp_lv_remote_locals_dict
+);
+
+#endif // MP_LV_REMOTE
+""".replace('{disp_convertor}', lv_to_mp[try_generate_arg_type('lv_disp_remove', 0)]))
+    extension_globals.append(('remote_display', '&mp_lv_remote_type', 'MP_LV_REMOTE'))
+
+if has_funcs('lv_disp_get_default', 'lv_disp_get_next', 'lv_disp_flush_is_last', 'lv_color_format_get_size',
+        'lv_disp_get_scr_act', 'lv_obj_invalidate') and \
+        struct_has_fields('lv_disp_t', 'flush_cb', 'wait_cb', 'flushing', 'flushing_last', 'hor_res', 'ver_res',
+            'render_mode', 'color_format', 'buf_1', 'buf_2', 'buf_act', 'buf_size_in_bytes'):
+    print("""
+/*
+ * Flush traces
+ *
+ *   lvgl.flush_trace.record(stream, disp=None, payload=False)
+ *   lvgl.flush_trace.stop()                                     # Returns the number of flushes recorded
+ *   lvgl.flush_trace.replay(stream, disp=None, buf=None, realtime=False)
+ *
+ * record() writes every flush of a display to stream (anything with a write method): the area, a hash of its
+ * pixels or with payload=True the pixels themselves, when the flush started and the gap since the previous flush
+ * returned. flush_cb only appends the records to a buffer, which is written to stream from the MicroPython scheduler
+ * and by stop(), so no Python code runs in flush_cb (which may run on the render thread).
+ * stop() ends the recording, and raises the exception if writing failed. It raises RuntimeError while flush_cb is
+ * wrapped by something installed after record() (such as lvgl.telemetry), which must be removed first.
+ * replay() reads a trace from stream (anything with a readinto method) and feeds it to a display's flush_cb as fast
+ * as the display takes it, or with the recorded gaps when realtime is True. The areas come in the same order and
+ * sizes, so flush paths (a C driver with DMA, a Python driver, fbdev) can be compared on exactly the same I/O.
+ * The pixels go into buf, by default the display's active draw buffer (so they are DMA capable if it is), laid out
+ * as the display's render mode expects. Areas recorded without payload are filled with a color taken from their
+ * hash. The display must have the trace's pixel size and be at least as large as the areas. The screen is
+ * invalidated after replay(), since the draw buffers were overwritten. replay() returns a dict: flushes, frames,
+ * pixels, bytes (of payload), us (the whole replay), flush_us (in flush_cb and waiting for flush ready),
+ * recorded_us (from the first to the last recorded flush).
+ *
+ * Trace format, integers little endian:
+ *   Header:  'LVFT' version:u8 (1) flags:u8 (1: payload) px_size:u8 color_format:u8 width:u16 height:u16
+ *            render_mode:u8 reserved:u8[3]
+ *   Flush:   time_us:u32 gap_us:u32 x1:i16 y1:i16 x2:i16 y2:i16 last:u8 reserved:u8[3] hash:u32 length:u32 data
+ *            hash is FNV-1a over the area rows, data is length bytes: the area rows back to back, or nothing.
+ * Recording hashes (and with payload writes) the area before calling flush_cb. That time is not part of the gaps.
+ * Only one display is recorded at a time, and flush_cb must be set before record().
+ * Don't let an event loop refresh the display being replayed to.
+ */
+
+#define MP_LV_FLUSH_TRACE_HEADER_SIZE 16
+#define MP_LV_FLUSH_TRACE_RECORD_SIZE 28
+
+#ifndef MP_LV_FLUSH_TRACE_DRAIN_SIZE
+#define MP_LV_FLUSH_TRACE_DRAIN_SIZE (16 * 1024)     // Buffered bytes that schedule writing them
+#endif
+
+typedef void (*mp_lv_flush_trace_cb_t)(lv_disp_t *, const lv_area_t *, void *);
+
+typedef struct mp_lv_flush_trace_t {
+    lv_disp_t *disp;
+    mp_lv_flush_trace_cb_t flush_cb;
+    mp_obj_t write;
+    mp_obj_t error;             // Raised by write, MP_OBJ_NULL if none
+    uint8_t *buf;               // Records not written yet
+    size_t len;
+    size_t alloc;
+    uint32_t px_size;
+    uint32_t count;
+    mp_uint_t start;
+    mp_uint_t last_return;
+    bool payload;
+    bool overflow;              // The buffer could not grow, records were dropped
+    volatile bool drain_scheduled;
+} mp_lv_flush_trace_t;
+
+MP_REGISTER_ROOT_POINTER(struct mp_lv_flush_trace_t *mp_lv_flush_trace);
+
+STATIC void mp_lv_flush_trace_put16(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+STATIC void mp_lv_flush_trace_put32(uint8_t *p, uint32_t v)
+{
+    mp_lv_flush_trace_put16(p, v);
+    mp_lv_flush_trace_put16(p + 2, v >> 16);
+}
+
+STATIC uint32_t mp_lv_flush_trace_get16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+STATIC uint32_t mp_lv_flush_trace_get32(const uint8_t *p)
+{
+    return mp_lv_flush_trace_get16(p) | (mp_lv_flush_trace_get16(p + 2) << 16);
+}
+
+STATIC uint32_t mp_lv_flush_trace_hash(uint32_t hash, const uint8_t *p, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+STATIC size_t mp_lv_flush_trace_stride(lv_disp_t *disp, size_t row_size, uint32_t px_size)
+{
+    // In PARTIAL render mode the buffer holds the area rows back to back, otherwise the whole screen
+    return disp->render_mode == LV_DISP_RENDER_MODE_PARTIAL? row_size: (size_t)disp->hor_res * px_size;
+}
+
+STATIC void mp_lv_flush_trace_append(mp_lv_flush_trace_t *tr, const void *data, size_t len)
+{
+    // Called from flush_cb, so it must not raise. Nothing more is buffered after an error.
+    if (tr->error != MP_OBJ_NULL || tr->overflow) return;
+    if (tr->len + len > tr->alloc) {
+        size_t alloc = tr->alloc;
+        while (alloc < tr->len + len) alloc *= 2;
+        uint8_t *buf = m_renew_maybe(uint8_t, tr->buf, tr->alloc, alloc, true);
+        if (!buf) {
+            tr->overflow = true;
+            return;
+        }
+        tr->buf = buf;
+        tr->alloc = alloc;
+    }
+    memcpy(tr->buf + tr->len, data, len);
+    tr->len += len;
+}
+
+STATIC void mp_lv_flush_trace_write(mp_lv_flush_trace_t *tr)
+{
+    // Writes the buffered records, on a MicroPython thread. Exceptions are kept for stop().
+    uint8_t *data;
+    size_t len;
+    MP_LV_LOCK_BEGIN();
+    tr->drain_scheduled = false;
+    data = tr->buf;
+    len = tr->len;
+    if (len > 0) {
+        tr->buf = m_new(uint8_t, tr->alloc);
+        tr->len = 0;
+    }
+    MP_LV_LOCK_END();
+    if (len == 0 || tr->error != MP_OBJ_NULL) return;
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+        mp_call_function_1(tr->write, mp_obj_new_bytearray_by_ref(len, data));
+        nlr_pop();
+    } else {
+        tr->error = MP_OBJ_FROM_PTR(nlr.ret_val);
+    }
+}
+
+#if MICROPY_ENABLE_SCHEDULER
+
+STATIC mp_obj_t mp_lv_flush_trace_drain(mp_obj_t arg)
+{
+    mp_lv_flush_trace_t *tr = MP_STATE_VM(mp_lv_flush_trace);
+    if (tr) mp_lv_flush_trace_write(tr);
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_flush_trace_drain_obj, mp_lv_flush_trace_drain);
+
+#endif
+
+STATIC void mp_lv_flush_trace_flush_cb(lv_disp_t *disp, const lv_area_t *area, void *px_map)
+{
+    mp_lv_flush_trace_t *tr = MP_STATE_VM(mp_lv_flush_trace);
+    mp_uint_t now = mp_hal_ticks_us();
+    uint32_t px_size = tr->px_size, rows = area->y2 - area->y1 + 1;
+    size_t row_size = (size_t)(area->x2 - area->x1 + 1) * px_size;
+    size_t stride = mp_lv_flush_trace_stride(disp, row_size, px_size);
+    const uint8_t *px = disp->render_mode == LV_DISP_RENDER_MODE_PARTIAL?
+        (const uint8_t *)px_map: (const uint8_t *)px_map + area->y1 * stride + area->x1 * px_size;
+    uint32_t hash = 2166136261u;
+    for (uint32_t y = 0; y < rows; y++) hash = mp_lv_flush_trace_hash(hash, px + y * stride, row_size);
+
+    uint8_t record[MP_LV_FLUSH_TRACE_RECORD_SIZE] = {0};
+    mp_lv_flush_trace_put32(record, now - tr->start);
+    mp_lv_flush_trace_put32(record + 4, tr->count? now - tr->last_return: 0);
+    mp_lv_flush_trace_put16(record + 8, area->x1);
+    mp_lv_flush_trace_put16(record + 10, area->y1);
+    mp_lv_flush_trace_put16(record + 12, area->x2);
+    mp_lv_flush_trace_put16(record + 14, area->y2);
+    record[16] = lv_disp_flush_is_last(disp);
+    mp_lv_flush_trace_put32(record + 20, hash);
+    mp_lv_flush_trace_put32(record + 24, tr->payload? row_size * rows: 0);
+    mp_lv_flush_trace_append(tr, record, sizeof(record));
+    if (tr->payload) {
+        if (stride == row_size) mp_lv_flush_trace_append(tr, px, row_size * rows);
+        else for (uint32_t y = 0; y < rows; y++) mp_lv_flush_trace_append(tr, px + y * stride, row_size);
+    }
+    tr->count++;
+#if MICROPY_ENABLE_SCHEDULER
+    if (tr->len >= MP_LV_FLUSH_TRACE_DRAIN_SIZE && !tr->drain_scheduled) {
+        tr->drain_scheduled = mp_sched_schedule(MP_OBJ_FROM_PTR(&mp_lv_flush_trace_drain_obj), mp_const_none);
+    }
+#endif
+
+    tr->flush_cb(disp, area, px_map);
+    tr->last_return = mp_hal_ticks_us();
+}
+
+STATIC bool mp_lv_flush_trace_disp_exists(lv_disp_t *disp)
+{
+    for (lv_disp_t *d = lv_disp_get_next(NULL); d; d = lv_disp_get_next(d)) {
+        if (d == disp) return true;
+    }
+    return false;
+}
+
+STATIC lv_disp_t *mp_lv_flush_trace_get_disp(mp_obj_t disp_in)
+{
+    lv_disp_t *disp = disp_in != mp_const_none? mp_to_ptr(disp_in): lv_disp_get_default();
+    if (!disp) nlr_raise(mp_obj_new_exception_msg(&mp_type_RuntimeError, MP_ERROR_TEXT("No display")));
+    if (!disp->flush_cb) nlr_raise(mp_obj_new_exception_msg(&mp_type_RuntimeError, MP_ERROR_TEXT("Display has no flush_cb")));
+    return disp;
+}
+
+STATIC mp_lv_flush_trace_t *mp_lv_flush_trace_end(void)
+{
+    // Called holding the LVGL lock. A wrapper installed after record() still calls mp_lv_flush_trace_flush_cb,
+    // which needs the recording, so it can't end until the wrapper is removed.
+    mp_lv_flush_trace_t *tr = MP_STATE_VM(mp_lv_flush_trace);
+    if (!tr) return NULL;
+    if (mp_lv_flush_trace_disp_exists(tr->disp)) {
+        if ((void*)tr->disp->flush_cb != (void*)mp_lv_flush_trace_flush_cb) nlr_raise(
+            mp_obj_new_exception_msg(
+                &mp_type_RuntimeError, MP_ERROR_TEXT("flush_cb was wrapped after record(), remove the wrapper first")));
+        tr->disp->flush_cb = (__typeof__(tr->disp->flush_cb))tr->flush_cb;
+    }
+    MP_STATE_VM(mp_lv_flush_trace) = NULL;
+    return tr;
+}
+
+STATIC mp_obj_t mp_lv_flush_trace_stop(void)
+{
+    mp_lv_flush_trace_t *tr;
+    MP_LV_LOCK_BEGIN();
+    tr = mp_lv_flush_trace_end();
+    MP_LV_LOCK_END();
+    if (!tr) return MP_OBJ_NEW_SMALL_INT(0);
+    mp_lv_flush_trace_write(tr);
+    if (tr->error != MP_OBJ_NULL) nlr_raise(tr->error);
+    if (tr->overflow) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_MemoryError, MP_ERROR_TEXT("Flush trace buffer overflow, records were dropped")));
+    return mp_obj_new_int_from_uint(tr->count);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(mp_lv_flush_trace_stop_obj, mp_lv_flush_trace_stop);
+
+STATIC mp_obj_t mp_lv_flush_trace_record(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
+{
+    enum { ARG_stream, ARG_disp, ARG_payload };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_stream, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+        { MP_QSTR_disp, MP_ARG_OBJ, {.u_obj = mp_const_none} },
+        { MP_QSTR_payload, MP_ARG_BOOL, {.u_bool = false} },
+    };
+    mp_arg_val_t parsed[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, parsed);
+
+    mp_obj_t write = mp_load_attr(parsed[ARG_stream].u_obj, MP_QSTR_write);
+    mp_lv_flush_trace_t *ended;
+    lv_disp_t *disp;
+    {
+        MP_LV_LOCK_BEGIN();
+        disp = mp_lv_flush_trace_get_disp(parsed[ARG_disp].u_obj);
+        ended = mp_lv_flush_trace_end();
+        MP_LV_LOCK_END();
+    }
+    if (ended) mp_lv_flush_trace_write(ended);
+    uint32_t px_size = lv_color_format_get_size(disp->color_format);
+    if (px_size == 0) nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Unsupported color format")));
+
+    uint8_t header[MP_LV_FLUSH_TRACE_HEADER_SIZE] = {'L', 'V', 'F', 'T', 1};
+    header[5] = parsed[ARG_payload].u_bool;
+    header[6] = px_size;
+    header[7] = disp->color_format;
+    mp_lv_flush_trace_put16(header + 8, disp->hor_res);
+    mp_lv_flush_trace_put16(header + 10, disp->ver_res);
+    header[12] = disp->render_mode;
+    mp_call_function_1(write, mp_obj_new_bytes(header, sizeof(header)));
+
+    mp_lv_flush_trace_t *tr = m_new0(mp_lv_flush_trace_t, 1);
+    tr->disp = disp;
+    tr->write = write;
+    tr->error = MP_OBJ_NULL;
+    tr->alloc = MP_LV_FLUSH_TRACE_DRAIN_SIZE;
+    tr->buf = m_new(uint8_t, tr->alloc);
+    tr->px_size = px_size;
+    tr->payload = parsed[ARG_payload].u_bool;
+    MP_LV_LOCK_BEGIN();
+    tr->flush_cb = (mp_lv_flush_trace_cb_t)disp->flush_cb;
+    tr->start = mp_hal_ticks_us();
+    MP_STATE_VM(mp_lv_flush_trace) = tr;
+    disp->flush_cb = (__typeof__(disp->flush_cb))mp_lv_flush_trace_flush_cb;
+    MP_LV_LOCK_END();
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(mp_lv_flush_trace_record_obj, 1, mp_lv_flush_trace_record);
+
+STATIC size_t mp_lv_flush_trace_read(mp_obj_t readinto, void *buf, size_t len)
+{
+    // Reads len bytes, fewer only at the end of the stream
+    size_t done = 0;
+    while (done < len) {
+        mp_obj_t n = mp_call_function_1(readinto, mp_obj_new_bytearray_by_ref(len - done, (uint8_t *)buf + done));
+        if (n == mp_const_none || mp_obj_get_int(n) <= 0) break;
+        done += mp_obj_get_int(n);
+    }
+    return done;
+}
+
+STATIC void mp_lv_flush_trace_fill(uint8_t *px, size_t stride, size_t row_size, uint32_t rows, uint32_t px_size, uint32_t hash)
+{
+    // The low px_size bytes of the hash make the color
+    uint8_t color[4] = {hash, hash >> 8, hash >> 16, hash >> 24};
+    for (uint32_t y = 0; y < rows; y++, px += stride) {
+        for (size_t i = 0; i < row_size; i += px_size) memcpy(px + i, color, px_size);
+    }
+}
+
+STATIC mp_obj_t mp_lv_flush_trace_replay(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
+{
+    enum { ARG_stream, ARG_disp, ARG_buf, ARG_realtime };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_stream, MP_ARG_REQUIRED | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+        { MP_QSTR_disp, MP_ARG_OBJ, {.u_obj = mp_const_none} },
+        { MP_QSTR_buf, MP_ARG_OBJ, {.u_obj = mp_const_none} },
+        { MP_QSTR_realtime, MP_ARG_BOOL, {.u_bool = false} },
+    };
+    mp_arg_val_t parsed[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, parsed);
+
+    lv_disp_t *disp = mp_lv_flush_trace_get_disp(parsed[ARG_disp].u_obj);
+    mp_obj_t readinto = mp_load_attr(parsed[ARG_stream].u_obj, MP_QSTR_readinto);
+    uint8_t header[MP_LV_FLUSH_TRACE_HEADER_SIZE];
+    if (mp_lv_flush_trace_read(readinto, header, sizeof(header)) != sizeof(header) || memcmp(header, "LVFT", 4) != 0 ||
+            header[4] != 1) nlr_raise(
+        mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Not a flush trace")));
+    uint32_t px_size = lv_color_format_get_size(disp->color_format);
+    if (header[6] != px_size) nlr_raise(
+        mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Trace pixel size differs from the display's")));
+
+    bool own_buf = parsed[ARG_buf].u_obj == mp_const_none;
+    uint8_t *buf = (uint8_t *)disp->buf_act;
+    size_t buf_size = disp->buf_size_in_bytes;
+    if (!own_buf) {
+        mp_buffer_info_t bufinfo;
+        mp_get_buffer_raise(parsed[ARG_buf].u_obj, &bufinfo, MP_BUFFER_WRITE);
+        buf = bufinfo.buf;
+        buf_size = bufinfo.len;
+    }
+    if (!buf) nlr_raise(mp_obj_new_exception_msg(&mp_type_RuntimeError, MP_ERROR_TEXT("Display has no draw buffer")));
+
+    bool partial = disp->render_mode == LV_DISP_RENDER_MODE_PARTIAL;
+    bool realtime = parsed[ARG_realtime].u_bool;
+    uint32_t flushes = 0, frames = 0, first_time = 0, last_time = 0;
+    uint64_t pixels = 0, bytes = 0, flush_us = 0;
+    mp_uint_t start = mp_hal_ticks_us(), last_return = start;
+    uint8_t record[MP_LV_FLUSH_TRACE_RECORD_SIZE];
+    for (;;) {
+        size_t n = mp_lv_flush_trace_read(readinto, record, sizeof(record));
+        if (n == 0) break;
+        if (n != sizeof(record)) nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Truncated trace")));
+        lv_area_t area;
+        area.x1 = (int16_t)mp_lv_flush_trace_get16(record + 8);
+        area.y1 = (int16_t)mp_lv_flush_trace_get16(record + 10);
+        area.x2 = (int16_t)mp_lv_flush_trace_get16(record + 12);
+        area.y2 = (int16_t)mp_lv_flush_trace_get16(record + 14);
+        bool last = record[16] != 0;
+        uint32_t hash = mp_lv_flush_trace_get32(record + 20), length = mp_lv_flush_trace_get32(record + 24);
+        if (area.x1 < 0 || area.y1 < 0 || area.x2 < area.x1 || area.y2 < area.y1 ||
+                area.x2 >= disp->hor_res || area.y2 >= disp->ver_res) nlr_raise(
+            mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Trace area is outside the display")));
+
+        uint32_t rows = area.y2 - area.y1 + 1;
+        size_t row_size = (size_t)(area.x2 - area.x1 + 1) * px_size;
+        size_t stride = mp_lv_flush_trace_stride(disp, row_size, px_size);
+        size_t offset = partial? 0: area.y1 * stride + area.x1 * px_size;
+        if (offset + (rows - 1) * stride + row_size > buf_size) nlr_raise(
+            mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Buffer is too small for the trace")));
+        if (length) {
+            if (length != row_size * rows) nlr_raise(
+                mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Bad payload length")));
+            bool complete = stride == row_size? mp_lv_flush_trace_read(readinto, buf, length) == length: true;
+            for (uint32_t y = 0; stride != row_size && y < rows && complete; y++) {
+                complete = mp_lv_flush_trace_read(readinto, buf + offset + y * stride, row_size) == row_size;
+            }
+            if (!complete) nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Truncated trace")));
+            bytes += length;
+        } else {
+            mp_lv_flush_trace_fill(buf + offset, stride, row_size, rows, px_size, hash);
+        }
+
+        uint32_t recorded = mp_lv_flush_trace_get32(record), gap = mp_lv_flush_trace_get32(record + 4);
+        if (flushes == 0) first_time = recorded;
+        last_time = recorded;
+        if (realtime && flushes > 0) {
+            // The gap runs from the return of the previous flush_cb, which includes waiting for flush ready
+            uint32_t elapsed = mp_hal_ticks_us() - last_return;
+            if (gap > elapsed) mp_hal_delay_us(gap - elapsed);
+        }
+
+        MP_LV_LOCK_BEGIN();
+        mp_uint_t flush_start = mp_hal_ticks_us();
+        disp->flushing = 1;
+        disp->flushing_last = last;
+        disp->flush_cb(disp, &area, (void *)buf);
+        last_return = mp_hal_ticks_us();
+        while (disp->flushing) {
+            if (disp->wait_cb) disp->wait_cb(disp);
+        }
+        flush_us += mp_hal_ticks_us() - flush_start;
+        if (own_buf && disp->buf_2 && (partial || last)) {
+            // As LVGL does, render into the other buffer while this one is being sent
+            disp->buf_act = disp->buf_act == disp->buf_1? disp->buf_2: disp->buf_1;
+            buf = (uint8_t *)disp->buf_act;
+        }
+        MP_LV_LOCK_END();
+        flushes++;
+        frames += last;
+        pixels += (uint64_t)(area.x2 - area.x1 + 1) * rows;
+    }
+    uint32_t us = mp_hal_ticks_us() - start;
+
+    MP_LV_LOCK_BEGIN();
+    lv_obj_invalidate(lv_disp_get_scr_act(disp));
+    MP_LV_LOCK_END();
+
+    mp_obj_t stats = mp_obj_new_dict(7);
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_flushes), mp_obj_new_int_from_uint(flushes));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_frames), mp_obj_new_int_from_uint(frames));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_pixels), mp_obj_new_int_from_ull(pixels));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_bytes), mp_obj_new_int_from_ull(bytes));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_us), mp_obj_new_int_from_uint(us));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_flush_us), mp_obj_new_int_from_ull(flush_us));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_recorded_us), mp_obj_new_int_from_uint(last_time - first_time));
+    return stats;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(mp_lv_flush_trace_replay_obj, 1, mp_lv_flush_trace_replay);
+
+STATIC const mp_rom_map_elem_t mp_lv_flush_trace_globals_table[] = {
+    { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_flush_trace) },
+    { MP_ROM_QSTR(MP_QSTR_record), MP_ROM_PTR(&mp_lv_flush_trace_record_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stop), MP_ROM_PTR(&mp_lv_flush_trace_stop_obj) },
+    { MP_ROM_QSTR(MP_QSTR_replay), MP_ROM_PTR(&mp_lv_flush_trace_replay_obj) },
+    { MP_ROM_QSTR(MP_QSTR_HEADER_SIZE), MP_ROM_INT(MP_LV_FLUSH_TRACE_HEADER_SIZE) },
+    { MP_ROM_QSTR(MP_QSTR_RECORD_SIZE), MP_ROM_INT(MP_LV_FLUSH_TRACE_RECORD_SIZE) },
+};
+
+STATIC MP_DEFINE_CONST_DICT(mp_lv_flush_trace_globals, mp_lv_flush_trace_globals_table);
+
+STATIC const mp_obj_module_t mp_lv_flush_trace_module = {
+    .base = { &mp_type_module },
+    .globals = (mp_obj_dict_t *)&mp_lv_flush_trace_globals,
+};
+""")
+    extension_globals.append(('flush_trace', '&mp_lv_flush_trace_module'))
+
+if has_funcs('lv_disp_add_event', 'lv_disp_get_event_count', 'lv_disp_get_event_dsc', 'lv_event_dsc_get_cb',
+        'lv_disp_remove_event', 'lv_event_get_user_data', 'lv_event_dsc_get_user_data', 'lv_disp_get_hor_res', 'lv_disp_get_ver_res',
+        'lv_disp_get_default', 'lv_disp_get_next') and \
+        struct_has_fields('lv_disp_t', 'inv_areas', 'inv_area_joined', 'inv_p'):
+    print("""
+/*
+ * Flush planner
+ *
+ *   planner = lvgl.flush_planner(disp=None, overhead=200, full=True)
+ *   planner.stats()              # dict: frames, areas_in, areas_out, merged, full, dirty_px, sent_px, redundant_px
+ *   planner.set_overhead(px)
+ *   planner.reset()
+ *   planner.deinit()
+ *
+ * Plans the areas of a display that LVGL redraws and flushes, when rendering starts (LV_EVENT_RENDER_START): after
+ * layout, which can invalidate more areas, and after LVGL joined the areas it could.
+ * The cost of an area is overhead + its number of pixels. overhead is the fixed cost of flushing an area
+ * (window commands, transactions, driver calls), in pixels: the time to send it divided by the time to send a pixel.
+ * Pairs of areas are merged into their bounding box as long as that lowers the total cost, so small nearby areas
+ * become one write. With full=True, when the whole screen costs less than the planned areas, the frame is redrawn
+ * as a single full window write.
+ * Statistics: planned frames, dirty areas, areas after planning, merges, full window frames, dirty pixels (covered
+ * by the dirty areas), sent pixels (covered by the planned areas) and redundant pixels (sent but not dirty).
+ * An area larger than the draw buffer is still flushed in several parts.
+ * LVGL finds the last area of the frame before LV_EVENT_RENDER_START, so the planned areas always keep that slot.
+ */
+
+typedef struct mp_lv_flush_planner_t {
+    mp_obj_base_t base;
+    lv_disp_t *disp;
+    uint32_t overhead;
+    bool full;
+    uint32_t frames;
+    uint32_t areas_in;
+    uint32_t areas_out;
+    uint32_t merged;
+    uint32_t full_frames;
+    uint64_t dirty_px;
+    uint64_t sent_px;
+} mp_lv_flush_planner_t;
+
+#define MP_LV_FLUSH_PLANNER_MAX_AREAS (sizeof(((lv_disp_t *)0)->inv_areas) / sizeof(lv_area_t))
+
+STATIC inline uint32_t mp_lv_flush_planner_px(const lv_area_t *a)
+{
+    return (uint32_t)(a->x2 - a->x1 + 1) * (uint32_t)(a->y2 - a->y1 + 1);
+}
+
+STATIC inline void mp_lv_flush_planner_bounds(lv_area_t *res, const lv_area_t *a, const lv_area_t *b)
+{
+    res->x1 = LV_MIN(a->x1, b->x1);
+    res->y1 = LV_MIN(a->y1, b->y1);
+    res->x2 = LV_MAX(a->x2, b->x2);
+    res->y2 = LV_MAX(a->y2, b->y2);
+}
+
+STATIC void mp_lv_flush_planner_sort(int32_t *v, uint32_t n, uint32_t stride)
+{
+    // Insertion sort on the first of each stride values, n is at most 2 * MP_LV_FLUSH_PLANNER_MAX_AREAS
+    for (uint32_t i = 1; i < n; i++) {
+        for (uint32_t j = i; j > 0 && v[(j - 1) * stride] > v[j * stride]; j--) {
+            for (uint32_t k = 0; k < stride; k++) {
+                int32_t t = v[(j - 1) * stride + k];
+                v[(j - 1) * stride + k] = v[j * stride + k];
+                v[j * stride + k] = t;
+            }
+        }
+    }
+}
+
+// Number of pixels covered by the areas that are not joined.
+// The x edges split the areas into vertical slabs, and the y ranges in each slab are merged.
+
+STATIC uint64_t mp_lv_flush_planner_covered(const lv_area_t *areas, const uint8_t *joined, uint32_t n)
+{
+    int32_t xs[2 * MP_LV_FLUSH_PLANNER_MAX_AREAS];
+    int32_t ys[2 * MP_LV_FLUSH_PLANNER_MAX_AREAS];
+    uint32_t nx = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (joined[i]) continue;
+        xs[nx++] = areas[i].x1;
+        xs[nx++] = areas[i].x2 + 1;
+    }
+    mp_lv_flush_planner_sort(xs, nx, 1);
+
+    uint64_t covered = 0;
+    for (uint32_t k = 0; k + 1 < nx; k++) {
+        if (xs[k] == xs[k + 1]) continue;
+        uint32_t ny = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (joined[i] || areas[i].x1 > xs[k] || areas[i].x2 < xs[k + 1] - 1) continue;
+            ys[2 * ny] = areas[i].y1;
+            ys[2 * ny + 1] = areas[i].y2 + 1;
+            ny++;
+        }
+        mp_lv_flush_planner_sort(ys, ny, 2);
+        uint32_t height = 0;
+        int32_t end = INT32_MIN;
+        for (uint32_t i = 0; i < ny; i++) {
+            int32_t start = LV_MAX(ys[2 * i], end);
+            if (ys[2 * i + 1] > start) height += ys[2 * i + 1] - start;
+            end = LV_MAX(end, ys[2 * i + 1]);
+        }
+        covered += (uint64_t)height * (xs[k + 1] - xs[k]);
+    }
+    return covered;
+}
+
+STATIC void mp_lv_flush_planner_event_cb(lv_event_t *e)
+{
+    mp_lv_flush_planner_t *self = lv_event_get_user_data(e);
+    lv_disp_t *disp = self->disp;
+    lv_area_t *areas = disp->inv_areas;
+    uint8_t *joined = disp->inv_area_joined;
+    uint32_t n = disp->inv_p;
+    if (n == 0) return;
+
+    uint32_t count = 0, last = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (!joined[i]) {
+            count++;
+            last = i;
+        }
+    }
+    if (count == 0) return;
+    self->frames++;
+    self->areas_in += count;
+    self->dirty_px += mp_lv_flush_planner_covered(areas, joined, n);
+
+    // Merge the pair that saves the most, until no merge saves anything
+
+    for (;;) {
+        int64_t best = 0;
+        uint32_t best_i = 0, best_j = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (joined[i]) continue;
+            uint32_t px_i = mp_lv_flush_planner_px(&areas[i]);
+            for (uint32_t j = i + 1; j < n; j++) {
+                if (joined[j]) continue;
+                lv_area_t merged;
+                mp_lv_flush_planner_bounds(&merged, &areas[i], &areas[j]);
+                int64_t saving = (int64_t)self->overhead + px_i + mp_lv_flush_planner_px(&areas[j]) -
+                    mp_lv_flush_planner_px(&merged);
+                if (saving > best) {
+                    best = saving;
+                    best_i = i;
+                    best_j = j;
+                }
+            }
+        }
+        if (best <= 0) break;
+        mp_lv_flush_planner_bounds(&areas[best_i], &areas[best_i], &areas[best_j]);
+        joined[best_j] = 1;
+        count--;
+        self->merged++;
+    }
+
+    uint64_t sent = 0;
+    uint32_t planned_last = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (joined[i]) continue;
+        sent += mp_lv_flush_planner_px(&areas[i]);
+        planned_last = i;
+    }
+    if (planned_last != last) {
+        // Merges only join areas, so the last slot was joined
+        areas[last] = areas[planned_last];
+        joined[last] = 0;
+        joined[planned_last] = 1;
+    }
+
+    // A single full window write, when it costs less
+
+    lv_coord_t hor_res = lv_disp_get_hor_res(disp);
+    lv_coord_t ver_res = lv_disp_get_ver_res(disp);
+    uint64_t full_px = (uint64_t)hor_res * ver_res;
+    if (self->full && count > 1 && (uint64_t)self->overhead * count + sent >= self->overhead + full_px) {
+        for (uint32_t i = 0; i < n; i++) joined[i] = 1;
+        areas[last].x1 = 0;
+        areas[last].y1 = 0;
+        areas[last].x2 = hor_res - 1;
+        areas[last].y2 = ver_res - 1;
+        joined[last] = 0;
+        self->merged += count - 1;
+        self->full_frames++;
+        count = 1;
+        sent = full_px;
+    }
+
+    self->areas_out += count;
+    self->sent_px += sent;
+}
+
+STATIC bool mp_lv_flush_planner_disp_exists(lv_disp_t *disp)
+{
+    for (lv_disp_t *d = lv_disp_get_next(NULL); d; d = lv_disp_get_next(d)) {
+        if (d == disp) return true;
+    }
+    return false;
+}
+
+STATIC mp_obj_t mp_lv_flush_planner_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args)
+{
+    enum { ARG_disp, ARG_overhead, ARG_full };
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_disp, MP_ARG_OBJ, {.u_rom_obj = MP_ROM_NONE} },
+        { MP_QSTR_overhead, MP_ARG_INT, {.u_int = 200} },
+        { MP_QSTR_full, MP_ARG_BOOL, {.u_bool = true} },
+    };
+    mp_arg_val_t parsed[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all_kw_array(n_args, n_kw, args, MP_ARRAY_SIZE(allowed_args), allowed_args, parsed);
+
+    lv_disp_t *disp = parsed[ARG_disp].u_obj != mp_const_none? mp_to_ptr(parsed[ARG_disp].u_obj): lv_disp_get_default();
+    if (!disp) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_RuntimeError, MP_ERROR_TEXT("No display")));
+    if (parsed[ARG_overhead].u_int < 0) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_ValueError, MP_ERROR_TEXT("overhead must not be negative")));
+
+    mp_lv_flush_planner_t *self = m_new0(mp_lv_flush_planner_t, 1);
+    self->base.type = type;
+    self->disp = disp;
+    self->overhead = parsed[ARG_overhead].u_int;
+    self->full = parsed[ARG_full].u_bool;
+
+    // The event keeps self alive, LVGL memory is scanned by the GC
+    MP_LV_LOCK_BEGIN();
+    lv_disp_add_event(disp, mp_lv_flush_planner_event_cb, LV_EVENT_RENDER_START, self);
+    MP_LV_LOCK_END();
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC mp_obj_t mp_lv_flush_planner_set_overhead(mp_obj_t self_in, mp_obj_t overhead_in)
+{
+    mp_lv_flush_planner_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_int_t overhead = mp_obj_get_int(overhead_in);
+    if (overhead < 0) nlr_raise(
+        mp_obj_new_exception_msg(
+            &mp_type_ValueError, MP_ERROR_TEXT("overhead must not be negative")));
+    self->overhead = overhead;
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(mp_lv_flush_planner_set_overhead_obj, mp_lv_flush_planner_set_overhead);
+
+STATIC mp_obj_t mp_lv_flush_planner_stats(mp_obj_t self_in)
+{
+    mp_lv_flush_planner_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_t stats = mp_obj_new_dict(8);
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_frames), mp_obj_new_int_from_uint(self->frames));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_areas_in), mp_obj_new_int_from_uint(self->areas_in));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_areas_out), mp_obj_new_int_from_uint(self->areas_out));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_merged), mp_obj_new_int_from_uint(self->merged));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_full), mp_obj_new_int_from_uint(self->full_frames));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_dirty_px), mp_obj_new_int_from_ull(self->dirty_px));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_sent_px), mp_obj_new_int_from_ull(self->sent_px));
+    mp_obj_dict_store(stats, MP_OBJ_NEW_QSTR(MP_QSTR_redundant_px), mp_obj_new_int_from_ull(self->sent_px - self->dirty_px));
+    return stats;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_flush_planner_stats_obj, mp_lv_flush_planner_stats);
+
+STATIC mp_obj_t mp_lv_flush_planner_reset(mp_obj_t self_in)
+{
+    mp_lv_flush_planner_t *self = MP_OBJ_TO_PTR(self_in);
+    self->frames = self->areas_in = self->areas_out = self->merged = self->full_frames = 0;
+    self->dirty_px = self->sent_px = 0;
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_flush_planner_reset_obj, mp_lv_flush_planner_reset);
+
+STATIC mp_obj_t mp_lv_flush_planner_deinit(mp_obj_t self_in)
+{
+    mp_lv_flush_planner_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!self->disp) return mp_const_none;
+    MP_LV_LOCK_BEGIN();
+    if (mp_lv_flush_planner_disp_exists(self->disp)) {
+        for (uint32_t i = lv_disp_get_event_count(self->disp); i-- > 0;) {
+            lv_event_dsc_t *dsc = lv_disp_get_event_dsc(self->disp, i);
+            if (lv_event_dsc_get_cb(dsc) == mp_lv_flush_planner_event_cb && lv_event_dsc_get_user_data(dsc) == self) {
+                lv_disp_remove_event(self->disp, i);
+            }
+        }
+    }
+    MP_LV_LOCK_END();
+    self->disp = NULL;
+    return mp_const_none;
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mp_lv_flush_planner_deinit_obj, mp_lv_flush_planner_deinit);
+
+STATIC const mp_rom_map_elem_t mp_lv_flush_planner_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_set_overhead), MP_ROM_PTR(&mp_lv_flush_planner_set_overhead_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stats), MP_ROM_PTR(&mp_lv_flush_planner_stats_obj) },
+    { MP_ROM_QSTR(MP_QSTR_reset), MP_ROM_PTR(&mp_lv_flush_planner_reset_obj) },
+    { MP_ROM_QSTR(MP_QSTR_deinit), MP_ROM_PTR(&mp_lv_flush_planner_deinit_obj) },
+};
+
+STATIC MP_DEFINE_CONST_DICT(mp_lv_flush_planner_locals_dict, mp_lv_flush_planner_locals_dict_table);
+
+STATIC MP_DEFINE_CONST_OBJ_TYPE(
+    mp_lv_flush_planner_type,
+    MP_QSTR_flush_planner,
+    MP_TYPE_FLAG_NONE,
+    make_new, mp_lv_flush_planner_make_new,
+    locals_dict, &mp_lv_flush_planner_locals_dict
+);
+""")
+    extension_globals.append(('flush_planner', '&mp_lv_flush_planner_type'))
+
+# Pixel format conversion kernels, shared with the drivers (driver/include/pixconv.h)
+# (name, source bits per pixel, destination bits per pixel)
+
+pixconv_kernels = [
+    ('rgb565_swap', 16, 16),
+    ('rgb565_swap_rb', 16, 16),
+    ('xrgb8888_swap_rb', 32, 32),
+    ('rgb888_swap_rb', 24, 24),
+    ('xrgb8888_to_rgb888', 32, 24),
+    ('xrgb8888_to_rgb666', 32, 24),
+    ('pack_4bpp', 8, 4),
+]
+
+if has_funcs('lv_init'):
+    print("""
+/*
+ * Pixel format conversion
+ *
+ *   n = lvgl.pixconv.xrgb8888_to_rgb888(dst, src)       # Convert all the pixels in src, returns the number of pixels
+ *   lvgl.pixconv.rgb565_swap(buf, buf, n)               # In place, the first n pixels only
+ *   lvgl.pixconv.pack_1bpp(dst, src, threshold=128)     # Bit set for values >= threshold
+ *   lvgl.pixconv.rotate16(dst, src, w, h, quarter_turns) # Rotate w x h pixels clockwise, dst is h x w for odd turns
+ *
+ * dst and src are buffers. dst may be src, but the buffers must not overlap otherwise.
+ * Rotation by 90 or 270 degrees can't run in place. rotate16 and rotate32 take an optional
+ * tile size after quarter_turns (default PIXCONV_ROTATE_TILE, 1 for a plain pixel by pixel loop).
+ * See driver/include/pixconv.h for the pixel layouts.
+ */
+
+#include "driver/include/pixconv.h"
+
+STATIC size_t mp_lv_pixconv_buffers(size_t n_args, const mp_obj_t *args, size_t src_bits, size_t dst_bits, void **dst, const void **src)
+{
+    mp_buffer_info_t dst_info, src_info;
+    mp_get_buffer_raise(args[0], &dst_info, MP_BUFFER_WRITE);
+    mp_get_buffer_raise(args[1], &src_info, MP_BUFFER_READ);
+    size_t n = src_info.len * 8 / src_bits;
+    if (n_args > 2 && args[2] != mp_const_none) {
+        mp_int_t count = mp_obj_get_int(args[2]);
+        if (count < 0 || (size_t)count > n) nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Pixel count exceeds the source buffer")));
+        n = count;
+    }
+    size_t dst_len = (n * dst_bits + 7) / 8;
+    if (dst_len > dst_info.len) nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Destination buffer too small")));
+    const uint8_t *d = dst_info.buf, *s = src_info.buf;
+    if (d != s && d < s + (n * src_bits + 7) / 8 && s < d + dst_len) {
+        nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Overlapping buffers must start at the same address")));
+    }
+    *dst = dst_info.buf;
+    *src = src_info.buf;
+    return n;
+}
+""")
+    for name, src_bits, dst_bits in pixconv_kernels:
+        print("""
+STATIC mp_obj_t mp_lv_pixconv_{name}(size_t n_args, const mp_obj_t *args)
+{{
+    void *dst;
+    const void *src;
+    size_t n = mp_lv_pixconv_buffers(n_args, args, {src_bits}, {dst_bits}, &dst, &src);
+    pixconv_{name}(dst, src, n);
+    return mp_obj_new_int_from_uint(n);
+}}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_lv_pixconv_{name}_obj, 2, 3, mp_lv_pixconv_{name});
+""".format(name=name, src_bits=src_bits, dst_bits=dst_bits))
+    for bits in (16, 32):
+        print("""
+STATIC mp_obj_t mp_lv_pixconv_rotate{bits}(size_t n_args, const mp_obj_t *args)
+{{
+    mp_buffer_info_t dst_info, src_info;
+    mp_get_buffer_raise(args[0], &dst_info, MP_BUFFER_WRITE);
+    mp_get_buffer_raise(args[1], &src_info, MP_BUFFER_READ);
+    mp_int_t w = mp_obj_get_int(args[2]);
+    mp_int_t h = mp_obj_get_int(args[3]);
+    mp_int_t quarter_turns = mp_obj_get_int(args[4]) & 3;
+    mp_int_t tile = n_args > 5 ? mp_obj_get_int(args[5]) : PIXCONV_ROTATE_TILE;
+    if (w < 0 || h < 0 || tile < 1) nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Invalid size")));
+    size_t len = (size_t)w * h * {bytes};
+    if (len > src_info.len) nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Pixel count exceeds the source buffer")));
+    if (len > dst_info.len) nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Destination buffer too small")));
+    if (((uintptr_t)dst_info.buf | (uintptr_t)src_info.buf) & ({bytes} - 1)) {{
+        nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Buffers must be aligned to the pixel size")));
+    }}
+    const uint8_t *d = dst_info.buf, *s = src_info.buf;
+    if (d < s + len && s < d + len) {{
+        if (quarter_turns & 1) nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Rotation by 90 or 270 degrees needs separate buffers")));
+        if (d != s) nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Overlapping buffers must start at the same address")));
+    }}
+    pixconv_rotate{bits}_tiled(dst_info.buf, src_info.buf, w, h, quarter_turns, tile);
+    return mp_const_none;
+}}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_lv_pixconv_rotate{bits}_obj, 5, 6, mp_lv_pixconv_rotate{bits});
+""".format(bits=bits, bytes=bits // 8))
+    print("""
+STATIC mp_obj_t mp_lv_pixconv_pack_1bpp(size_t n_args, const mp_obj_t *args)
+{
+    void *dst;
+    const void *src;
+    size_t n = mp_lv_pixconv_buffers(2, args, 8, 1, &dst, &src);
+    mp_int_t threshold = n_args > 2 ? mp_obj_get_int(args[2]) : 128;
+    if (threshold < 0 || threshold > 255) nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, MP_ERROR_TEXT("Threshold must be 0..255")));
+    pixconv_pack_1bpp(dst, src, n, threshold);
+    return mp_obj_new_int_from_uint(n);
+}
+
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_lv_pixconv_pack_1bpp_obj, 2, 3, mp_lv_pixconv_pack_1bpp);
+
+STATIC const mp_rom_map_elem_t mp_lv_pixconv_globals_table[] = {
+    { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_pixconv) },
+    { MP_ROM_QSTR(MP_QSTR_pack_1bpp), MP_ROM_PTR(&mp_lv_pixconv_pack_1bpp_obj) },
+    { MP_ROM_QSTR(MP_QSTR_rotate16), MP_ROM_PTR(&mp_lv_pixconv_rotate16_obj) },
+    { MP_ROM_QSTR(MP_QSTR_rotate32), MP_ROM_PTR(&mp_lv_pixconv_rotate32_obj) },
+    %s
+    { MP_ROM_QSTR(MP_QSTR_WORD), MP_ROM_INT(PIXCONV_WORD) },
+    { MP_ROM_QSTR(MP_QSTR_ROTATE_TILE), MP_ROM_INT(PIXCONV_ROTATE_TILE) },
+};
+
+STATIC MP_DEFINE_CONST_DICT(mp_lv_pixconv_globals, mp_lv_pixconv_globals_table);
+
+STATIC const mp_obj_module_t mp_lv_pixconv_module = {
+    .base = { &mp_type_module },
+    .globals = (mp_obj_dict_t *)&mp_lv_pixconv_globals,
+};
+""" % '\n    '.join('{ MP_ROM_QSTR(MP_QSTR_%s), MP_ROM_PTR(&mp_lv_pixconv_%s_obj) },' % (name, name)
+        for name, src_bits, dst_bits in pixconv_kernels))
+    extension_globals.append(('pixconv', '&mp_lv_pixconv_module'))
+
+# TICK_CUSTOM is set when LVGL reads the tick from a clock (e.g. mp_hal_ticks_ms, see lv_conf.h).
+# lv.tick_inc doesn't exist in that case.
+extension_globals.append(('TICK_CUSTOM', 'MP_ROM_INT(LV_TICK_CUSTOM)', 'defined(LV_TICK_CUSTOM)'))
 
 #
 # Emit Mpy Module definition
@@ -2891,6 +7439,7 @@ STATIC const mp_rom_map_elem_t {module_name}_globals_table[] = {{
     {struct_aliases}
     {blobs}
     {int_constants}
+    {extensions}
 #ifdef LV_OBJ_T
     {{ MP_ROM_QSTR(MP_QSTR_LvReferenceError), MP_ROM_PTR(&mp_type_LvReferenceError) }},
 #endif // LV_OBJ_T
@@ -2911,7 +7460,10 @@ STATIC const mp_rom_map_elem_t {module_name}_globals_table[] = {{
         blobs = ''.join(['{{ MP_ROM_QSTR(MP_QSTR_{name}), MP_ROM_PTR(&mp_{global_name}) }},\n    '.
             format(name = sanitize(simplify_identifier(global_name)), global_name = global_name) for global_name in generated_globals]),
         int_constants = ''.join(['{{ MP_ROM_QSTR(MP_QSTR_{name}), MP_ROM_PTR(MP_ROM_INT({value})) }},\n    '.
-            format(name = sanitize(get_enum_name(int_constant)), value = int_constant) for int_constant in int_constants])))
+            format(name = sanitize(get_enum_name(int_constant)), value = int_constant) for int_constant in int_constants]),
+        extensions = ''.join([('#if {cond}\n    {entry}\n#endif\n    ' if len(ext) > 2 else '{entry}\n    ').
+            format(entry = '{{ MP_ROM_QSTR(MP_QSTR_{name}), MP_ROM_PTR({obj}) }},'.format(name = ext[0], obj = ext[1]),
+                cond = ext[2] if len(ext) > 2 else None) for ext in extension_globals])))
 
 
 print("""
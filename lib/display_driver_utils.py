@@ -3,6 +3,11 @@ sys.path.append('') # See: https://github.com/micropython/micropython/issues/641
 
 import lvgl as lv
 
+try:
+    import uos as os
+except:
+    os = None
+
 try:
     import lv_utils
     lv_utils_available = True
@@ -14,7 +19,7 @@ ORIENT_PORTRAIT  = True
 
 class driver:
     
-    def __init__(self,width=420,height=320,orientation=ORIENT_PORTRAIT, asynchronous=False, exception_sink=None, defaultGroup=True):
+    def __init__(self,width=420,height=320,orientation=ORIENT_PORTRAIT, asynchronous=False, exception_sink=None, defaultGroup=True, headless=None):
 
         if not lv.is_initialized():
             lv.init()
@@ -28,6 +33,8 @@ class driver:
         self.orientation = orientation
         self.asynchronous = asynchronous
         self.exception_sink = exception_sink
+        # headless=None: only when LV_HEADLESS is set in the environment, or when no other display is available
+        self.headless = headless if headless is not None else bool(os and hasattr(os, 'getenv') and os.getenv('LV_HEADLESS'))
         self.disp = None
         self.touch = None
         self.type = None
@@ -44,6 +51,15 @@ class driver:
         self.keyboard.set_group(self.group)
         self.type = "SDL"
         print("Running the SDL lvgl version")
+
+    def init_gui_headless(self):
+        if lv_utils_available and not lv_utils.event_loop.is_running():
+            self.event_loop = lv_utils.event_loop(asynchronous=self.asynchronous, exception_sink=self.exception_sink)
+
+        # Renders into a RAM framebuffer. No input devices
+        self.disp = lv.headless(self.width, self.height)
+        self.type = "headless"
+        print("Running the headless lvgl version")
         
     def init_gui_ili9341(self):
 
@@ -116,6 +132,10 @@ class driver:
         
         # Identify platform and initialize it
 
+        if self.headless:
+            self.init_gui_headless()
+            return
+
         try:
             self.init_gui_twatch()
             return
@@ -128,11 +148,14 @@ class driver:
         except ImportError:
             pass
             
-        try:
+        # Only a missing SDL driver falls through. Errors raised by SDL itself propagate
+        if hasattr(lv, 'sdl_window_create'):
             self.init_gui_SDL()
             return
-        except ImportError:
-            pass
+
+        if hasattr(lv, 'headless'):
+            self.init_gui_headless()
+            return
 
         raise RuntimeError("Could not find a suitable display driver!")
 
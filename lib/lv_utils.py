@@ -26,6 +26,28 @@
 #        self.disp = ili9341(asynchronous=True)
 #        uasyncio.Loop.run_forever()
 #
+# When the lvgl module provides lv.event_loop (a native, deadline driven loop),
+# the event loop sleeps until the next lvgl timer is due (up to max_delay ms)
+# instead of running at a fixed frequency. The asynchronous event loop sleeps
+# in a uasyncio task (async_timer) for that.
+# It wakes up early when the display is invalidated, or when wake() is called.
+# Pass deadline=False to run at a fixed frequency (freq) instead.
+#
+# On the unix port, pass threaded=True to run lvgl on its own thread
+# (lv.render_thread), so rendering doesn't block Python code. lvgl calls
+# from Python take a lock, and Python callbacks still run on a Python thread.
+#
+# Pass a governor (lv_utils.governor) to lower the refresh rate while the
+# screen is idle. Drivers can register callbacks on the governor, to lower SPI
+# clocks or dim the backlight when the state changes:
+#
+#        gov = lv_utils.governor(idle_after=5000, sleep_after=60000)
+#        gov.add_callback(lambda state: backlight.set(state != gov.SLEEP))
+#        event_loop = lv_utils.event_loop(governor=gov)
+#
+# When lvgl reads the tick from the port clock (lv.TICK_CUSTOM, see
+# lv_conf.h), the event loop doesn't call lv.tick_inc.
+#
 # MIT license; Copyright (c) 2021 Amir Gonnen
 #
 ##############################################################################
@@ -63,13 +85,25 @@ try:
 except:
     uasyncio_available = False
 
+# Does lvgl read the tick from a clock, or does it need lv.tick_inc?
+
+tick_custom = getattr(lv, 'TICK_CUSTOM', 0)
+
+# Callbacks wrapped with lv.deferred are queued, and run after the task handler
+
+run_deferred = getattr(lv, 'run_deferred', None)
+
+# Run the task handler through lv.telemetry when available, so it can record the handler time of each frame
+
+task_handler = lv.telemetry.timer_handler if hasattr(lv, 'telemetry') else lv.task_handler
+
 ##############################################################################
 
 class event_loop():
 
     _current_instance = None
 
-    def __init__(self, freq=25, timer_id=default_timer_id, max_scheduled=2, refresh_cb=None, asynchronous=False, exception_sink=None):
+    def __init__(self, freq=25, timer_id=default_timer_id, max_scheduled=2, refresh_cb=None, asynchronous=False, exception_sink=None, deadline=True, max_delay=500, threaded=False, governor=None):
         if self.is_running():
             raise RuntimeError("Event loop is already running!")
 
@@ -83,9 +117,20 @@ class event_loop():
         self.exception_sink = exception_sink if exception_sink else self.default_exception_sink
 
         self.asynchronous = asynchronous
-        if self.asynchronous:
-            if not uasyncio_available:
-                raise RuntimeError("Cannot run asynchronous event loop. uasyncio is not available!")
+        self.threaded = threaded and not asynchronous
+        if self.threaded and not hasattr(lv, 'render_thread'):
+            raise RuntimeError("Cannot run threaded event loop. lv.render_thread is not available!")
+        self.deadline = deadline and not self.threaded and hasattr(lv, 'event_loop')
+        if self.asynchronous and not uasyncio_available:
+            raise RuntimeError("Cannot run asynchronous event loop. uasyncio is not available!")
+        if self.threaded:
+            if refresh_cb:
+                raise ValueError("refresh_cb is not supported by the threaded event loop")
+            self.loop = lv.render_thread(max_delay, exception_sink=self.exception_sink)
+        elif self.deadline:
+            timer = async_timer() if self.asynchronous else Timer(timer_id)
+            self.loop = lv.event_loop(timer, max_delay, refresh_cb=refresh_cb, exception_sink=self.exception_sink)
+        elif self.asynchronous:
             self.refresh_event = uasyncio.Event()
             self.refresh_task = uasyncio.create_task(self.async_refresh())
             self.timer_task = uasyncio.create_task(self.async_timer())
@@ -96,8 +141,16 @@ class event_loop():
             self.max_scheduled = max_scheduled
             self.scheduled = 0
 
+        self.governor = governor
+        if governor:
+            governor.attach(self)
+
     def deinit(self):
-        if self.asynchronous:
+        if self.governor:
+            self.governor.detach()
+        if self.threaded or self.deadline:
+            self.loop.deinit()
+        elif self.asynchronous:
             self.refresh_task.cancel()
             self.timer_task.cancel()
         else:
@@ -105,10 +158,30 @@ class event_loop():
         event_loop._current_instance = None
 
     def disable(self):
-        self.scheduled += self.max_scheduled
+        if self.threaded or self.deadline:
+            self.loop.disable()
+        else:
+            self.scheduled += self.max_scheduled
 
     def enable(self):
-        self.scheduled -= self.max_scheduled
+        if self.threaded or self.deadline:
+            self.loop.enable()
+        else:
+            self.scheduled -= self.max_scheduled
+
+    def wake(self):
+        # Run the task handler as soon as possible. Can be called in Interrupt context.
+        if self.threaded or self.deadline:
+            self.loop.wake()
+        elif self.asynchronous:
+            self.refresh_event.set()
+
+    def set_period(self, period):
+        # Change the period of the fixed frequency and asynchronous loops.
+        # The deadline driven loops follow the lvgl timers instead.
+        self.delay = period
+        if not (self.threaded or self.deadline or self.asynchronous):
+            self.timer.init(mode=Timer.PERIODIC, period=period, callback=self.timer_cb)
 
     @staticmethod
     def is_running():
@@ -121,7 +194,8 @@ class event_loop():
     def task_handler(self, _):
         try:
             if lv._nesting.value == 0:
-                lv.task_handler()
+                task_handler()
+                if run_deferred: run_deferred()
                 if self.refresh_cb: self.refresh_cb()
             self.scheduled -= 1
         except Exception as e:
@@ -131,7 +205,7 @@ class event_loop():
     def timer_cb(self, t):
         # Can be called in Interrupt context
         # Use task_handler_ref since passing self.task_handler would cause allocation.
-        lv.tick_inc(self.delay)
+        if not tick_custom: lv.tick_inc(self.delay)
         if self.scheduled < self.max_scheduled:
             try:
                 micropython.schedule(self.task_handler_ref, 0)
@@ -145,7 +219,8 @@ class event_loop():
             if lv._nesting.value == 0:
                 self.refresh_event.clear()
                 try:
-                    lv.task_handler()
+                    task_handler()
+                    if run_deferred: run_deferred()
                 except Exception as e:
                     if self.exception_sink:
                         self.exception_sink(e)
@@ -154,10 +229,169 @@ class event_loop():
     async def async_timer(self):
         while True:
             await uasyncio.sleep_ms(self.delay)
-            lv.tick_inc(self.delay)
+            if not tick_custom: lv.tick_inc(self.delay)
             self.refresh_event.set()
             
 
     def default_exception_sink(self, e):
         usys.print_exception(e)
         event_loop.current_instance().deinit()
+
+##############################################################################
+# machine.Timer compatible timer that runs on uasyncio.
+# lv.event_loop re-arms it with the time until the next lvgl timer is due, so
+# the asynchronous event loop sleeps until then instead of polling.
+# The callback runs in the task, not in interrupt context.
+##############################################################################
+
+class async_timer():
+
+    ONE_SHOT = 0
+    PERIODIC = 1
+
+    def __init__(self):
+        self.task = None
+
+    def init(self, mode=PERIODIC, period=-1, callback=None):
+        self.deinit()
+        self.mode = mode
+        self.period = period
+        self.callback = callback
+        self.task = uasyncio.create_task(self.run())
+
+    def deinit(self):
+        task = self.task
+        self.task = None
+        if task:
+            try:
+                task.cancel()
+            except RuntimeError:
+                pass # Called from the task itself (e.g. from the callback). It stops after the callback returns
+
+    async def run(self):
+        task = self.task
+        while True:
+            await uasyncio.sleep_ms(self.period)
+            if self.task is not task:
+                break
+            self.callback(self)
+            if self.task is not task or self.mode != async_timer.PERIODIC:
+                break
+
+##############################################################################
+# Idle-aware governor for the event loop.
+#
+# Samples the display inactivity time (lv.disp_get_inactive_time, reset by
+# input) and rendering activity every sample_period ms, from an lvgl timer:
+# - ACTIVE: input or rendering in the last idle_after ms. Full rate.
+# - IDLE: nothing for idle_after ms. The display refresh and input read timers,
+#   and the fixed frequency event loop, run every idle_period ms.
+# - SLEEP: nothing for sleep_after ms. They run every sleep_period ms.
+# Input or a rendered frame (an animation, or a change made by the
+# application) returns to ACTIVE on the next sample. The sampling rate doesn't
+# change with the state, so leaving SLEEP takes up to sleep_period ms (the
+# input read timer) plus sample_period ms.
+#
+# Callbacks registered with add_callback(cb) are called with the new state on
+# each change, from the lvgl task handler.
+#
+##############################################################################
+
+class governor():
+
+    ACTIVE = 0
+    IDLE = 1
+    SLEEP = 2
+
+    def __init__(self, disp=None, idle_after=5000, sleep_after=60000, idle_period=100, sleep_period=500, sample_period=100):
+        self.disp = disp
+        self.idle_after = idle_after
+        self.sleep_after = sleep_after
+        self.periods = (0, idle_period, sleep_period)
+        self.sample_period = sample_period
+        self.state = governor.ACTIVE
+        self.callbacks = []
+        self.loop = None
+        self.timer = None
+        self.hooked = None
+        self.event_user_data = None
+        self.rendered = False
+        self.last_render = 0
+        self.saved = None
+
+    def add_callback(self, cb):
+        self.callbacks.append(cb)
+
+    def remove_callback(self, cb):
+        self.callbacks.remove(cb)
+
+    def attach(self, loop):
+        self.loop = loop
+        self.loop_period = loop.delay
+        self.last_render = lv.tick_get()
+        if not self.hooked:
+            disp = self.disp if self.disp else lv.disp_get_default()
+            if disp:
+                # Python callbacks share the same C callback, so the event is told apart by the
+                # callback dict the binding passes as its user_data
+                disp.add_event(self.render_cb, lv.EVENT.RENDER_START, None)
+                self.event_user_data = disp.get_event_dsc(disp.get_event_count() - 1).get_user_data()
+                self.hooked = disp
+        self.timer = lv.timer_create(self.sample, self.sample_period, None)
+
+    def detach(self):
+        if not self.loop:
+            return
+        self.set_state(governor.ACTIVE)
+        self.timer._del()
+        self.timer = None
+        if self.hooked:
+            for i in range(self.hooked.get_event_count() - 1, -1, -1):
+                if self.hooked.get_event_dsc(i).get_user_data() == self.event_user_data:
+                    self.hooked.remove_event(i)
+                    break
+            self.hooked = None
+            self.event_user_data = None
+        self.loop = None
+
+    def render_cb(self, e):
+        self.rendered = True
+
+    def sample(self, timer):
+        if self.rendered:
+            self.rendered = False
+            self.last_render = lv.tick_get()
+        quiet = min(lv.disp_get_inactive_time(self.disp), lv.tick_elaps(self.last_render))
+        if quiet < self.idle_after:
+            state = governor.ACTIVE
+        elif quiet < self.sleep_after:
+            state = governor.IDLE
+        else:
+            state = governor.SLEEP
+        if state != self.state:
+            self.set_state(state)
+
+    def set_state(self, state):
+        if state == self.state:
+            return
+        period = self.periods[state]
+        if self.saved is None:
+            # Remember the full rate periods of the refresh and input read timers
+            self.saved = []
+            disp = lv.disp_get_next(None)
+            while disp:
+                self.saved.append((disp.refr_timer, disp.refr_timer.period))
+                disp = lv.disp_get_next(disp)
+            indev = lv.indev_get_next(None)
+            while indev:
+                self.saved.append((indev.get_read_timer(), indev.get_read_timer().period))
+                indev = lv.indev_get_next(indev)
+        for timer, saved_period in self.saved:
+            timer.set_period(max(saved_period, period))
+        if state == governor.ACTIVE:
+            self.saved = None
+        if self.loop:
+            self.loop.set_period(max(self.loop_period, period))
+        self.state = state
+        for cb in self.callbacks:
+            cb(state)
@@ -94,11 +94,17 @@
 #define LV_DEF_REFR_PERIOD  33      /*[ms]*/
 
 /*Use a custom tick source that tells the elapsed time in milliseconds.
- *It removes the need to manually update the tick with `lv_tick_inc()`)*/
+ *It removes the need to manually update the tick with `lv_tick_inc()`)
+ *Ports that build LVGL with the MicroPython headers can define LV_TICK_CUSTOM 1 to use the port clock
+ *(mp_hal_ticks_ms), as bindings.cmake does.*/
+#ifndef LV_TICK_CUSTOM
 #define LV_TICK_CUSTOM 0
+#endif
 #if LV_TICK_CUSTOM
-    #define LV_TICK_CUSTOM_INCLUDE "Arduino.h"         /*Header for the system time function*/
-    #define LV_TICK_CUSTOM_SYS_TIME_EXPR (millis())    /*Expression evaluating to current system time in ms*/
+#ifndef LV_TICK_CUSTOM_INCLUDE
+    #define LV_TICK_CUSTOM_INCLUDE "py/mphal.h"                 /*Header for the system time function*/
+    #define LV_TICK_CUSTOM_SYS_TIME_EXPR (mp_hal_ticks_ms())    /*Expression evaluating to current system time in ms*/
+#endif
     /*If using lvgl as ESP32 component*/
     // #define LV_TICK_CUSTOM_INCLUDE "esp_timer.h"
     // #define LV_TICK_CUSTOM_SYS_TIME_EXPR ((esp_timer_get_time() / 1000LL))
@@ -94,7 +94,9 @@ function(all_lv_bindings)
 
     # LVGL bindings
 
+    # LV_MP_DEFINITIONS are the definitions lvgl and the module are compiled with (see bindings.cmake)
     file(GLOB_RECURSE LVGL_HEADERS ${LVGL_DIR}/src/*.h ${LV_BINDINGS_DIR}/lv_conf.h)
+    list(TRANSFORM LV_MP_DEFINITIONS PREPEND -D OUTPUT_VARIABLE LV_MP_PP_OPTIONS)
     lv_bindings(
         OUTPUT
             ${LV_MP}
@@ -102,6 +104,8 @@ function(all_lv_bindings)
             ${LVGL_DIR}/lvgl.h
         DEPENDS
             ${LVGL_HEADERS}
+        PP_OPTIONS
+            ${LV_MP_PP_OPTIONS}
         GEN_OPTIONS
             -M lvgl -MP lv
     )
@@ -0,0 +1,61 @@
+##############################################################################
+# Benchmark lv.batch
+#
+# Build the pages of examples/advanced_demo.py with and without lv.batch,
+# and measure the time it takes to build them and render them once.
+#
+# Usage (unix port):
+#   micropython tests/bench_batch.py [iterations]
+#
+##############################################################################
+
+import usys
+script_path = usys.argv[0][:usys.argv[0].rfind('/')] if usys.argv[0].find('/') >= 0 else '.'
+usys.path.append(script_path + '/../examples')
+
+import gc
+import time
+import lvgl as lv
+
+import advanced_demo # Initializes LVGL and the display, and loads the demo screen
+
+ITERATIONS = int(usys.argv[1]) if len(usys.argv) > 1 else 10
+
+def build_pages(screen):
+    app = advanced_demo.app
+    tabview = lv.tabview(screen, lv.DIR.TOP, 20)
+    advanced_demo.Page_Simple(app, tabview.add_tab("Simple"))
+    advanced_demo.Page_Buttons(app, tabview.add_tab("Buttons"))
+    advanced_demo.Page_Text(app, tabview.add_tab("Text"))
+    advanced_demo.Page_Chart(app, tabview.add_tab("Chart"))
+
+def measure(batched):
+    gc.collect()
+    main_screen = lv.scr_act()
+    start = time.ticks_us()
+    screen = lv.obj()
+    if batched:
+        with lv.batch(screen):
+            build_pages(screen)
+    else:
+        build_pages(screen)
+    built = time.ticks_us()
+    lv.scr_load(screen)
+    lv.refr_now(None)
+    rendered = time.ticks_us()
+    lv.scr_load(main_screen)
+    screen.delete()
+    return time.ticks_diff(built, start), time.ticks_diff(rendered, start)
+
+def run(batched):
+    build_total = 0
+    total = 0
+    for i in range(ITERATIONS):
+        build_time, total_time = measure(batched)
+        build_total += build_time
+        total += total_time
+    print('%-16s build: %8d us   build+render: %8d us' % (
+        'with batch' if batched else 'without batch', build_total // ITERATIONS, total // ITERATIONS))
+
+run(False)
+run(True)
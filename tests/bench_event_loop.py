@@ -0,0 +1,87 @@
+##############################################################################
+# Benchmark lv_utils.event_loop
+#
+# Compare the fixed frequency event loop with the deadline driven one
+# (lv.event_loop). For each loop, measure:
+# - Wakeups per second while the UI is idle
+# - Latency from changing a label until the display starts rendering it
+# Exits with an error when the deadline driven loop doesn't wake up less
+# often than the fixed frequency one while idle.
+#
+# Renders on a headless display, so no SDL is needed.
+# It has not been run yet, so there are no recorded numbers to compare with.
+#
+# Usage (unix port):
+#   micropython tests/bench_event_loop.py [seconds]
+#
+##############################################################################
+
+import usys
+usys.path.append('') # See: https://github.com/micropython/micropython/issues/6419
+
+import time
+import lvgl as lv
+import lv_utils
+
+SECONDS = int(usys.argv[1]) if len(usys.argv) > 1 else 5
+CHANGES = 50
+
+lv.init()
+hd = lv.headless(480, 320)
+disp = hd.get_disp()
+label = lv.label(lv.scr_act())
+label.center()
+
+class Stats:
+    def __init__(self):
+        self.wakeups = 0
+        self.rendered = None
+
+    def refresh_cb(self):
+        self.wakeups += 1
+
+    def render_cb(self, e):
+        if self.rendered is None:
+            self.rendered = time.ticks_us()
+
+stats = Stats()
+disp.add_event(stats.render_cb, lv.EVENT.RENDER_START, None)
+
+def wait_ms(ms):
+    # Let scheduled callbacks run
+    deadline = time.ticks_add(time.ticks_ms(), ms)
+    while time.ticks_diff(deadline, time.ticks_ms()) > 0:
+        time.sleep_ms(1)
+
+def run(deadline):
+    event_loop = lv_utils.event_loop(refresh_cb=stats.refresh_cb, deadline=deadline)
+    wait_ms(200) # Let the first frame render
+
+    stats.wakeups = 0
+    wait_ms(SECONDS * 1000)
+    idle_wakeups = stats.wakeups * 1000 // (SECONDS * 1000)
+
+    total = 0
+    worst = 0
+    for i in range(CHANGES):
+        wait_ms(20 + (i * 7) % 40) # Change the label at different phases of the loop
+        stats.rendered = None
+        start = time.ticks_us()
+        label.set_text(str(i))
+        while stats.rendered is None and time.ticks_diff(time.ticks_us(), start) < 1000000:
+            time.sleep_ms(1)
+        latency = time.ticks_diff(stats.rendered if stats.rendered is not None else time.ticks_us(), start)
+        total += latency
+        worst = max(worst, latency)
+
+    event_loop.deinit()
+    print('%-16s idle wakeups/s: %4d   latency avg: %6d us   max: %6d us' % (
+        'deadline' if event_loop.deadline else 'fixed frequency', idle_wakeups, total // CHANGES, worst))
+    return idle_wakeups
+
+fixed = run(False)
+deadline = run(True)
+hd.deinit()
+if deadline >= fixed:
+    print('FAILED: the deadline driven loop is not idle')
+    usys.exit(1)
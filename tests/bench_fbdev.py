@@ -0,0 +1,68 @@
+##############################################################################
+# Check and benchmark the direct framebuffer display (lvgl.fbdev)
+#
+# Runs lvgl.fbdev on a file-backed stand-in framebuffer in DIRECT and FULL
+# render modes, single and double buffered, and moves a box every frame.
+# Measures the wall time per frame, and compares it with lvgl.headless in
+# PARTIAL mode, which renders into a draw buffer and copies it into the
+# framebuffer like lv.linux_fbdev_create() does.
+# Then checks that double buffered displays flip once per frame, and that the
+# page on screen holds the same pixels as a headless display rendering the
+# same screen.
+#
+# Usage (unix port):
+#   micropython tests/bench_fbdev.py [path] [frames]
+#
+##############################################################################
+
+import usys
+usys.path.append('') # See: https://github.com/micropython/micropython/issues/6419
+
+import time
+import lvgl as lv
+from bench_utils import scene
+
+PATH = usys.argv[1] if len(usys.argv) > 1 else '/tmp/lv_fbdev.raw'
+FRAMES = int(usys.argv[2]) if len(usys.argv) > 2 else 50
+WIDTH, HEIGHT = 480, 320
+
+lv.init()
+
+def move(box, i):
+    box.set_pos((i * 13) % (WIDTH - 80), (i * 7) % (HEIGHT - 60))
+
+def run(disp):
+    scr, box = scene(disp, (80, 60), 'lvgl.fbdev')
+    lv.refr_now(disp)
+    start = time.ticks_us()
+    for i in range(FRAMES):
+        move(box, i)
+        lv.refr_now(disp)
+    return time.ticks_diff(time.ticks_us(), start) // FRAMES
+
+# Reference: the last frame, rendered by a headless display
+
+ref = lv.headless(WIDTH, HEIGHT, render_mode=lv.DISP_RENDER_MODE.PARTIAL)
+us = run(ref.get_disp())
+expected = bytes(ref)
+ref.deinit()
+print('%-22s %6d us per frame (copies every frame)' % ('headless PARTIAL', us))
+
+failures = 0
+for mode_name, mode in (('DIRECT', lv.DISP_RENDER_MODE.DIRECT), ('FULL', lv.DISP_RENDER_MODE.FULL)):
+    for double_buffer in (False, True):
+        name = '%s %s' % (mode_name, 'double' if double_buffer else 'single')
+        fb = lv.fbdev(PATH, render_mode=mode, double_buffer=double_buffer, width=WIDTH, height=HEIGHT)
+        us = run(fb.get_disp())
+        stats = fb.stats()
+        errors = []
+        if double_buffer and stats['flips'] != FRAMES + 1:
+            errors.append('%d flips' % stats['flips'])
+        if bytes(fb.displayed()) != expected:
+            errors.append('screen differs')
+        fb.deinit()
+        failures += len(errors)
+        print('fbdev %-16s %6d us per frame   flushes: %5d   flips: %4d   %s' % (
+            name, us, stats['flushes'], stats['flips'], 'FAILED: ' + ', '.join(errors) if errors else 'OK'))
+
+usys.exit(1 if failures else 0)
@@ -0,0 +1,61 @@
+##############################################################################
+# Benchmark the flush planner (lvgl.flush_planner) on the virtual SPI LCD
+#
+# Runs the generic st77xx driver (St7789, 240x320) against lv_spi_lcd, and
+# moves a number of small boxes every frame, so each frame has many small
+# dirty areas. Measures per frame, without and with the planner:
+# - Wall time (LVGL rendering + driver + decoding)
+# - Modeled SPI bus time, bytes and transactions
+# Then prints the planner statistics, and checks that the planned frames end
+# with the same screen as the direct ones.
+#
+# Usage (unix port, with driver/generic and driver/linux in MICROPYPATH):
+#   micropython tests/bench_flush_planner.py [overhead] [boxes] [frames]
+#
+##############################################################################
+
+import usys
+usys.path.append('') # See: https://github.com/micropython/micropython/issues/6419
+
+import time
+import lvgl as lv
+from bench_utils import solid_box, st7789
+
+OVERHEAD = int(usys.argv[1]) if len(usys.argv) > 1 else 200
+BOXES = int(usys.argv[2]) if len(usys.argv) > 2 else 12
+FRAMES = int(usys.argv[3]) if len(usys.argv) > 3 else 20
+WIDTH, HEIGHT = 240, 320
+
+lcd, drv = st7789(WIDTH, HEIGHT)
+
+scr = lv.scr_act()
+scr.set_style_bg_color(lv.color_hex(0x000000), 0)
+boxes = [solid_box(scr, 0x00FF00, 8, 8) for i in range(BOXES)]
+lv.refr_now(None)
+
+def run(name):
+    lcd.reset_stats()
+    start = time.ticks_us()
+    for f in range(FRAMES):
+        for i, box in enumerate(boxes):
+            box.set_pos((i * 37 + f * 3) % (WIDTH - 8), (i * 53 + f * 2) % (HEIGHT - 8))
+        lv.refr_now(None)
+    wall = time.ticks_diff(time.ticks_us(), start)
+    print('%-8s wall: %6d us   bus: %6d us   bytes: %6d   transactions: %4d   (per frame)' % (
+        name, wall // FRAMES, int(lcd.transfer_us) // FRAMES, lcd.bytes // FRAMES, lcd.transactions // FRAMES))
+
+run('direct')
+direct = bytes(lcd.fb)
+planner = lv.flush_planner(overhead=OVERHEAD)
+run('planned')
+stats = planner.stats()
+planner.deinit()
+print('Planner (overhead %d px): %d areas -> %d, %d merged, %d full window frames' % (
+    OVERHEAD, stats['areas_in'], stats['areas_out'], stats['merged'], stats['full']))
+print('Pixels: %d dirty, %d sent, %d redundant' % (stats['dirty_px'], stats['sent_px'], stats['redundant_px']))
+
+# Both runs end with the boxes at the same positions
+same = bytes(lcd.fb) == direct
+print('Screen check:', 'OK' if same else 'FAILED')
+
+usys.exit(0 if same else 1)
@@ -0,0 +1,104 @@
+##############################################################################
+# Benchmark display flush paths with a recorded flush trace (lvgl.flush_trace)
+#
+# Records the flushes of a headless display while a box moves around the
+# screen, with and without payload, into a trace file. Then replays the trace
+# at full speed into:
+# - headless displays in PARTIAL and DIRECT render modes
+# - lvgl.fbdev on a file-backed stand-in framebuffer (unix port)
+# - the generic st77xx driver on the virtual SPI LCD controller (lv_spi_lcd)
+# and measures per flush the wall time and the time in flush_cb (including
+# waiting for flush ready). Every target gets the same areas, in the same
+# order, with the same pixels. The screens of the headless and fbdev targets
+# are checked against the recorded display.
+# Finally replays in real time, and compares the duration with the recording.
+#
+# The trace can be copied to a device and replayed into its display, e.g.
+#   lv.flush_trace.replay(open('lv_flush.trace', 'rb'))
+# to compare the esp32 C flush path of ili9XXX (hybrid=True) with the Python one.
+#
+# Usage (unix port, with driver/generic and driver/linux in MICROPYPATH):
+#   micropython tests/bench_flush_trace.py [trace] [frames]
+#
+##############################################################################
+
+import usys
+usys.path.append('') # See: https://github.com/micropython/micropython/issues/6419
+
+import io
+import time
+import lvgl as lv
+from bench_utils import scene, st7789
+
+PATH = usys.argv[1] if len(usys.argv) > 1 else '/tmp/lv_flush.trace'
+FRAMES = int(usys.argv[2]) if len(usys.argv) > 2 else 50
+WIDTH, HEIGHT = 240, 320
+
+lv.init()
+
+def record(path, payload):
+    ref = lv.headless(WIDTH, HEIGHT, render_mode=lv.DISP_RENDER_MODE.PARTIAL)
+    disp = ref.get_disp()
+    scr, box = scene(disp, (60, 40), 'lvgl.flush_trace')
+    with open(path, 'wb') as f:
+        lv.flush_trace.record(f, disp, payload=payload)
+        start = time.ticks_us()
+        lv.refr_now(disp)
+        for i in range(FRAMES):
+            box.set_pos((i * 13) % (WIDTH - 60), (i * 7) % (HEIGHT - 40))
+            lv.refr_now(disp)
+        us = time.ticks_diff(time.ticks_us(), start)
+        flushes = lv.flush_trace.stop()
+    screen = bytes(ref)
+    ref.deinit()
+    with open(path, 'rb') as f:
+        trace = f.read()
+    return flushes, us, screen, trace
+
+flushes, us, expected, trace = record(PATH + '.hash', False)
+print('Hash only trace: %d flushes, %d bytes' % (flushes, len(trace)))
+flushes, us, expected, trace = record(PATH, True)
+print('Payload trace:   %d flushes, %d bytes, recorded in %d us' % (flushes, len(trace), us))
+
+failures = 0
+
+def replay(name, disp, screen=None, realtime=False, **kw):
+    # The trace is replayed from RAM, so that reading the file is not measured
+    global failures
+    stats = lv.flush_trace.replay(io.BytesIO(trace), disp, realtime=realtime, **kw)
+    errors = []
+    if stats['flushes'] != flushes:
+        errors.append('%d flushes' % stats['flushes'])
+    if screen is not None and bytes(screen()) != expected:
+        errors.append('screen differs')
+    failures += len(errors)
+    n = max(1, stats['flushes'])
+    print('%-18s %6d us per flush   in flush_cb: %6d us   %6.2f Mpx/s   %s' % (
+        name, stats['us'] // n, stats['flush_us'] // n, stats['pixels'] / max(1, stats['flush_us']),
+        'FAILED: ' + ', '.join(errors) if errors else 'OK'))
+    return stats
+
+for mode_name, mode in (('PARTIAL', lv.DISP_RENDER_MODE.PARTIAL), ('DIRECT', lv.DISP_RENDER_MODE.DIRECT)):
+    hd = lv.headless(WIDTH, HEIGHT, render_mode=mode)
+    replay('headless ' + mode_name, hd.get_disp(), lambda: hd)
+    hd.deinit()
+
+if hasattr(lv, 'fbdev'):
+    fb = lv.fbdev(PATH + '.fb', render_mode=lv.DISP_RENDER_MODE.DIRECT, double_buffer=False, width=WIDTH, height=HEIGHT)
+    replay('fbdev DIRECT', fb.get_disp(), fb.displayed)
+    fb.deinit()
+
+hd = lv.headless(WIDTH, HEIGHT, render_mode=lv.DISP_RENDER_MODE.PARTIAL)
+stats = replay('headless realtime', hd.get_disp(), lambda: hd, realtime=True)
+print('%-18s %6d us, recorded %d us' % ('', stats['us'], stats['recorded_us']))
+hd.deinit()
+
+# st77xx through the virtual SPI LCD controller: its own display, and its flush in Python
+
+lcd, drv = st7789(WIDTH, HEIGHT)
+lcd.reset_stats()
+replay('st77xx lv_spi_lcd', drv.disp_drv)
+print('%-18s bus: %6d us per flush at 40 MHz' % ('', int(lcd.transfer_us) // max(1, flushes)))
+
+print('Replay check:', 'OK' if failures == 0 else 'FAILED (%d)' % failures)
+usys.exit(1 if failures else 0)
@@ -0,0 +1,78 @@
+##############################################################################
+# Benchmark lv_utils.governor
+#
+# Run an idle UI with and without the governor, and measure for each:
+# - Wakeups (task handler runs) per idle minute
+# - CPU time per idle minute
+# The governor is configured to go idle after 1 second and sleep after 3,
+# so the measurement covers the SLEEP state.
+# It has not been run yet, so there are no recorded numbers for the wakeups,
+# the CPU time or the time it takes to leave SLEEP on input.
+#
+# Usage (unix port):
+#   micropython tests/bench_governor.py [seconds] [deadline]
+#
+##############################################################################
+
+import usys
+usys.path.append('') # See: https://github.com/micropython/micropython/issues/6419
+
+import ffi
+import time
+import lvgl as lv
+import lv_utils
+
+SECONDS = int(usys.argv[1]) if len(usys.argv) > 1 else 20
+DEADLINE = len(usys.argv) > 2 and usys.argv[2] == 'deadline'
+
+libc = ffi.open("libc.so.6")
+clock = libc.func("l", "clock", "")
+CLOCKS_PER_SEC = 1000000
+
+lv.init()
+disp = lv.sdl_window_create(480, 320)
+mouse = lv.sdl_mouse_create()
+label = lv.label(lv.scr_act())
+label.set_text('Idle')
+label.center()
+
+class Stats:
+    def __init__(self):
+        self.wakeups = 0
+        self.states = []
+
+    def refresh_cb(self):
+        self.wakeups += 1
+
+    def state_cb(self, state):
+        self.states.append(state)
+
+stats = Stats()
+
+def wait_ms(ms):
+    # Let scheduled callbacks run
+    deadline = time.ticks_add(time.ticks_ms(), ms)
+    while time.ticks_diff(deadline, time.ticks_ms()) > 0:
+        time.sleep_ms(10)
+
+def run(governor):
+    if governor:
+        governor.add_callback(stats.state_cb)
+    event_loop = lv_utils.event_loop(refresh_cb=stats.refresh_cb, deadline=DEADLINE, governor=governor)
+    wait_ms(5000) # Let the governor reach SLEEP
+
+    stats.wakeups = 0
+    start = clock()
+    wait_ms(SECONDS * 1000)
+    cpu = clock() - start
+
+    event_loop.deinit()
+    print('%-12s wakeups/idle min: %6d   cpu ms/idle min: %6d   states: %s' % (
+        'governor' if governor else 'no governor',
+        stats.wakeups * 60 // SECONDS,
+        cpu * 60 * 1000 // (CLOCKS_PER_SEC * SECONDS),
+        stats.states))
+
+print('Event loop:', 'deadline' if DEADLINE else 'fixed frequency')
+run(None)
+run(lv_utils.governor(idle_after=1000, sleep_after=3000))
@@ -0,0 +1,63 @@
+##############################################################################
+# Benchmark the ILI9488 24 bit flush on the virtual SPI LCD
+#
+# Runs driver/esp32/ili9XXX.py (ili9488, 320x480) against lv_spi_lcd with the
+# bus modeled on the clock (realtime=True). The espidf stand-in converts the
+# pixels to 24 bit in chunks of the given size, while the previous chunk is
+# on the bus. With chunk 0 the whole draw buffer is converted before the
+# transfer starts, as the in-place conversion did.
+# Measures per full frame: wall time (rendering + conversion + waiting for the
+# bus) and modeled bus time. Then checks the screen contents.
+#
+# Usage (unix port built with LV_COLOR_DEPTH=32, with driver/esp32 and
+# driver/linux in MICROPYPATH):
+#   micropython tests/bench_ili9488_flush.py [chunk pixels] [MHz] [frames]
+#
+##############################################################################
+
+import usys
+usys.path.append('') # See: https://github.com/micropython/micropython/issues/6419
+
+import time
+import lvgl as lv
+import lv_spi_lcd
+from bench_utils import box_on_red, box_errors
+
+CHUNK = int(usys.argv[1]) if len(usys.argv) > 1 else 1024
+MHZ = int(usys.argv[2]) if len(usys.argv) > 2 else 40
+FRAMES = int(usys.argv[3]) if len(usys.argv) > 3 else 10
+WIDTH, HEIGHT = 320, 480
+
+lcd = lv_spi_lcd.controller(WIDTH, HEIGHT, dc=12, cs=13, realtime=True)
+lv_spi_lcd.install(lcd)
+lv_spi_lcd.ILI9XXX_PANEL_CHUNK_PX = CHUNK if CHUNK > 0 else WIDTH * HEIGHT
+
+from ili9XXX import ili9488
+
+lv.init()
+drv = ili9488(dc=12, cs=13, mhz=MHZ)
+drv.event_loop.disable()
+print('Chunk: %s' % (CHUNK if CHUNK > 0 else 'whole draw buffer'))
+
+scr = lv.scr_act()
+box = box_on_red(scr)
+box.set_pos(140, 200) # Centered, so MADCTL MX does not move it
+
+lcd.reset_stats()
+start = time.ticks_us()
+for i in range(FRAMES):
+    scr.invalidate()
+    lv.refr_now(None)
+lcd.wait(lcd.bus_free)
+wall = time.ticks_diff(time.ticks_us(), start)
+print('full frame: %6d us   bus: %6d us   bytes: %7d' % (
+    wall // FRAMES, int(lcd.transfer_us) // FRAMES, lcd.bytes // FRAMES))
+
+# Check the screen: a blue box on red, whatever the channel order
+
+red, blue = lcd.pixel(0, 0), lcd.pixel(150, 210)
+errors = box_errors(lcd, red, blue, 140, 200)
+ok = errors == 0 and red != blue
+print('Screen check:', 'OK' if ok else 'FAILED (%d pixels)' % errors)
+
+usys.exit(0 if ok else 1)
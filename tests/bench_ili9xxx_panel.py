@@ -0,0 +1,66 @@
+##############################################################################
+# Benchmark the esp32 ili9XXX driver flush paths on the virtual SPI LCD
+#
+# Runs driver/esp32/ili9XXX.py (ili9341, 240x320) against lv_spi_lcd, either
+# with the queued native panel (espidf.ili9xxx_panel_*, mirrored by the
+# lv_spi_lcd espidf stand-in) or with the Python flush (hybrid=False).
+# For a number of full screen and partial refreshes, measures per refresh:
+# - Wall time (LVGL rendering + driver + decoding)
+# - Modeled SPI bus time, and the part of it the caller waited for (blocked)
+# - Transactions, and queued transactions beyond the device queue size
+# Then checks the screen contents pixel for pixel.
+#
+# Usage (unix port built with LV_COLOR_DEPTH=16, with driver/esp32 and
+# driver/linux in MICROPYPATH):
+#   micropython tests/bench_ili9xxx_panel.py [panel|python] [MHz] [refreshes]
+#
+##############################################################################
+
+import usys
+usys.path.append('') # See: https://github.com/micropython/micropython/issues/6419
+
+import time
+import lvgl as lv
+import lv_spi_lcd
+from bench_utils import box_on_red, box_errors
+
+MODE = usys.argv[1] if len(usys.argv) > 1 else 'panel'
+MHZ = int(usys.argv[2]) if len(usys.argv) > 2 else 40
+REFRESHES = int(usys.argv[3]) if len(usys.argv) > 3 else 20
+WIDTH, HEIGHT = 240, 320
+
+lcd = lv_spi_lcd.controller(WIDTH, HEIGHT, dc=12, cs=13)
+lv_spi_lcd.install(lcd)
+
+from ili9XXX import ili9341, COLOR_MODE_RGB
+
+lv.init()
+drv = ili9341(dc=12, cs=13, mhz=MHZ, hybrid=(MODE == 'panel'), colormode=COLOR_MODE_RGB)
+drv.event_loop.disable()
+print('Flush path:', 'native panel' if drv.panel else 'python')
+
+scr = lv.scr_act()
+box = box_on_red(scr)
+
+def run(name, change):
+    lcd.reset_stats()
+    start = time.ticks_us()
+    for i in range(REFRESHES):
+        change(i)
+        lv.refr_now(None)
+    wall = time.ticks_diff(time.ticks_us(), start)
+    print('%-8s wall: %6d us   bus: %6d us   blocked: %6d us   transactions: %4d   queue full: %d   (per refresh)' % (
+        name, wall // REFRESHES, int(lcd.transfer_us) // REFRESHES, int(lcd.blocked_us) // REFRESHES,
+        lcd.transactions // REFRESHES, lcd.queue_full))
+
+run('full', lambda i: scr.invalidate())
+run('partial', lambda i: box.set_pos((i * 7) % (WIDTH - 40), (i * 11) % (HEIGHT - 40)))
+
+# Check the screen, pixel for pixel: a blue box on red
+
+box.set_pos(100, 200)
+lv.refr_now(None)
+errors = box_errors(lcd, 0xF800, 0x001F, 100, 200)
+print('Screen check:', 'OK' if errors == 0 else 'FAILED (%d pixels)' % errors)
+
+usys.exit(1 if errors else 0)
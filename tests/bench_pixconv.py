@@ -0,0 +1,167 @@
+##############################################################################
+# Check and benchmark the pixel format conversion kernels (lvgl.pixconv)
+#
+# Each kernel is checked against a Python reference implementation, with
+# word aligned buffers (the word kernels), with buffers one byte off (the
+# byte fallback), in place, and with a pixel count that is not a multiple of
+# the word size. Then the throughput of both paths is measured.
+#
+# Usage (unix port):
+#   micropython tests/bench_pixconv.py [pixels] [rounds]
+#
+##############################################################################
+
+import usys
+usys.path.append('') # See: https://github.com/micropython/micropython/issues/6419
+
+import time
+import lvgl as lv
+
+PIXELS = int(usys.argv[1]) if len(usys.argv) > 1 else 320 * 48
+ROUNDS = int(usys.argv[2]) if len(usys.argv) > 2 else 20
+pc = lv.pixconv
+
+# Reference implementations: (src bytes per pixel, dst bits per pixel, function(src, n) -> bytes)
+
+def ref_rgb565_swap(s, n):
+    d = bytearray(2 * n)
+    for i in range(n):
+        d[2 * i], d[2 * i + 1] = s[2 * i + 1], s[2 * i]
+    return d
+
+def ref_rgb565_swap_rb(s, n):
+    d = bytearray(2 * n)
+    for i in range(n):
+        p = s[2 * i] | s[2 * i + 1] << 8
+        p = (p & 0x07E0) | (p >> 11) | ((p & 0x1F) << 11)
+        d[2 * i], d[2 * i + 1] = p & 0xFF, p >> 8
+    return d
+
+def ref_xrgb8888_swap_rb(s, n):
+    d = bytearray(4 * n)
+    for i in range(n):
+        d[4 * i:4 * i + 4] = bytes((s[4 * i + 2], s[4 * i + 1], s[4 * i], s[4 * i + 3]))
+    return d
+
+def ref_rgb888_swap_rb(s, n):
+    d = bytearray(3 * n)
+    for i in range(n):
+        d[3 * i:3 * i + 3] = bytes((s[3 * i + 2], s[3 * i + 1], s[3 * i]))
+    return d
+
+def ref_xrgb8888_to_rgb888(s, n, mask=0xFF):
+    d = bytearray(3 * n)
+    for i in range(n):
+        d[3 * i:3 * i + 3] = bytes((s[4 * i] & mask, s[4 * i + 1] & mask, s[4 * i + 2] & mask))
+    return d
+
+def ref_xrgb8888_to_rgb666(s, n):
+    return ref_xrgb8888_to_rgb888(s, n, 0xFC)
+
+def ref_pack_4bpp(s, n):
+    d = bytearray((n + 1) // 2)
+    for i in range(n):
+        d[i // 2] |= s[i] >> 4 if i & 1 else s[i] & 0xF0
+    return d
+
+def ref_pack_1bpp(s, n, threshold=128):
+    d = bytearray((n + 7) // 8)
+    for i in range(n):
+        if s[i] >= threshold:
+            d[i // 8] |= 0x80 >> (i % 8)
+    return d
+
+KERNELS = (
+    ('rgb565_swap', 2, 16, ref_rgb565_swap),
+    ('rgb565_swap_rb', 2, 16, ref_rgb565_swap_rb),
+    ('xrgb8888_swap_rb', 4, 32, ref_xrgb8888_swap_rb),
+    ('rgb888_swap_rb', 3, 24, ref_rgb888_swap_rb),
+    ('xrgb8888_to_rgb888', 4, 24, ref_xrgb8888_to_rgb888),
+    ('xrgb8888_to_rgb666', 4, 24, ref_xrgb8888_to_rgb666),
+    ('pack_4bpp', 1, 4, ref_pack_4bpp),
+    ('pack_1bpp', 1, 1, ref_pack_1bpp),
+)
+
+seed = 12345
+
+def random_bytes(n):
+    global seed
+    b = bytearray(n)
+    for i in range(n):
+        seed = (seed * 1103515245 + 12345) & 0x7FFFFFFF
+        b[i] = (seed >> 16) & 0xFF
+    return b
+
+# Correctness
+
+failures = 0
+
+def check(name, what, got, expected):
+    global failures
+    if bytes(got) != bytes(expected):
+        failures += 1
+        print('FAILED: %s (%s)' % (name, what))
+
+def convert(name, dst, src, n):
+    # pack_1bpp takes a threshold instead of the pixel count
+    if name == 'pack_1bpp':
+        getattr(pc, name)(dst, memoryview(src)[:n])
+    else:
+        getattr(pc, name)(dst, src, n)
+
+for name, src_size, dst_bits, ref in KERNELS:
+    kernel = getattr(pc, name)
+    for n in (0, 1, 3, 4, 5, 7, 8, 9, 31, 64, 67):
+        dst_len = (n * dst_bits + 7) // 8
+        src = random_bytes(n * src_size + 1)
+        expected = ref(src, n)
+        dst = bytearray(dst_len + 1)
+        convert(name, dst, src, n)
+        check(name, 'aligned, n=%d' % n, dst[:dst_len], expected)
+        dst = bytearray(dst_len + 1)
+        convert(name, memoryview(dst)[1:], memoryview(src)[1:], n)
+        check(name, 'unaligned, n=%d' % n, dst[1:], ref(memoryview(src)[1:], n))
+        buf = bytearray(src)
+        convert(name, buf, buf, n)
+        check(name, 'in place, n=%d' % n, buf[:dst_len], expected)
+    if name == 'pack_1bpp':
+        src = random_bytes(64)
+        for threshold in (0, 1, 200, 255):
+            dst = bytearray(8)
+            kernel(dst, src, threshold)
+            check(name, 'threshold=%d' % threshold, dst, ref(src, 64, threshold))
+
+for args in ((bytearray(5), bytearray(8)), (bytearray(8), bytearray(8), 5)):
+    try:
+        pc.xrgb8888_to_rgb888(*args)
+        failures += 1
+        print('FAILED: buffer size not checked')
+    except ValueError:
+        pass
+
+buf = bytearray(16)
+try:
+    pc.rgb565_swap(memoryview(buf)[2:], buf)
+    failures += 1
+    print('FAILED: overlap not checked')
+except ValueError:
+    pass
+
+print('Correctness:', 'OK' if failures == 0 else 'FAILED (%d)' % failures)
+
+# Throughput
+
+print('Throughput, %d pixels x %d rounds (word kernels: %s):' % (PIXELS, ROUNDS, 'yes' if pc.WORD else 'no'))
+for name, src_size, dst_bits, ref in KERNELS:
+    src = bytearray(PIXELS * src_size + 1)
+    dst = bytearray((PIXELS * dst_bits + 7) // 8 + 1)
+    rates = []
+    for s, d in ((src, dst), (memoryview(src)[1:], memoryview(dst)[1:])):
+        start = time.ticks_us()
+        for i in range(ROUNDS):
+            convert(name, d, s, PIXELS)
+        us = max(1, time.ticks_diff(time.ticks_us(), start))
+        rates.append(PIXELS * ROUNDS / us)
+    print('  %-20s word: %7.1f Mpx/s   byte: %7.1f Mpx/s' % (name, rates[0], rates[1]))
+
+usys.exit(1 if failures else 0)
@@ -0,0 +1,114 @@
+##############################################################################
+# Benchmark and check the remote display (lvgl.remote_display)
+#
+# Streams a remote display over a loopback TCP connection, decodes the stream
+# with driver/linux/lv_remote.py on the other end, and measures per frame the
+# bytes sent and the wall time (rendering, comparing, encoding and decoding):
+# - small: a small box moves on a static screen
+# - same: the whole screen is redrawn without changes
+# - full: the whole screen changes color
+# Then checks that the decoded frame equals the frame that was sent, and a
+# headless display rendering the same screen.
+# The stream is read after each frame, so a frame must fit in the loopback
+# socket buffers (the display's writes block).
+#
+# Usage (unix port, with driver/linux in MICROPYPATH):
+#   micropython tests/bench_remote.py [tile] [frames] [port]
+#
+##############################################################################
+
+import usys
+usys.path.append('') # See: https://github.com/micropython/micropython/issues/6419
+
+import time
+import socket
+import lvgl as lv
+import lv_remote
+from bench_utils import scene
+
+TILE = int(usys.argv[1]) if len(usys.argv) > 1 else 16
+FRAMES = int(usys.argv[2]) if len(usys.argv) > 2 else 30
+PORT = int(usys.argv[3]) if len(usys.argv) > 3 else 5999
+WIDTH, HEIGHT = 480, 320
+
+lv.init()
+
+def changes(scr, box):
+    return (
+        ('small', lambda i: box.set_pos((i * 13) % (WIDTH - 40), (i * 7) % (HEIGHT - 30))),
+        ('same', lambda i: scr.invalidate()),
+        ('full', lambda i: scr.set_style_bg_color(lv.color_hex(0x203040 + (i & 1) * 0x101010), 0)),
+    )
+
+# Loopback connection: the display writes to conn, the decoder reads from client
+
+addr = socket.getaddrinfo('127.0.0.1', PORT)[0][-1]
+srv = socket.socket()
+srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+srv.bind(addr)
+srv.listen(1)
+client = socket.socket()
+client.connect(addr)
+conn, _ = srv.accept()
+client.setblocking(False)
+
+decoder = lv_remote.decoder()
+
+def drain():
+    while True:
+        try:
+            data = client.recv(65536)
+        except OSError:
+            return
+        if not data:
+            return
+        decoder.feed(data)
+
+remote = lv.remote_display(WIDTH, HEIGHT, tile=TILE)
+remote.connect(conn.fileno())
+disp = remote.get_disp()
+scr, box = scene(disp, (40, 30), 'lvgl.remote_display')
+lv.refr_now(disp)
+drain()
+
+print('%dx%d, tile %d, raw frame %d bytes:' % (WIDTH, HEIGHT, TILE, len(memoryview(remote))))
+for name, change in changes(scr, box):
+    stats = remote.stats()
+    start = time.ticks_us()
+    for i in range(FRAMES):
+        change(i)
+        lv.refr_now(disp)
+        drain()
+    us = time.ticks_diff(time.ticks_us(), start) // FRAMES
+    after = remote.stats()
+    print('  %-6s %7d bytes   %5d tiles (%5d RLE)   %6d us   per frame' % (
+        name, (after['bytes'] - stats['bytes']) // FRAMES, (after['tiles'] - stats['tiles']) // FRAMES,
+        (after['tiles_rle'] - stats['tiles_rle']) // FRAMES, us))
+
+# Checks: the decoder is in sync with the display, and the display with a headless one
+
+failures = 0
+if bytes(decoder.fb) != bytes(remote):
+    failures += 1
+    print('FAILED: decoded frame differs')
+if decoder.frame + 1 != remote.stats()['frames']:
+    failures += 1
+    print('FAILED: %d frames decoded, %d sent' % (decoder.frame + 1, remote.stats()['frames']))
+
+ref = lv.headless(WIDTH, HEIGHT, render_mode=lv.DISP_RENDER_MODE.PARTIAL)
+ref_scr, ref_box = scene(ref.get_disp(), (40, 30), 'lvgl.remote_display')
+for name, change in changes(ref_scr, ref_box):
+    for i in range(FRAMES):
+        change(i)
+lv.refr_now(ref.get_disp())
+if bytes(ref) != bytes(remote):
+    failures += 1
+    print('FAILED: frame differs from the headless display')
+ref.deinit()
+
+remote.deinit()
+for s in (client, conn, srv):
+    s.close()
+
+print('Stream check:', 'OK' if failures == 0 else 'FAILED (%d)' % failures)
+usys.exit(1 if failures else 0)
@@ -0,0 +1,134 @@
+##############################################################################
+# Check and benchmark the rotation kernels (lvgl.pixconv.rotate16/rotate32)
+# and software rotation in the generic st77xx driver
+#
+# The kernels are checked against a Python reference implementation for all
+# four rotations, including in place rotation by 0 and 180 degrees. Then the
+# throughput of the tiled kernels is compared with a plain pixel by pixel loop
+# (tile size 1), on a draw buffer sized block.
+# Finally the St7789 driver renders the same screen on the virtual SPI LCD
+# controller (lv_spi_lcd) with sw_rot and with MADCTL rotation, and the two
+# GRAM contents are compared.
+#
+# Usage (unix port, with driver/generic and driver/linux in MICROPYPATH):
+#   micropython tests/bench_rotate.py [rot] [width] [height] [rounds]
+#
+##############################################################################
+
+import usys
+usys.path.append('') # See: https://github.com/micropython/micropython/issues/6419
+
+import time
+import lvgl as lv
+
+ROT = int(usys.argv[1]) if len(usys.argv) > 1 else 1
+WIDTH = int(usys.argv[2]) if len(usys.argv) > 2 else 320
+HEIGHT = int(usys.argv[3]) if len(usys.argv) > 3 else 60
+ROUNDS = int(usys.argv[4]) if len(usys.argv) > 4 else 20
+pc = lv.pixconv
+
+def ref_rotate(src, w, h, q, size):
+    d = bytearray(w * h * size)
+    for y in range(h):
+        for x in range(w):
+            if q == 0: k = y * w + x
+            elif q == 1: k = x * h + (h - 1 - y)
+            elif q == 2: k = (h - 1 - y) * w + (w - 1 - x)
+            else: k = (w - 1 - x) * h + y
+            d[k * size:(k + 1) * size] = src[(y * w + x) * size:(y * w + x + 1) * size]
+    return d
+
+seed = 12345
+
+def random_bytes(n):
+    global seed
+    b = bytearray(n)
+    for i in range(n):
+        seed = (seed * 1103515245 + 12345) & 0x7FFFFFFF
+        b[i] = (seed >> 16) & 0xFF
+    return b
+
+# Correctness
+
+failures = 0
+
+def check(what, got, expected):
+    global failures
+    if bytes(got) != bytes(expected):
+        failures += 1
+        print('FAILED: %s' % what)
+
+for name, size in (('rotate16', 2), ('rotate32', 4)):
+    kernel = getattr(pc, name)
+    for w, h in ((1, 1), (1, 7), (7, 1), (5, 3), (16, 16), (17, 33), (40, 23)):
+        src = random_bytes(w * h * size)
+        for q in range(4):
+            expected = ref_rotate(src, w, h, q, size)
+            for tile in (1, 4, pc.ROTATE_TILE):
+                dst = bytearray(w * h * size)
+                kernel(dst, src, w, h, q, tile)
+                check('%s %dx%d q=%d tile=%d' % (name, w, h, q, tile), dst, expected)
+            if q % 2 == 0:
+                buf = bytearray(src)
+                kernel(buf, buf, w, h, q)
+                check('%s %dx%d q=%d in place' % (name, w, h, q), buf, expected)
+
+buf = bytearray(64)
+for args in ((buf, buf, 4, 4, 1), (bytearray(30), bytearray(32), 4, 4, 2), (memoryview(buf)[1:], bytearray(32), 4, 4, 0)):
+    try:
+        pc.rotate16(*args)
+        failures += 1
+        print('FAILED: invalid arguments not checked')
+    except ValueError:
+        pass
+
+print('Correctness:', 'OK' if failures == 0 else 'FAILED (%d)' % failures)
+
+# Throughput
+
+print('Throughput, %dx%d pixels x %d rounds (tile %d):' % (WIDTH, HEIGHT, ROUNDS, pc.ROTATE_TILE))
+for name, size in (('rotate16', 2), ('rotate32', 4)):
+    kernel = getattr(pc, name)
+    src = bytearray(WIDTH * HEIGHT * size)
+    dst = bytearray(WIDTH * HEIGHT * size)
+    for q in (1, 2, 3):
+        rates = []
+        for tile in (pc.ROTATE_TILE, 1):
+            start = time.ticks_us()
+            for i in range(ROUNDS):
+                kernel(dst, src, WIDTH, HEIGHT, q, tile)
+            us = max(1, time.ticks_diff(time.ticks_us(), start))
+            rates.append(WIDTH * HEIGHT * ROUNDS / us)
+        print('  %s %3d deg   tiled: %7.1f Mpx/s   pixel by pixel: %7.1f Mpx/s' % (name, q * 90, rates[0], rates[1]))
+
+# Driver: sw_rot against MADCTL rotation
+
+from bench_utils import solid_box, st7789
+
+lcd, drv = st7789(240, 320, rot=ROT, sw_rot=True)
+
+scr = lv.scr_act()
+scr.set_style_bg_color(lv.color_hex(0x00FF00), 0)
+box = solid_box(scr, 0x0000FF, drv.width // 3, drv.height // 5)
+box.set_pos(drv.width // 8, drv.height // 6)
+label = lv.label(scr)
+label.set_text('rot %d' % ROT)
+label.align(lv.ALIGN.BOTTOM_RIGHT, -4, -4)
+
+frames = []
+for sw_rot in (True, False):
+    drv.sw_rot = sw_rot
+    drv.apply_rotation(ROT)
+    lcd.fb[:] = bytes(len(lcd.fb))
+    start = time.ticks_us()
+    for i in range(ROUNDS):
+        scr.invalidate()
+        lv.refr_now(None)
+    wall = time.ticks_diff(time.ticks_us(), start)
+    print('%-6s wall: %6d us per full refresh' % ('sw_rot' if sw_rot else 'MADCTL', wall // ROUNDS))
+    frames.append(bytes(lcd.fb))
+
+same = frames[0] == frames[1]
+print('Screen check (rot %d):' % ROT, 'OK' if same else 'FAILED')
+
+usys.exit(0 if failures == 0 and same else 1)
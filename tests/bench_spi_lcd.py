@@ -0,0 +1,54 @@
+##############################################################################
+# Benchmark and check an SPI panel driver on the virtual SPI LCD controller
+#
+# Runs the generic st77xx driver (St7789, 240x320, RGB565) against
+# lv_spi_lcd, and for a number of full screen and partial refreshes measures:
+# - Wall time per refresh (LVGL rendering + driver + decoding)
+# - Modeled SPI bus time per refresh, at the given SPI clock
+# - Bytes and transactions per refresh
+# Then checks the screen contents pixel for pixel, and exits with an error when
+# they differ.
+#
+# Usage (unix port, with driver/generic and driver/linux in MICROPYPATH):
+#   micropython tests/bench_spi_lcd.py [MHz] [refreshes]
+#
+##############################################################################
+
+import usys
+usys.path.append('') # See: https://github.com/micropython/micropython/issues/6419
+
+import time
+import lvgl as lv
+from bench_utils import box_on_red, box_errors, st7789
+
+MHZ = int(usys.argv[1]) if len(usys.argv) > 1 else 40
+REFRESHES = int(usys.argv[2]) if len(usys.argv) > 2 else 20
+WIDTH, HEIGHT = 240, 320
+
+lcd, drv = st7789(WIDTH, HEIGHT, mhz=MHZ)
+
+scr = lv.scr_act()
+box = box_on_red(scr)
+
+def run(name, change):
+    lcd.reset_stats()
+    start = time.ticks_us()
+    for i in range(REFRESHES):
+        change(i)
+        lv.refr_now(None)
+    wall = time.ticks_diff(time.ticks_us(), start)
+    print('%-8s wall: %6d us   bus: %6d us   bytes: %7d   transactions: %4d   (per refresh)' % (
+        name, wall // REFRESHES, int(lcd.transfer_us) // REFRESHES, lcd.bytes // REFRESHES, lcd.transactions // REFRESHES))
+
+run('full', lambda i: scr.invalidate())
+run('partial', lambda i: box.set_pos((i * 7) % (WIDTH - 40), (i * 11) % (HEIGHT - 40)))
+
+# Check the screen, pixel for pixel: a blue box on red
+
+box.set_pos(100, 200)
+lv.refr_now(None)
+errors = box_errors(lcd, 0xF800, 0x001F, 100, 200)
+print('Screen check:', 'OK' if errors == 0 else 'FAILED (%d pixels)' % errors)
+print('Modeled max FPS @%dMHz: %d' % (MHZ, MHZ * 1000000 // (WIDTH * HEIGHT * 16)))
+
+usys.exit(1 if errors else 0)
@@ -0,0 +1,56 @@
+##############################################################################
+# Setup shared by the display benchmarks in tests/
+#
+# - scene(disp, box_size, text): a box on a dark screen, with a label
+# - box_on_red(scr), box_errors(lcd, ...): a blue box on a red screen, and
+#   the pixel check of it on the virtual SPI LCD controller (lv_spi_lcd)
+# - st7789(width, height, ...): the generic st77xx driver on lv_spi_lcd
+#
+##############################################################################
+
+import lvgl as lv
+
+def scene(disp, box_size, text):
+    # Returns the screen, and the box to move
+    scr = disp.get_scr_act()
+    scr.set_style_bg_color(lv.color_hex(0x203040), 0)
+    box = lv.obj(scr)
+    box.set_size(*box_size)
+    box.set_style_bg_color(lv.color_hex(0xFFA000), 0)
+    label = lv.label(scr)
+    label.set_text(text)
+    label.align(lv.ALIGN.BOTTOM_MID, 0, -10)
+    return scr, box
+
+def solid_box(parent, color, w, h):
+    box = lv.obj(parent)
+    box.set_size(w, h)
+    box.set_style_bg_color(lv.color_hex(color), 0)
+    box.set_style_border_width(0, 0)
+    box.set_style_radius(0, 0)
+    return box
+
+def box_on_red(scr):
+    scr.set_style_bg_color(lv.color_hex(0xFF0000), 0)
+    return solid_box(scr, 0x0000FF, 40, 40)
+
+def box_errors(lcd, red, blue, x, y):
+    # The number of pixels that are not red outside the 40x40 box at x, y, or not blue inside it
+    return abs(lcd.count(red) + lcd.count(blue, x, y, 40, 40) - lcd.count(red, x, y, 40, 40) - lcd.width * lcd.height)
+
+def st7789(width, height, mhz=40, rot=None, **kw):
+    # Returns the lv_spi_lcd controller and the driver, with its event loop disabled.
+    # lv_spi_lcd must be installed before st77xx imports machine.
+    import lv_spi_lcd
+    lcd = lv_spi_lcd.controller(width, height, dc=12, cs=13)
+    lv_spi_lcd.install(lcd)
+
+    import machine
+    import st77xx
+
+    if not lv.is_initialized():
+        lv.init()
+    drv = st77xx.St7789(res=(width, height), rot=st77xx.ST77XX_PORTRAIT if rot is None else rot,
+        spi=machine.SPI(1, baudrate=mhz * 1000000), dc=12, cs=13, rst=None, **kw)
+    drv.event_loop.disable()
+    return lcd, drv
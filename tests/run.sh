@@ -24,3 +24,36 @@ EXCLUDE_FINDEXP=$(echo $EXCLUDE_PATH | sed "s/^\|[[:space:]]/ -and -not -path /g
 find $TEST_PATH -name "*.py" $EXCLUDE_FINDEXP |\
    parallel --halt-on-error now,fail=1 --max-args=1 --max-procs $NUMCPUS -I {} timeout 5m catchsegv $SCRIPT_PATH/../../../ports/unix/build-standard/micropython $SCRIPT_PATH/run_test.py {}
 
+
+##############################################################################
+# Run the binding's own tests (tests/test_*.py), which check their results
+# and exit with a non zero code on failure
+
+for TEST in $SCRIPT_PATH/test_*.py; do
+   timeout 5m catchsegv $SCRIPT_PATH/../../../ports/unix/build-standard/micropython $TEST
+done
+
+
+##############################################################################
+# Run the correctness checks of the benchmarks, with few frames and rounds.
+# They exit with a non zero code when a check fails.
+# bench_governor (SDL, timed) and bench_batch (timing only) are not run, nor is
+# bench_ili9xxx_panel, which needs a build with LV_COLOR_DEPTH=16.
+
+export MICROPYPATH=".frozen:$SCRIPT_PATH:$SCRIPT_PATH/../lib:$SCRIPT_PATH/../driver/generic:$SCRIPT_PATH/../driver/linux:$SCRIPT_PATH/../driver/esp32"
+
+BENCHES=(
+   "bench_event_loop.py 2"
+   "bench_spi_lcd.py 40 2"
+   "bench_ili9488_flush.py 1024 40 1"
+   "bench_pixconv.py 256 1"
+   "bench_flush_planner.py 200 12 3"
+   "bench_rotate.py 1 64 16 1"
+   "bench_fbdev.py /tmp/lv_fbdev_test.raw 3"
+   "bench_remote.py 16 3"
+   "bench_flush_trace.py /tmp/lv_flush_test.trace 3"
+)
+
+for BENCH in "${BENCHES[@]}"; do
+   timeout 5m catchsegv $SCRIPT_PATH/../../../ports/unix/build-standard/micropython $SCRIPT_PATH/$BENCH
+done
@@ -0,0 +1,79 @@
+##############################################################################
+# Test lv.build (widget tree from a spec) on a headless display
+#
+# Usage (unix port):
+#   micropython tests/test_build.py
+#
+##############################################################################
+
+import usys
+usys.path.append('') # See: https://github.com/micropython/micropython/issues/6419
+
+import lvgl as lv
+
+lv.init()
+hd = lv.headless(240, 320)
+
+failures = 0
+
+def check(name, cond):
+    global failures
+    if not cond:
+        failures += 1
+        print('FAILED:', name)
+
+def raises(exc, f):
+    try:
+        f()
+    except exc:
+        return True
+    return False
+
+clicks = []
+style = lv.style_t()
+style.init()
+style.set_bg_opa(lv.OPA.TRANSP)
+
+names = lv.build(
+    ('obj', {'name': 'screen'}, [
+        ('btn', [('size', (80, 40)), ('align', (lv.ALIGN.CENTER, 0, 10)), ('events', [(clicks.append, lv.EVENT.CLICKED)])], [
+            ('label', {'name': 'ok_label', 'text': 'OK', 'center': ()}),
+        ]),
+        {'type': lv.slider, 'name': 'slider', 'width': 100, 'align': lv.ALIGN.BOTTOM_MID, 'styles': [(style, lv.PART.MAIN)]},
+    ]))
+
+screen = names['screen']
+check('names', sorted(names.keys()) == ['ok_label', 'screen', 'slider'])
+check('root has no parent', screen.get_parent() is None)
+check('children', screen.get_child_cnt() == 2)
+
+btn = screen.get_child(0)
+check('type by name', type(btn) is lv.btn)
+check('tuple prop', btn.get_width() == 80 and btn.get_height() == 40)
+lv.scr_load(screen)
+lv.refr_now(None)
+check('<prop> when only it takes the arguments', btn.get_y() == (320 - 40) // 2 + 10)
+btn.send_event(lv.EVENT.CLICKED, None)
+check('events', len(clicks) == 1)
+
+label = names['ok_label']
+check('nested child', label.get_parent() == btn)
+check('dict prop', label.get_text() == 'OK')
+
+slider = names['slider']
+check('type by class', type(slider) is lv.slider)
+check('set_<prop> first', slider.get_style_align(lv.PART.MAIN) == lv.ALIGN.BOTTOM_MID)
+check('width', slider.get_style_width(lv.PART.MAIN) == 100)
+check('styles', slider.get_style_bg_opa(lv.PART.MAIN) == lv.OPA.TRANSP)
+
+parent = lv.obj()
+names = lv.build(('label', {'name': 'child', 'text': 'x'}), parent)
+check('parent argument', names['child'].get_parent() == parent)
+
+check('unknown type', raises(ValueError, lambda: lv.build(('no_such_widget', {}))))
+check('unknown prop', raises(AttributeError, lambda: lv.build(('obj', {'no_such_prop': 1}))))
+check('too many arguments', raises(ValueError, lambda: lv.build(('obj', {'size': tuple(range(9))}))))
+
+hd.deinit()
+print('lv.build:', 'OK' if failures == 0 else 'FAILED (%d)' % failures)
+usys.exit(1 if failures else 0)
@@ -0,0 +1,93 @@
+##############################################################################
+# Pixel hash regression test of lv.headless
+#
+# - A solid screen has the expected pixels, and hash() matches them
+# - The same scene hashes the same in FULL, DIRECT and PARTIAL render modes,
+#   and when it is rendered again
+# - Changing the scene changes the hash, and undoing the change restores it
+#
+# Usage (unix port):
+#   micropython tests/test_headless.py
+#
+##############################################################################
+
+import usys
+usys.path.append('') # See: https://github.com/micropython/micropython/issues/6419
+
+import lvgl as lv
+
+WIDTH = 64
+HEIGHT = 48
+
+lv.init()
+
+failures = 0
+
+def check(name, cond):
+    global failures
+    if not cond:
+        failures += 1
+        print('FAILED:', name)
+
+def fnv1a(data):
+    h = 2166136261
+    for b in data:
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+def render(hd):
+    lv.refr_now(hd.get_disp())
+    return hd.hash()
+
+def build_scene(hd):
+    scr = hd.get_disp().get_scr_act()
+    scr.set_style_bg_color(lv.color_hex(0x112233), lv.PART.MAIN)
+    scr.set_style_bg_opa(lv.OPA.COVER, lv.PART.MAIN)
+    scr.set_scrollbar_mode(lv.SCROLLBAR_MODE.OFF)
+    return scr
+
+# Solid screen
+
+hd = lv.headless(WIDTH, HEIGHT)
+build_scene(hd)
+solid = render(hd)
+fb = bytes(memoryview(hd))
+px_size = len(fb) // (WIDTH * HEIGHT)
+if px_size == 2:
+    c = (0x11 >> 3) << 11 | (0x22 >> 2) << 5 | (0x33 >> 3)
+    expected = bytes((c & 0xFF, c >> 8))
+else:
+    expected = bytes((0x33, 0x22, 0x11))
+check('solid color', all(fb[i:i + len(expected)] == expected for i in range(0, len(fb), px_size)))
+check('hash matches the framebuffer', solid == fnv1a(fb))
+hd.deinit()
+
+# The same scene in every render mode
+
+hashes = []
+for mode, buf_size in ((lv.DISP_RENDER_MODE.FULL, 0), (lv.DISP_RENDER_MODE.DIRECT, 0), (lv.DISP_RENDER_MODE.PARTIAL, WIDTH * px_size * 5)):
+    hd = lv.headless(WIDTH, HEIGHT, render_mode=mode, buf_size=buf_size)
+    scr = build_scene(hd)
+    btn = lv.btn(scr)
+    btn.set_size(40, 20)
+    btn.align(lv.ALIGN.TOP_LEFT, 4, 4)
+    label = lv.label(scr)
+    label.set_text('Hi')
+    label.align(lv.ALIGN.BOTTOM_RIGHT, -4, -4)
+    first = render(hd)
+    hashes.append(first)
+    check('scene differs from solid (mode %d)' % mode, first != solid)
+    scr.invalidate()
+    check('rendering again (mode %d)' % mode, render(hd) == first)
+    label.set_text('Ho')
+    changed = render(hd)
+    check('change (mode %d)' % mode, changed != first)
+    label.set_text('Hi')
+    check('undo (mode %d)' % mode, render(hd) == first)
+    check('flushed (mode %d)' % mode, hd.flush_count() > 0)
+    hd.deinit()
+
+check('same pixels in every render mode', hashes[0] == hashes[1] == hashes[2])
+
+print('lv.headless:', 'OK' if failures == 0 else 'FAILED (%d)' % failures)
+usys.exit(1 if failures else 0)